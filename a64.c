@@ -0,0 +1,441 @@
+#include "a64.h"
+
+const char *const a64_class_name[A64_NCLASSES] = {
+	[A64_OTHER] = "other",
+	[A64_B] = "b/bl",
+	[A64_BCOND] = "b.cond",
+	[A64_CBZ] = "cbz",
+	[A64_TBZ] = "tbz",
+	[A64_BR_REG] = "br/ret",
+	[A64_ADDSUB_IMM] = "addsub-imm",
+	[A64_LOGIC_IMM] = "logic-imm",
+	[A64_MOVE_WIDE] = "movw",
+	[A64_ADDSUB_REG] = "addsub-reg",
+	[A64_LOGIC_REG] = "logic-reg",
+	[A64_ADR] = "adr",
+	[A64_COND_SELECT] = "csel",
+	[A64_COND_CMP] = "ccmp",
+	[A64_LDST_UIMM] = "ldst",
+	[A64_LDST_PAIR] = "ldst-pair",
+};
+
+const char *const a64_field_name[A64_NFIELDS] = {
+	[A64_F_OPCODE] = "opcode",
+	[A64_F_COND] = "cond",
+	[A64_F_RD] = "rd",
+	[A64_F_RN] = "rn",
+	[A64_F_RM] = "rm",
+	[A64_F_IMM] = "imm",
+	[A64_F_SF] = "size",
+	[A64_F_SHIFT] = "shift",
+};
+
+const char *const a64_outcome_name[A64_NOUTCOMES] = {
+	[A64_O_UNDEFINED] = "undefined",
+	[A64_O_SAME] = "same",
+	[A64_O_REG] = "register",
+	[A64_O_COND] = "condition",
+	[A64_O_TARGET] = "target",
+	[A64_O_OTHER] = "other",
+};
+
+struct a64_span {
+	uint8_t hi, lo;
+	uint8_t field;
+};
+
+#define END { 0, 0, 0xFF }
+
+// Bit spans of each class, highest first. Bits not covered are opcode.
+static const struct a64_span a64_layout[A64_NCLASSES][8] = {
+	[A64_OTHER] = { END },
+	[A64_B] = { { 25, 0, A64_F_IMM }, END },
+	[A64_BCOND] = { { 23, 5, A64_F_IMM }, { 3, 0, A64_F_COND }, END },
+	[A64_CBZ] = { { 31, 31, A64_F_SF }, { 24, 24, A64_F_COND },
+		      { 23, 5, A64_F_IMM }, { 4, 0, A64_F_RN }, END },
+	[A64_TBZ] = { { 31, 31, A64_F_IMM }, { 24, 24, A64_F_COND },
+		      { 23, 5, A64_F_IMM }, { 4, 0, A64_F_RN }, END },
+	[A64_BR_REG] = { { 9, 5, A64_F_RN }, END },
+	[A64_ADDSUB_IMM] = { { 31, 31, A64_F_SF }, { 22, 22, A64_F_SHIFT },
+			     { 21, 10, A64_F_IMM }, { 9, 5, A64_F_RN },
+			     { 4, 0, A64_F_RD }, END },
+	[A64_LOGIC_IMM] = { { 31, 31, A64_F_SF }, { 22, 10, A64_F_IMM },
+			    { 9, 5, A64_F_RN }, { 4, 0, A64_F_RD }, END },
+	[A64_MOVE_WIDE] = { { 31, 31, A64_F_SF }, { 22, 21, A64_F_SHIFT },
+			    { 20, 5, A64_F_IMM }, { 4, 0, A64_F_RD }, END },
+	[A64_ADDSUB_REG] = { { 31, 31, A64_F_SF }, { 23, 22, A64_F_SHIFT },
+			     { 20, 16, A64_F_RM }, { 15, 10, A64_F_SHIFT },
+			     { 9, 5, A64_F_RN }, { 4, 0, A64_F_RD }, END },
+	[A64_LOGIC_REG] = { { 31, 31, A64_F_SF }, { 23, 22, A64_F_SHIFT },
+			    { 20, 16, A64_F_RM }, { 15, 10, A64_F_SHIFT },
+			    { 9, 5, A64_F_RN }, { 4, 0, A64_F_RD }, END },
+	[A64_ADR] = { { 30, 29, A64_F_IMM }, { 23, 5, A64_F_IMM },
+		      { 4, 0, A64_F_RD }, END },
+	[A64_COND_SELECT] = { { 31, 31, A64_F_SF }, { 20, 16, A64_F_RM },
+			      { 15, 12, A64_F_COND }, { 9, 5, A64_F_RN },
+			      { 4, 0, A64_F_RD }, END },
+	[A64_COND_CMP] = { { 31, 31, A64_F_SF }, { 20, 16, A64_F_RM },
+			   { 15, 12, A64_F_COND }, { 9, 5, A64_F_RN },
+			   { 3, 0, A64_F_IMM }, END },
+	[A64_LDST_UIMM] = { { 31, 30, A64_F_SF }, { 21, 10, A64_F_IMM },
+			    { 9, 5, A64_F_RN }, { 4, 0, A64_F_RD }, END },
+	[A64_LDST_PAIR] = { { 31, 30, A64_F_SF }, { 21, 15, A64_F_IMM },
+			    { 14, 10, A64_F_RM }, { 9, 5, A64_F_RN },
+			    { 4, 0, A64_F_RD }, END },
+};
+
+enum a64_class a64_class_of(uint32_t insn)
+{
+	if ((insn & 0x7C000000) == 0x14000000)
+		return A64_B;
+	if ((insn & 0xFF000010) == 0x54000000)
+		return A64_BCOND;
+	if ((insn & 0x7E000000) == 0x34000000)
+		return A64_CBZ;
+	if ((insn & 0x7E000000) == 0x36000000)
+		return A64_TBZ;
+	if ((insn & 0xFE000000) == 0xD6000000)
+		return A64_BR_REG;
+	if ((insn & 0x1F800000) == 0x11000000)
+		return A64_ADDSUB_IMM;
+	if ((insn & 0x1F800000) == 0x12000000)
+		return A64_LOGIC_IMM;
+	if ((insn & 0x1F800000) == 0x12800000)
+		return A64_MOVE_WIDE;
+	if ((insn & 0x1F000000) == 0x0B000000)
+		return A64_ADDSUB_REG;
+	if ((insn & 0x1F000000) == 0x0A000000)
+		return A64_LOGIC_REG;
+	if ((insn & 0x1F000000) == 0x10000000)
+		return A64_ADR;
+	if ((insn & 0x1FE00000) == 0x1A800000)
+		return A64_COND_SELECT;
+	if ((insn & 0x1FE00000) == 0x1A400000)
+		return A64_COND_CMP;
+	if ((insn & 0x3B000000) == 0x39000000)
+		return A64_LDST_UIMM;
+	if ((insn & 0x3A000000) == 0x28000000)
+		return A64_LDST_PAIR;
+	return A64_OTHER;
+}
+
+static enum a64_field field_in(enum a64_class cls, int bit)
+{
+	const struct a64_span *s = a64_layout[cls];
+
+	for (; s->field != 0xFF; s++) {
+		if (bit <= s->hi && bit >= s->lo)
+			return s->field;
+	}
+	return A64_F_OPCODE;
+}
+
+enum a64_field a64_field_of(uint32_t insn, int bit)
+{
+	return field_in(a64_class_of(insn), bit);
+}
+
+int a64_is_call(uint32_t insn)
+{
+	return (insn & 0xFC000000) == 0x94000000; // bl
+}
+
+int a64_is_cond_branch(uint32_t insn)
+{
+	enum a64_class c = a64_class_of(insn);
+
+	return c == A64_BCOND || c == A64_CBZ || c == A64_TBZ;
+}
+
+int a64_is_branch(uint32_t insn)
+{
+	enum a64_class c = a64_class_of(insn);
+
+	return c == A64_B || c == A64_BR_REG || a64_is_cond_branch(insn);
+}
+
+int a64_sets_flags(uint32_t insn)
+{
+	switch (a64_class_of(insn)) {
+	case A64_ADDSUB_IMM:
+	case A64_ADDSUB_REG:
+		return (insn >> 29) & 1; // S
+	case A64_LOGIC_IMM:
+	case A64_LOGIC_REG:
+		return ((insn >> 29) & 3) == 3; // ands
+	case A64_COND_CMP:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static int64_t sext(uint64_t v, int bits)
+{
+	return (int64_t)(v << (64 - bits)) >> (64 - bits);
+}
+
+int64_t a64_branch_disp(uint32_t insn)
+{
+	switch (a64_class_of(insn)) {
+	case A64_B:
+		return sext(insn & 0x3FFFFFF, 26);
+	case A64_BCOND:
+	case A64_CBZ:
+		return sext((insn >> 5) & 0x7FFFF, 19);
+	case A64_TBZ:
+		return sext((insn >> 5) & 0x3FFF, 14);
+	default:
+		return 0;
+	}
+}
+
+// Branch displacement bits; the rest of a tbz immediate is the bit tested.
+static const uint32_t a64_disp_bits[A64_NCLASSES] = {
+	[A64_B] = 0x03FFFFFF,
+	[A64_BCOND] = 0x00FFFFE0,
+	[A64_CBZ] = 0x00FFFFE0,
+	[A64_TBZ] = 0x0007FFE0,
+};
+
+// Bits whose outcome depends on more than the field they land in: opcode
+// and size bits, and fields where some values are unallocated or
+// equivalent (the N:imms of a logical immediate, AL and NV conditions, a
+// shift of zero, ...).
+static const uint32_t a64_decode_bits[A64_NCLASSES] = {
+	[A64_OTHER] = 0xFFFFFFFF,
+	[A64_B] = 0xFC000000,
+	[A64_BCOND] = 0xFF00001F,
+	[A64_CBZ] = 0xFE000000,
+	[A64_TBZ] = 0x7E000000,
+	[A64_BR_REG] = 0xFFFFFC1F,
+	[A64_ADDSUB_IMM] = 0xFFC00000,
+	[A64_LOGIC_IMM] = 0xFFFFFC00,
+	[A64_MOVE_WIDE] = 0xFFE00000,
+	[A64_ADDSUB_REG] = 0xFFE0FC00,
+	[A64_LOGIC_REG] = 0xFFE0FC00,
+	[A64_ADR] = 0x9F000000,
+	[A64_COND_SELECT] = 0xFFE0FC00,
+	[A64_COND_CMP] = 0xFFFFFC10,
+	[A64_LDST_UIMM] = 0xFFC00000,
+	[A64_LDST_PAIR] = 0xFFC00000,
+};
+
+static int logic_imm_reserved(uint32_t insn)
+{
+	unsigned n = (insn >> 22) & 1, imms = (insn >> 10) & 0x3F;
+	unsigned v = (n << 6) | (~imms & 0x3F), len = 0, levels;
+
+	if (!(insn >> 31) && n)
+		return 1;
+	while (v >>= 1)
+		len++;
+	if (len < 1)
+		return 1;
+	levels = (1u << len) - 1;
+	return (imms & levels) == levels; // an element of all ones
+}
+
+static int is_prfm(uint32_t insn)
+{
+	return (insn & 0xFFC00000) == 0xF9800000;
+}
+
+static int unallocated(uint32_t insn, enum a64_class cls)
+{
+	unsigned op1 = (insn >> 25) & 0xF;
+
+	// reserved (udf), and the two unallocated top-level groups; SME
+	// shares op1 0000 with bit 31 set
+	if ((op1 == 0x0 && !(insn >> 31)) || op1 == 0x1 || op1 == 0x3)
+		return 1;
+
+	switch (cls) {
+	case A64_BR_REG: {
+		unsigned opc = (insn >> 21) & 0xF, op3 = (insn >> 10) & 0x3F;
+
+		// eret and drps are undefined at EL0
+		if (((insn >> 16) & 0x1F) != 0x1F ||
+		    !(opc <= 2 || opc == 8 || opc == 9))
+			return 1;
+		return opc <= 2 && op3 != 2 && op3 != 3 &&
+		       (op3 != 0 || (insn & 0x1F));
+	}
+	case A64_LOGIC_IMM:
+		return logic_imm_reserved(insn);
+	case A64_MOVE_WIDE:
+		return ((insn >> 29) & 3) == 1 ||
+		       (!(insn >> 31) && ((insn >> 22) & 1));
+	case A64_ADDSUB_REG:
+		if ((insn >> 21) & 1) // extended register
+			return ((insn >> 22) & 3) || ((insn >> 10) & 7) > 4;
+		return ((insn >> 22) & 3) == 3 ||
+		       (!(insn >> 31) && ((insn >> 15) & 1));
+	case A64_LOGIC_REG:
+		return !(insn >> 31) && ((insn >> 15) & 1);
+	case A64_COND_SELECT:
+		return ((insn >> 29) & 1) || ((insn >> 11) & 1);
+	case A64_COND_CMP:
+		return !((insn >> 29) & 1) || (insn & 0x410);
+	case A64_LDST_UIMM: {
+		unsigned size = insn >> 30, opc = (insn >> 22) & 3;
+
+		if ((insn >> 26) & 1) // SIMD&FP, only q registers take opc 1x
+			return size && opc >= 2;
+		return size >= 2 && opc == 3;
+	}
+	case A64_LDST_PAIR:
+		return (insn >> 30) == 3;
+	default:
+		return 0;
+	}
+}
+
+int a64_is_unallocated(uint32_t insn)
+{
+	return unallocated(insn, a64_class_of(insn));
+}
+
+static int always(unsigned cond)
+{
+	return cond >= 14; // AL, and NV which behaves as AL
+}
+
+// `a` and `b` are allocated encodings of class `cls`, `b` with some bits of
+// `a` flipped.
+static int same_semantics(uint32_t a, uint32_t b, enum a64_class cls)
+{
+	uint32_t diff = a ^ b;
+
+	switch (cls) {
+	case A64_BCOND:
+		return !(diff & ~0xFu) && always(a & 0xF) && always(b & 0xF);
+	case A64_COND_SELECT:
+		if (diff & ~0xF000u)
+			return 0;
+		// csel xd, xn, xn, cond
+		if (!(a & 0x40000C00) && ((a >> 5) & 0x1F) == ((a >> 16) & 0x1F))
+			return 1;
+		return always((a >> 12) & 0xF) && always((b >> 12) & 0xF);
+	case A64_COND_CMP:
+		return !(diff & ~0xF000u) && always((a >> 12) & 0xF) &&
+		       always((b >> 12) & 0xF);
+	case A64_ADDSUB_IMM:
+		return diff == 1u << 22 && !((a >> 10) & 0xFFF);
+	case A64_MOVE_WIDE:
+		// movn and movz of zero, whatever the shift
+		return !(diff & ~0x600000u) && ((a >> 29) & 3) != 3 &&
+		       !((a >> 5) & 0xFFFF);
+	case A64_ADDSUB_REG:
+		if ((a >> 21) & 1)
+			return 0;
+		/* fall through */
+	case A64_LOGIC_REG:
+		return !(diff & ~0xC00000u) && !((a >> 10) & 0x3F);
+	case A64_LDST_UIMM:
+		// prefetches have no architectural effect
+		return is_prfm(a) && is_prfm(b);
+	default:
+		return 0;
+	}
+}
+
+int a64_equivalent(uint32_t a, uint32_t b)
+{
+	enum a64_class cls = a64_class_of(a);
+
+	if (a == b)
+		return 1;
+	if (cls == A64_OTHER || a64_class_of(b) != cls ||
+	    unallocated(a, cls) || unallocated(b, cls))
+		return 0;
+	return same_semantics(a, b, cls);
+}
+
+static enum a64_outcome field_outcome(enum a64_class cls, int bit)
+{
+	switch (field_in(cls, bit)) {
+	case A64_F_RD:
+	case A64_F_RN:
+	case A64_F_RM:
+		return A64_O_REG;
+	case A64_F_COND:
+		return A64_O_COND;
+	case A64_F_IMM:
+		return (a64_disp_bits[cls] >> bit) & 1 ? A64_O_TARGET :
+							  A64_O_OTHER;
+	default:
+		return A64_O_OTHER;
+	}
+}
+
+static enum a64_outcome outcome(uint32_t insn, enum a64_class cls,
+			       int insn_unallocated, uint32_t mask)
+{
+	uint32_t flipped = insn ^ mask;
+	enum a64_class fcls = a64_class_of(flipped);
+	enum a64_outcome o;
+
+	if (unallocated(flipped, fcls))
+		return A64_O_UNDEFINED;
+	if (cls == A64_OTHER || fcls != cls)
+		return A64_O_OTHER;
+	if (!insn_unallocated && same_semantics(insn, flipped, cls))
+		return A64_O_SAME;
+	// ccmp (immediate) keeps an imm5 where the register form has Rm
+	if (cls == A64_COND_CMP && (mask & 0x1F0000) && (insn & 0x800))
+		return A64_O_OTHER;
+	// several registers are still a register, a register and a
+	// condition are something else
+	o = field_outcome(cls, __builtin_ctz(mask));
+	for (mask &= mask - 1; mask; mask &= mask - 1) {
+		if (field_outcome(cls, __builtin_ctz(mask)) != o)
+			return A64_O_OTHER;
+	}
+	return o;
+}
+
+enum a64_outcome a64_flip_outcome(uint32_t insn, int bit)
+{
+	return a64_mask_outcome(insn, 1u << bit);
+}
+
+enum a64_outcome a64_mask_outcome(uint32_t insn, uint32_t mask)
+{
+	enum a64_class cls = a64_class_of(insn);
+
+	return outcome(insn, cls, unallocated(insn, cls), mask);
+}
+
+void a64_classify(const uint32_t *insns, size_t n, struct a64_flips *out)
+{
+	static const struct a64_flips none;
+	struct a64_flips table[A64_NCLASSES];
+
+	for (int c = 0; c < A64_NCLASSES; c++) {
+		table[c] = none;
+		for (int bit = 0; bit < 32; bit++) {
+			if (!((a64_decode_bits[c] >> bit) & 1))
+				table[c].bits[field_outcome(c, bit)] |= 1u << bit;
+		}
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		uint32_t insn = insns[i], slow = 0xFFFFFFFF;
+		enum a64_class cls = a64_class_of(insn);
+		int unalloc = unallocated(insn, cls);
+
+		if (unalloc || is_prfm(insn)) {
+			out[i] = none;
+		} else {
+			out[i] = table[cls];
+			slow = a64_decode_bits[cls];
+		}
+		for (; slow; slow &= slow - 1) {
+			int bit = __builtin_ctz(slow);
+
+			out[i].bits[outcome(insn, cls, unalloc, 1u << bit)] |=
+				1u << bit;
+		}
+	}
+}
@@ -0,0 +1,90 @@
+#ifndef A64_H
+#define A64_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Just enough AArch64 decoding to tell which encoding class an instruction
+ * belongs to and which field of that class each bit lands in. Flips in the
+ * same field of the same class tend to have the same kind of effect.
+ */
+
+enum a64_class {
+	A64_OTHER,
+	A64_B, // b, bl
+	A64_BCOND,
+	A64_CBZ, // cbz, cbnz
+	A64_TBZ, // tbz, tbnz
+	A64_BR_REG, // br, blr, ret
+	A64_ADDSUB_IMM, // add, adds, sub, subs, cmp, cmn (immediate)
+	A64_LOGIC_IMM, // and, orr, eor, ands, tst (immediate)
+	A64_MOVE_WIDE, // movn, movz, movk
+	A64_ADDSUB_REG, // add, sub, cmp (shifted or extended register)
+	A64_LOGIC_REG, // and, orr, eor, ands, mov (shifted register)
+	A64_ADR, // adr, adrp
+	A64_COND_SELECT, // csel, csinc, cset, ...
+	A64_COND_CMP, // ccmp, ccmn
+	A64_LDST_UIMM, // ldr, str (unsigned offset)
+	A64_LDST_PAIR, // ldp, stp
+	A64_NCLASSES,
+};
+
+enum a64_field {
+	A64_F_OPCODE,
+	A64_F_COND, // condition code, or the sense of cbz/tbz
+	A64_F_RD, // destination, or the data register of a load/store
+	A64_F_RN,
+	A64_F_RM,
+	A64_F_IMM, // immediates, including branch offsets
+	A64_F_SF, // operand or access size
+	A64_F_SHIFT,
+	A64_NFIELDS,
+};
+
+// What an instruction turns into with some of its bits flipped.
+enum a64_outcome {
+	A64_O_UNDEFINED, // unallocated, the victim takes SIGILL
+	A64_O_SAME, // a different encoding of the same operation
+	A64_O_REG, // another register
+	A64_O_COND, // another condition, or the sense of cbz/tbz
+	A64_O_TARGET, // another branch target
+	A64_O_OTHER, // another operation or operand value
+	A64_NOUTCOMES,
+};
+
+// Outcomes of all 32 flips of one instruction, as a bit mask per outcome.
+struct a64_flips {
+	uint32_t bits[A64_NOUTCOMES];
+};
+
+extern const char *const a64_class_name[A64_NCLASSES];
+extern const char *const a64_field_name[A64_NFIELDS];
+extern const char *const a64_outcome_name[A64_NOUTCOMES];
+
+enum a64_class a64_class_of(uint32_t insn);
+enum a64_field a64_field_of(uint32_t insn, int bit);
+
+int a64_is_call(uint32_t insn);
+int a64_is_cond_branch(uint32_t insn);
+int a64_is_branch(uint32_t insn);
+int a64_sets_flags(uint32_t insn);
+// Target as an instruction count relative to the branch, 0 if indirect.
+int64_t a64_branch_disp(uint32_t insn);
+
+// Only encodings known to be unallocated for user code, anything the
+// decoder does not understand counts as allocated.
+int a64_is_unallocated(uint32_t insn);
+enum a64_outcome a64_flip_outcome(uint32_t insn, int bit);
+// The same with every bit set in `mask` flipped at once. Bits landing in
+// different kinds of field make A64_O_OTHER.
+enum a64_outcome a64_mask_outcome(uint32_t insn, uint32_t mask);
+// Whether two words do the same thing: equal, or allocated encodings of
+// one operation, e.g. b.al and b.nv.
+int a64_equivalent(uint32_t a, uint32_t b);
+// a64_flip_outcome() of every bit of `n` instructions. Bits whose outcome
+// follows from the field they land in come from a per-class table, only
+// the rest are decoded.
+void a64_classify(const uint32_t *insns, size_t n, struct a64_flips *out);
+
+#endif
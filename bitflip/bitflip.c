@@ -7,11 +7,28 @@
 #include <linux/highmem.h>
 #include <linux/uaccess.h>
 #include <linux/sched.h>
+#include <linux/sched/mm.h>
+#include <linux/slab.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/vmalloc.h>
+#include <linux/spinlock.h>
+#include <linux/log2.h>
+#include <linux/kref.h>
+#include <linux/hrtimer.h>
+#include <linux/irq_work.h>
+#include <linux/perf_event.h>
+#include <linux/uprobes.h>
+#include <linux/namei.h>
+#include <linux/fs.h>
+#include <asm/cacheflush.h>
+#include <asm/tlbflush.h>
+
+#include "bitflip.h"
 
 #define DEVICE_NAME "bitflip"
 #define N_MINORS 1
-#define BITFLIP_MAGIC 0xF5
-#define IOCTL_FLIP_BIT _IOW(BITFLIP_MAGIC, 0, unsigned long)
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Yi-Chi Lee");
@@ -22,28 +39,161 @@ static struct cdev bf_dev;
 static dev_t dev_num;
 static struct class *cls;
 
-static int bitflip_core_op(unsigned long, pid_t, int, int);
+struct bitflip_ctx;
+struct timed_flip;
+struct uprobe_flip;
+
+static int bitflip_flip_op(unsigned long, pid_t, int);
+static int bitflip_lazy_op(unsigned long, pid_t, int);
+static int bitflip_pfn_op(unsigned long, pid_t, int);
+static int bitflip_timed_op(struct bitflip_ctx *,
+			    const struct bitflip_timed_args *);
+static int bitflip_mask_op(const struct bitflip_mask_args *);
+static int bitflip_uprobe_op(struct bitflip_ctx *,
+			     const struct bitflip_uprobe_args *);
+static bool bitflip_post_cqe(struct bitflip_ctx *, u64, int);
+static void timed_flip_cancel(struct timed_flip *);
+static void uprobe_flip_cancel(struct uprobe_flip *);
+static int bitflip_open(struct inode *, struct file *);
+static int bitflip_release(struct inode *, struct file *);
+static int bitflip_mmap(struct file *, struct vm_area_struct *);
 static long bitflip_ioctl(struct file *, unsigned int, unsigned long);
 
-static struct file_operations bf_fops = { .unlocked_ioctl = bitflip_ioctl };
+static struct file_operations bf_fops = {
+	.owner = THIS_MODULE,
+	.open = bitflip_open,
+	.release = bitflip_release,
+	.mmap = bitflip_mmap,
+	.unlocked_ioctl = bitflip_ioctl
+};
+
+static bool verbose = true;
+module_param(verbose, bool, 0644);
+MODULE_PARM_DESC(verbose, "Log every flip, turn off for high-rate rings");
+
+#define bf_info(fmt, ...)				\
+	do {						\
+		if (verbose)				\
+			pr_info(fmt, ##__VA_ARGS__);	\
+	} while (0)
 
-struct bitflip_args {
+// Per open file: the optional shared submission/completion rings. Timed
+// flips hold a reference until they have posted their completion.
+struct bitflip_ctx {
+	struct kref ref;
+	struct mutex lock; // serialises ring setup, mmap and consumption
+	spinlock_t cq_lock;
+	void *ring;
+	size_t ring_size;
+	struct bitflip_ring_hdr *hdr;
+	struct bitflip_sqe *sqes;
+	struct bitflip_cqe *cqes;
+	u32 sq_entries;
+	u32 cq_entries;
+	// private copies, userspace may scribble over the shared indices
+	u32 sq_head;
+	u32 cq_tail;
+};
+
+// Deferred flips are kept per victim page until the page is touched again.
+// lazy_poll() only notices the access afterwards, through the access flag,
+// so the flip lands up to a poll period, in jiffies, after the access that
+// set it. Any access sets it, including remote reads by the attacker, and
+// reclaim may clear it before the poll sees it.
+struct lazy_flip {
+	struct list_head node;
 	unsigned long vaddr;
+	int target_bit;
+};
+
+struct lazy_page {
+	struct list_head node;
+	struct list_head flips;
+	struct mm_struct *mm;
 	pid_t pid;
+	unsigned long addr;
+};
+
+static LIST_HEAD(lazy_pages);
+static DEFINE_MUTEX(lazy_lock);
+
+static void lazy_poll(struct work_struct *);
+static DECLARE_DELAYED_WORK(lazy_work, lazy_poll);
+
+/*
+ * Timed flips pin the target page when armed, so the flip itself is a
+ * single store from the hrtimer or PMU overflow handler without faulting
+ * or stopping the victim, plus cache maintenance on code pages. Cleanup
+ * runs from bitflip_wq.
+ */
+struct timed_flip {
+	struct list_head node;
+	struct bitflip_ctx *ctx;
+	struct page *page;
+	unsigned int offset;
+	u64 mask;
+	u64 user_data;
+	bool exec;
+	int res;
+	u64 armed_ns;
+	u64 fired_ns;
+	atomic_t fired;
+	struct hrtimer timer;
+	struct perf_event *event;
+	struct irq_work irq_work;
+	struct work_struct work;
+};
+
+static LIST_HEAD(timed_flips);
+static DEFINE_MUTEX(timed_lock);
+static struct workqueue_struct *bitflip_wq;
+
+/*
+ * PC-triggered flips: a uprobe whose handler runs in the victim's context
+ * right before the probed instruction. The filter keeps the breakpoint out
+ * of every mm but the victim's, and the probe is dropped after one hit.
+ */
+struct uprobe_flip {
+	struct list_head node;
+	struct bitflip_ctx *ctx;
+	struct inode *inode;
+	loff_t offset;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 12, 0)
+	struct uprobe *uprobe;
+#endif
+	struct uprobe_consumer consumer;
+	struct mm_struct *mm;
+	unsigned long vaddr;
 	int target_bit;
-	int pfn_shift;
+	u64 user_data;
+	atomic_t fired;
+	struct work_struct work;
 };
 
+static LIST_HEAD(uprobe_flips);
+static DEFINE_MUTEX(uprobe_lock);
+
+static unsigned int lazy_poll_ms = 1;
+module_param(lazy_poll_ms, uint, 0644);
+MODULE_PARM_DESC(lazy_poll_ms,
+		 "Interval in ms for checking pages with deferred flips "
+		 "(rounded up to jiffies)");
+
 static int __init bitflip_init(void)
 {
 	int alloc_ret = -1;
 	pr_info("[bitflip] Initializing the module\n");
 
+	bitflip_wq = alloc_workqueue("bitflip", WQ_UNBOUND, 0);
+	if (!bitflip_wq)
+		return -ENOMEM;
+
 	alloc_ret = alloc_chrdev_region(&dev_num, 0, N_MINORS, DEVICE_NAME);
 	if (alloc_ret) {
 		pr_alert(
 			"[bitflip] Failed to register device with error = %d\n",
 			alloc_ret);
+		destroy_workqueue(bitflip_wq);
 		return alloc_ret;
 	}
 
@@ -63,18 +213,286 @@ static int __init bitflip_init(void)
 	return 0;
 }
 
+static void lazy_page_free(struct lazy_page *lp)
+{
+	struct lazy_flip *flip, *tmp;
+
+	list_for_each_entry_safe(flip, tmp, &lp->flips, node) {
+		list_del(&flip->node);
+		kfree(flip);
+	}
+	list_del(&lp->node);
+	mmdrop(lp->mm);
+	kfree(lp);
+}
+
 static void __exit bitflip_exit(void)
 {
+	struct lazy_page *lp, *tmp;
+	struct timed_flip *tf;
+	struct uprobe_flip *uf;
+
 	pr_info("[bitflip] Cleaning up the module\n");
+	cancel_delayed_work_sync(&lazy_work);
+	list_for_each_entry_safe(lp, tmp, &lazy_pages, node)
+		lazy_page_free(lp);
+
+	// cancel what has not fired yet, the cleanup work frees every entry
+	mutex_lock(&timed_lock);
+	list_for_each_entry(tf, &timed_flips, node)
+		timed_flip_cancel(tf);
+	mutex_unlock(&timed_lock);
+
+	mutex_lock(&uprobe_lock);
+	list_for_each_entry(uf, &uprobe_flips, node)
+		uprobe_flip_cancel(uf);
+	mutex_unlock(&uprobe_lock);
+	destroy_workqueue(bitflip_wq);
+
 	device_destroy(cls, dev_num);
 	class_destroy(cls);
 	unregister_chrdev_region(dev_num, N_MINORS);
 	pr_info("[bitflip] Module cleanup completed\n");
 }
 
-static long bitflip_ioctl(struct file *, unsigned int cmd, unsigned long arg)
+static int bitflip_open(struct inode *inode, struct file *file)
+{
+	struct bitflip_ctx *ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+
+	if (!ctx)
+		return -ENOMEM;
+	kref_init(&ctx->ref);
+	mutex_init(&ctx->lock);
+	spin_lock_init(&ctx->cq_lock);
+	file->private_data = ctx;
+	return 0;
+}
+
+static void bitflip_ctx_free(struct kref *ref)
+{
+	struct bitflip_ctx *ctx = container_of(ref, struct bitflip_ctx, ref);
+
+	vfree(ctx->ring);
+	kfree(ctx);
+}
+
+static int bitflip_release(struct inode *inode, struct file *file)
+{
+	struct bitflip_ctx *ctx = file->private_data;
+	struct timed_flip *tf;
+	struct uprobe_flip *uf;
+
+	// a timer far out or a count the victim never retires would keep
+	// the page pinned, the event and the ctx until rmmod; so would a
+	// probe the victim never reaches
+	mutex_lock(&timed_lock);
+	list_for_each_entry(tf, &timed_flips, node) {
+		if (tf->ctx == ctx)
+			timed_flip_cancel(tf);
+	}
+	mutex_unlock(&timed_lock);
+
+	mutex_lock(&uprobe_lock);
+	list_for_each_entry(uf, &uprobe_flips, node) {
+		if (uf->ctx == ctx)
+			uprobe_flip_cancel(uf);
+	}
+	mutex_unlock(&uprobe_lock);
+
+	kref_put(&ctx->ref, bitflip_ctx_free);
+	return 0;
+}
+
+static long bitflip_ring_setup(struct bitflip_ctx *ctx,
+			       struct bitflip_ring_params __user *uparams)
+{
+	struct bitflip_ring_params params;
+	size_t sq_off, cq_off, size;
+	void *ring;
+
+	if (copy_from_user(&params, uparams, sizeof(params)))
+		return -EFAULT;
+	if (!params.sq_entries || params.sq_entries > BITFLIP_RING_MAX ||
+	    !is_power_of_2(params.sq_entries))
+		return -EINVAL;
+
+	sq_off = L1_CACHE_ALIGN(sizeof(struct bitflip_ring_hdr));
+	cq_off = L1_CACHE_ALIGN(sq_off +
+				params.sq_entries * sizeof(struct bitflip_sqe));
+	size = PAGE_ALIGN(cq_off +
+			  2 * params.sq_entries * sizeof(struct bitflip_cqe));
+
+	ring = vmalloc_user(size);
+	if (!ring)
+		return -ENOMEM;
+
+	mutex_lock(&ctx->lock);
+	if (ctx->ring) {
+		mutex_unlock(&ctx->lock);
+		vfree(ring);
+		return -EBUSY;
+	}
+	ctx->ring = ring;
+	ctx->ring_size = size;
+	ctx->hdr = ring;
+	ctx->sqes = ring + sq_off;
+	ctx->cqes = ring + cq_off;
+	ctx->sq_entries = params.sq_entries;
+	ctx->cq_entries = 2 * params.sq_entries;
+	ctx->hdr->sq_mask = ctx->sq_entries - 1;
+	ctx->hdr->cq_mask = ctx->cq_entries - 1;
+	mutex_unlock(&ctx->lock);
+
+	params.cq_entries = 2 * params.sq_entries;
+	params.sq_off = sq_off;
+	params.cq_off = cq_off;
+	params.size = size;
+	if (copy_to_user(uparams, &params, sizeof(params)))
+		return -EFAULT;
+
+	pr_info("[bitflip] Ring set up with %u entries, %zu bytes\n",
+		params.sq_entries, size);
+	return 0;
+}
+
+static int bitflip_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct bitflip_ctx *ctx = file->private_data;
+	int ret;
+
+	mutex_lock(&ctx->lock);
+	if (!ctx->ring || vma->vm_pgoff ||
+	    vma->vm_end - vma->vm_start > ctx->ring_size)
+		ret = -EINVAL;
+	else
+		ret = remap_vmalloc_range(vma, ctx->ring, 0);
+	mutex_unlock(&ctx->lock);
+
+	return ret;
+}
+
+// Returns false and counts an overflow if the completion ring is full.
+static bool bitflip_post_cqe(struct bitflip_ctx *ctx, u64 user_data, int res)
+{
+	struct bitflip_cqe *cqe;
+	unsigned long flags;
+	bool posted = false;
+
+	spin_lock_irqsave(&ctx->cq_lock, flags);
+	if (ctx->cq_tail - smp_load_acquire(&ctx->hdr->cq_head) <
+	    ctx->cq_entries) {
+		cqe = &ctx->cqes[ctx->cq_tail & (ctx->cq_entries - 1)];
+		cqe->user_data = user_data;
+		cqe->res = res;
+		cqe->flags = 0;
+		ctx->cq_tail++;
+		smp_store_release(&ctx->hdr->cq_tail, ctx->cq_tail);
+		posted = true;
+	} else {
+		WRITE_ONCE(ctx->hdr->cq_overflow, ctx->hdr->cq_overflow + 1);
+	}
+	spin_unlock_irqrestore(&ctx->cq_lock, flags);
+
+	return posted;
+}
+
+static int bitflip_run_sqe(const struct bitflip_sqe *sqe)
+{
+	switch (sqe->opcode) {
+	case BITFLIP_OP_FLIP:
+		return bitflip_flip_op(sqe->vaddr, sqe->pid, sqe->target_bit);
+	case BITFLIP_OP_FLIP_LAZY:
+		return bitflip_lazy_op(sqe->vaddr, sqe->pid, sqe->target_bit);
+	case BITFLIP_OP_FLIP_PFN:
+		return bitflip_pfn_op(sqe->vaddr, sqe->pid, sqe->pfn_shift);
+	default:
+		return -EINVAL;
+	}
+}
+
+static long bitflip_ring_enter(struct bitflip_ctx *ctx,
+			       unsigned long to_submit)
+{
+	long done = 0;
+	u32 tail;
+
+	mutex_lock(&ctx->lock);
+	if (!ctx->ring) {
+		mutex_unlock(&ctx->lock);
+		return -EINVAL;
+	}
+
+	tail = smp_load_acquire(&ctx->hdr->sq_tail);
+	while (ctx->sq_head != tail && (!to_submit || done < to_submit)) {
+		struct bitflip_sqe sqe;
+
+		// leave the SQE queued while its completion has nowhere to go
+		if (READ_ONCE(ctx->cq_tail) -
+			    smp_load_acquire(&ctx->hdr->cq_head) >=
+		    ctx->cq_entries)
+			break;
+
+		memcpy(&sqe, &ctx->sqes[ctx->sq_head & (ctx->sq_entries - 1)],
+		       sizeof(sqe));
+		ctx->sq_head++;
+		smp_store_release(&ctx->hdr->sq_head, ctx->sq_head);
+
+		bitflip_post_cqe(ctx, sqe.user_data, bitflip_run_sqe(&sqe));
+		done++;
+
+		if (fatal_signal_pending(current))
+			break;
+		cond_resched();
+	}
+	mutex_unlock(&ctx->lock);
+
+	return done;
+}
+
+static long bitflip_ioctl(struct file *file, unsigned int cmd,
+			  unsigned long arg)
 {
 	switch (cmd) {
+	case IOCTL_RING_SETUP:
+		return bitflip_ring_setup(file->private_data,
+					  (struct bitflip_ring_params __user *)arg);
+	case IOCTL_RING_ENTER:
+		return bitflip_ring_enter(file->private_data, arg);
+	case IOCTL_FLIP_TIMED: {
+		struct bitflip_timed_args timed_args;
+
+		if (copy_from_user(&timed_args,
+				   (struct bitflip_timed_args __user *)arg,
+				   sizeof(timed_args)))
+			return -EFAULT;
+		bf_info("[ioctl] timed vaddr: %#lx, pid: %d, delay: %llu ns, insns: %llu\n",
+			timed_args.flip.vaddr, timed_args.flip.pid,
+			timed_args.delay_ns, timed_args.insn_count);
+		return bitflip_timed_op(file->private_data, &timed_args);
+	}
+	case IOCTL_FLIP_UPROBE: {
+		struct bitflip_uprobe_args uprobe_args;
+
+		if (copy_from_user(&uprobe_args,
+				   (struct bitflip_uprobe_args __user *)arg,
+				   sizeof(uprobe_args)))
+			return -EFAULT;
+		bf_info("[ioctl] uprobe vaddr: %#lx, pid: %d, offset: %#llx\n",
+			uprobe_args.flip.vaddr, uprobe_args.flip.pid,
+			uprobe_args.offset);
+		return bitflip_uprobe_op(file->private_data, &uprobe_args);
+	}
+	case IOCTL_FLIP_MASK: {
+		struct bitflip_mask_args mask_args;
+
+		if (copy_from_user(&mask_args,
+				   (struct bitflip_mask_args __user *)arg,
+				   sizeof(mask_args)))
+			return -EFAULT;
+		bf_info("[ioctl] mask vaddr: %#llx, pid: %d, words: %u\n",
+			mask_args.vaddr, mask_args.pid, mask_args.nwords);
+		return bitflip_mask_op(&mask_args);
+	}
 	case IOCTL_FLIP_BIT: {
 		struct bitflip_args user_args;
 		int ret;
@@ -84,57 +502,817 @@ static long bitflip_ioctl(struct file *, unsigned int cmd, unsigned long arg)
 				   sizeof(struct bitflip_args))) {
 			return -EFAULT;
 		}
-		pr_info("[ioctl] vaddr: %#lx, pid: %d\n", user_args.vaddr,
+		bf_info("[ioctl] vaddr: %#lx, pid: %d\n", user_args.vaddr,
 			user_args.pid);
-		ret = bitflip_core_op(user_args.vaddr, user_args.pid,
-				      user_args.target_bit,
-				      user_args.pfn_shift);
+		ret = bitflip_flip_op(user_args.vaddr, user_args.pid,
+				      user_args.target_bit);
 		if (ret)
 			return ret;
 		break;
 	}
+	case IOCTL_FLIP_BIT_LAZY: {
+		struct bitflip_args user_args;
+
+		if (copy_from_user(&user_args,
+				   (struct bitflip_args __user *)arg,
+				   sizeof(struct bitflip_args))) {
+			return -EFAULT;
+		}
+		bf_info("[ioctl] lazy vaddr: %#lx, pid: %d\n", user_args.vaddr,
+			user_args.pid);
+		return bitflip_lazy_op(user_args.vaddr, user_args.pid,
+				       user_args.target_bit);
+	}
+	case IOCTL_FLIP_PFN: {
+		struct bitflip_args user_args;
+
+		if (copy_from_user(&user_args,
+				   (struct bitflip_args __user *)arg,
+				   sizeof(struct bitflip_args))) {
+			return -EFAULT;
+		}
+		bf_info("[ioctl] pfn vaddr: %#lx, pid: %d, pfn_shift: %d\n",
+			user_args.vaddr, user_args.pid, user_args.pfn_shift);
+		return bitflip_pfn_op(user_args.vaddr, user_args.pid,
+				      user_args.pfn_shift);
+	}
 	default:
 		return -EINVAL;
 	}
 	return 0;
 }
 
-static int bitflip_core_op(unsigned long vaddr, pid_t pid, int target_bit,
-			   int pfn_shift)
-{
+enum pt_level {
+	PT_NONE,
+	PT_PTE,
+	PT_PMD,
+	PT_PUD,
+};
+
+struct pt_leaf {
+	enum pt_level level;
+	pud_t *pudp;
 	pmd_t *pmdp;
 	pte_t *ptep;
-	unsigned long pfn;
+	spinlock_t *ptl;
+};
+
+/*
+ * Walk `mm` down to the entry that maps `addr` and lock it. THP and hugetlb
+ * mappings end at a PMD or PUD leaf without a PTE level below them. Release
+ * with bitflip_walk_done().
+ */
+static enum pt_level bitflip_walk(struct mm_struct *mm, unsigned long addr,
+				  struct pt_leaf *leaf)
+{
+	pgd_t *pgdp = pgd_offset(mm, addr);
+	p4d_t *p4dp;
+
+	memset(leaf, 0, sizeof(*leaf));
+
+	if (pgd_none(*pgdp) || pgd_bad(*pgdp))
+		return PT_NONE;
+	p4dp = p4d_offset(pgdp, addr);
+	if (p4d_none(*p4dp) || p4d_bad(*p4dp))
+		return PT_NONE;
+
+	leaf->pudp = pud_offset(p4dp, addr);
+	if (pud_none(*leaf->pudp))
+		return PT_NONE;
+	if (pud_leaf(*leaf->pudp)) {
+		leaf->ptl = pud_lock(mm, leaf->pudp);
+		if (!pud_leaf(*leaf->pudp)) {
+			spin_unlock(leaf->ptl);
+			return PT_NONE;
+		}
+		return leaf->level = PT_PUD;
+	}
+
+	leaf->pmdp = pmd_offset(leaf->pudp, addr);
+	if (pmd_none(*leaf->pmdp))
+		return PT_NONE;
+	if (pmd_leaf(*leaf->pmdp)) {
+		leaf->ptl = pmd_lock(mm, leaf->pmdp);
+		if (!pmd_leaf(*leaf->pmdp)) {
+			spin_unlock(leaf->ptl);
+			return PT_NONE;
+		}
+		return leaf->level = PT_PMD;
+	}
+	if (pmd_bad(*leaf->pmdp))
+		return PT_NONE;
+
+	leaf->ptep = pte_offset_map_lock(mm, leaf->pmdp, addr, &leaf->ptl);
+	if (!leaf->ptep)
+		return PT_NONE;
+	return leaf->level = PT_PTE;
+}
+
+static void bitflip_walk_done(struct pt_leaf *leaf)
+{
+	if (leaf->level == PT_PTE)
+		pte_unmap_unlock(leaf->ptep, leaf->ptl);
+	else if (leaf->level != PT_NONE)
+		spin_unlock(leaf->ptl);
+}
+
+static struct mm_struct *bitflip_get_mm(pid_t pid)
+{
+	struct pid *pid_struct = find_get_pid(pid);
+	struct task_struct *task = get_pid_task(pid_struct, PIDTYPE_PID);
+	struct mm_struct *mm;
+
+	put_pid(pid_struct);
+	if (!task)
+		return NULL;
+	mm = get_task_mm(task);
+	put_task_struct(task);
+	return mm;
+}
+
+/*
+ * Access tracking on the victim page. With `arm` set, the access flag of a
+ * mapped page is cleared so that the next access by the victim sets it
+ * again; a page that is not mapped yet gets it on its first fault. Without
+ * `arm`, returns whether the page is mapped and has been accessed since.
+ * PUD leaves are not re-armed, they are applied on their next poll.
+ */
+static int lazy_page_touched(struct mm_struct *mm, unsigned long addr,
+			     bool arm)
+{
+	struct vm_area_struct *vma;
+	struct pt_leaf leaf;
+	int touched = 0;
+
+	mmap_read_lock(mm);
+	vma = find_vma(mm, addr);
+	if (!vma || vma->vm_start > addr)
+		goto out;
+
+	switch (bitflip_walk(mm, addr, &leaf)) {
+	case PT_PTE:
+		if (!pte_present(*leaf.ptep))
+			break;
+		if (!arm)
+			touched = pte_young(*leaf.ptep);
+		else if (ptep_test_and_clear_young(vma, addr, leaf.ptep))
+			flush_tlb_page(vma, addr);
+		break;
+	case PT_PMD:
+		if (!arm)
+			touched = pmd_young(*leaf.pmdp);
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+		else if (pmdp_test_and_clear_young(vma, addr & PMD_MASK,
+						   leaf.pmdp))
+			flush_tlb_range(vma, addr & PMD_MASK,
+					(addr & PMD_MASK) + PMD_SIZE);
+#endif
+		break;
+	case PT_PUD:
+		if (!arm)
+			touched = pud_young(*leaf.pudp);
+		break;
+	default:
+		break;
+	}
+	bitflip_walk_done(&leaf);
+out:
+	mmap_read_unlock(mm);
+	return touched;
+}
+
+/*
+ * Flip bit `pfn_shift` of the frame number in the leaf entry that maps
+ * `vaddr`, so the page (or whole huge page) is backed by another frame.
+ * Block entries can only hold naturally aligned frames, so bits below the
+ * huge page order are rejected. Page refcounts are not touched, exactly as
+ * with a real flip in DRAM.
+ */
+static int bitflip_pfn_op(unsigned long vaddr, pid_t pid, int pfn_shift)
+{
+	struct mm_struct *mm = bitflip_get_mm(pid);
+	struct vm_area_struct *vma;
+	struct pt_leaf leaf;
+	unsigned long pfn, new_pfn;
+	pgprot_t prot;
+	int ret = 0;
+
+	if (!mm)
+		return -ESRCH;
+	if (pfn_shift < 0 || pfn_shift >= BITS_PER_LONG - PAGE_SHIFT) {
+		mmput(mm);
+		return -EINVAL;
+	}
+
+	mmap_read_lock(mm);
+	vma = find_vma(mm, vaddr);
+	if (!vma || vma->vm_start > vaddr) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	switch (bitflip_walk(mm, vaddr, &leaf)) {
+	case PT_PTE:
+		if (!pte_present(*leaf.ptep)) {
+			ret = -EFAULT;
+			break;
+		}
+		pfn = pte_pfn(*leaf.ptep);
+		new_pfn = pfn ^ (1UL << pfn_shift);
+		if (!pfn_valid(new_pfn)) {
+			ret = -EINVAL;
+			break;
+		}
+		prot = __pgprot(pte_val(pfn_pte(pfn, __pgprot(0))) ^
+				pte_val(*leaf.ptep));
+		set_pte(leaf.ptep, pfn_pte(new_pfn, prot));
+		flush_tlb_page(vma, vaddr);
+		bf_info("[bitflip] PTE at %#lx: pfn %#lx -> %#lx\n", vaddr, pfn,
+			new_pfn);
+		break;
+	case PT_PMD:
+		pfn = pmd_pfn(*leaf.pmdp);
+		new_pfn = pfn ^ (1UL << pfn_shift);
+		if (pfn_shift < PMD_SHIFT - PAGE_SHIFT || !pfn_valid(new_pfn)) {
+			ret = -EINVAL;
+			break;
+		}
+		prot = __pgprot(pmd_val(pfn_pmd(pfn, __pgprot(0))) ^
+				pmd_val(*leaf.pmdp));
+		set_pmd(leaf.pmdp, pfn_pmd(new_pfn, prot));
+		flush_tlb_range(vma, vaddr & PMD_MASK,
+				(vaddr & PMD_MASK) + PMD_SIZE);
+		bf_info("[bitflip] PMD at %#lx: pfn %#lx -> %#lx\n", vaddr, pfn,
+			new_pfn);
+		break;
+	case PT_PUD:
+		pfn = pud_pfn(*leaf.pudp);
+		new_pfn = pfn ^ (1UL << pfn_shift);
+		if (pfn_shift < PUD_SHIFT - PAGE_SHIFT || !pfn_valid(new_pfn)) {
+			ret = -EINVAL;
+			break;
+		}
+		prot = __pgprot(pud_val(pfn_pud(pfn, __pgprot(0))) ^
+				pud_val(*leaf.pudp));
+		set_pud(leaf.pudp, pfn_pud(new_pfn, prot));
+		flush_tlb_range(vma, vaddr & PUD_MASK,
+				(vaddr & PUD_MASK) + PUD_SIZE);
+		bf_info("[bitflip] PUD at %#lx: pfn %#lx -> %#lx\n", vaddr, pfn,
+			new_pfn);
+		break;
+	default:
+		ret = -EFAULT;
+		break;
+	}
+	bitflip_walk_done(&leaf);
+out:
+	mmap_read_unlock(mm);
+	mmput(mm);
+	return ret;
+}
+
+/*
+ * XOR `nwords` words from `vaddr`, which lie in one 64-byte line, in the
+ * page the victim maps there. Each word is XORed atomically and only if
+ * its mask is non-zero, so stores the victim makes meanwhile survive.
+ */
+static int bitflip_remote_xor_words(struct mm_struct *mm, unsigned long vaddr,
+				    const u64 *mask, unsigned int nwords)
+{
+	struct vm_area_struct *vma;
 	struct page *page;
-	struct task_struct *task = get_pid_task(find_get_pid(pid), PIDTYPE_PID);
+	u64 *word, old;
+	long pinned;
+	unsigned int i;
+
+	if (!IS_ALIGNED(vaddr, sizeof(u64)) ||
+	    (vaddr % 64) + nwords * sizeof(u64) > 64)
+		return -EINVAL;
+
+	// FOLL_FORCE breaks COW on read-only private mappings, as ptrace does
+	mmap_read_lock(mm);
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 5, 0)
+	pinned = get_user_pages_remote(mm, vaddr, 1, FOLL_WRITE | FOLL_FORCE,
+				       &page, NULL, NULL);
+#else
+	pinned = get_user_pages_remote(mm, vaddr, 1, FOLL_WRITE | FOLL_FORCE,
+				       &page, NULL);
+#endif
+	if (pinned != 1) {
+		mmap_read_unlock(mm);
+		pr_err("Failed to pin victim memory at %#lx\n", vaddr);
+		return pinned < 0 ? pinned : -EFAULT;
+	}
+	vma = find_vma(mm, vaddr);
+
+	word = kmap_local_page(page) + offset_in_page(vaddr);
+	for (i = 0; i < nwords; i++) {
+		if (!mask[i])
+			continue;
+		do {
+			old = READ_ONCE(word[i]);
+		} while (cmpxchg64(&word[i], old, old ^ mask[i]) != old);
+		bf_info("[bitflip] Old value: %#llx\n", old);
+		bf_info("[bitflip] New value: %#llx\n", old ^ mask[i]);
+	}
+	if (vma && (vma->vm_flags & VM_EXEC))
+		flush_icache_range((unsigned long)word,
+				   (unsigned long)(word + nwords));
+	kunmap_local(word);
+	mmap_read_unlock(mm);
+
+	set_page_dirty_lock(page);
+	put_page(page);
+	return 0;
+}
+
+// Flip `target_bit` of the little-endian word at `vaddr`, aligned or not:
+// it is a bit of the aligned word holding byte `vaddr + target_bit / 8`.
+static int bitflip_remote_flip(struct mm_struct *mm, unsigned long vaddr,
+			       int target_bit)
+{
+	unsigned long byte = vaddr + target_bit / 8;
+	u64 mask = 1ULL << ((byte % sizeof(u64)) * 8 + target_bit % 8);
+
+	return bitflip_remote_xor_words(mm, ALIGN_DOWN(byte, sizeof(u64)),
+					&mask, 1);
+}
+
+// Flip `target_bit` of the 64-bit word at `vaddr` in the victim's memory.
+static int bitflip_flip_op(unsigned long vaddr, pid_t pid, int target_bit)
+{
+	struct mm_struct *mm;
 	int ret;
-	uint64_t val;
 
 	target_bit = (target_bit < 0) ? 16 : target_bit; // default: 16
+	if (target_bit >= 64)
+		return -EINVAL;
+	mm = bitflip_get_mm(pid);
+	if (!mm)
+		return -ESRCH;
+	ret = bitflip_remote_flip(mm, vaddr, target_bit);
+	mmput(mm);
+	return ret;
+}
 
-	pr_info("[bitflip] vaddr: %#lx\n", vaddr);
+static int bitflip_mask_op(const struct bitflip_mask_args *args)
+{
+	struct mm_struct *mm;
+	int ret;
 
-	ret = get_user(val, (uint64_t __user *)vaddr);
-	if (ret) {
-		pr_err("Failed to get user value\n");
-		return -EFAULT;
+	if (!args->nwords || args->nwords > BITFLIP_MASK_WORDS ||
+	    !IS_ALIGNED(args->vaddr, sizeof(u64)) ||
+	    (args->vaddr % 64) + args->nwords * sizeof(u64) > 64)
+		return -EINVAL;
+	mm = bitflip_get_mm(args->pid);
+	if (!mm)
+		return -ESRCH;
+	ret = bitflip_remote_xor_words(mm, args->vaddr, args->mask,
+				       args->nwords);
+	mmput(mm);
+	return ret;
+}
+
+static void lazy_poll(struct work_struct *work)
+{
+	struct lazy_page *lp, *tmp;
+
+	mutex_lock(&lazy_lock);
+	list_for_each_entry_safe(lp, tmp, &lazy_pages, node) {
+		struct mm_struct *mm = lp->mm;
+		struct lazy_flip *flip;
+
+		if (!mmget_not_zero(mm)) {
+			pr_info("[bitflip] pid %d exited, dropping deferred flips at %#lx\n",
+				lp->pid, lp->addr);
+			lazy_page_free(lp);
+			continue;
+		}
+
+		if (lazy_page_touched(mm, lp->addr, false)) {
+			bf_info("[bitflip] pid %d touched %#lx, applying deferred flips\n",
+				lp->pid, lp->addr);
+			list_for_each_entry(flip, &lp->flips, node)
+				bitflip_remote_flip(mm, flip->vaddr,
+						    flip->target_bit);
+			lazy_page_free(lp);
+		}
+		mmput(mm);
+	}
+
+	if (!list_empty(&lazy_pages))
+		schedule_delayed_work(&lazy_work,
+				      msecs_to_jiffies(lazy_poll_ms));
+	mutex_unlock(&lazy_lock);
+}
+
+static int bitflip_lazy_op(unsigned long vaddr, pid_t pid, int target_bit)
+{
+	struct mm_struct *mm = bitflip_get_mm(pid);
+	unsigned long addr = vaddr & PAGE_MASK;
+	struct lazy_page *lp;
+	struct lazy_flip *flip;
+	bool found = false;
+
+	if (!mm)
+		return -ESRCH;
+
+	target_bit = (target_bit < 0) ? 16 : target_bit; // default: 16
+	if (target_bit >= 64) {
+		mmput(mm);
+		return -EINVAL;
+	}
+
+	flip = kmalloc(sizeof(*flip), GFP_KERNEL);
+	if (!flip) {
+		mmput(mm);
+		return -ENOMEM;
+	}
+	flip->vaddr = vaddr;
+	flip->target_bit = target_bit;
+
+	mutex_lock(&lazy_lock);
+	list_for_each_entry(lp, &lazy_pages, node) {
+		if (lp->mm == mm && lp->addr == addr) {
+			found = true;
+			break;
+		}
+	}
+
+	if (!found) {
+		lp = kzalloc(sizeof(*lp), GFP_KERNEL);
+		if (!lp) {
+			mutex_unlock(&lazy_lock);
+			kfree(flip);
+			mmput(mm);
+			return -ENOMEM;
+		}
+		INIT_LIST_HEAD(&lp->flips);
+		mmgrab(mm);
+		lp->mm = mm;
+		lp->pid = pid;
+		lp->addr = addr;
+		list_add_tail(&lp->node, &lazy_pages);
+		lazy_page_touched(mm, addr, true);
+	}
+	list_add_tail(&flip->node, &lp->flips);
+	schedule_delayed_work(&lazy_work, msecs_to_jiffies(lazy_poll_ms));
+	mutex_unlock(&lazy_lock);
+
+	mmput(mm);
+	bf_info("[bitflip] Deferred flip of bit %d at %#lx until the page is touched\n",
+		target_bit, vaddr);
+	return 0;
+}
+
+/*
+ * The store went through the kernel alias: clean it to the PoU and
+ * invalidate the I-cache by VA, which is broadcast to every CPU. That is
+ * flush_icache_range() without its IPI, which cannot be sent from the
+ * hrtimer or the PMU NMI; a CPU that already fetched the old instruction
+ * may run it once more, until its next context synchronisation.
+ */
+static void timed_flip_sync_icache(u64 *word)
+{
+	unsigned long start = (unsigned long)word;
+
+#if !defined(CONFIG_ARM64)
+	flush_icache_range(start, start + sizeof(*word));
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(5, 15, 0)
+	caches_clean_inval_pou(start, start + sizeof(*word));
+#else
+	__flush_icache_range(start, start + sizeof(*word));
+#endif
+}
+
+static void timed_flip_fire(struct timed_flip *tf)
+{
+	u64 *word;
+
+	if (atomic_xchg(&tf->fired, 1))
+		return;
+
+	word = kmap_local_page(tf->page) + tf->offset;
+	WRITE_ONCE(*word, READ_ONCE(*word) ^ tf->mask);
+	if (tf->exec)
+		timed_flip_sync_icache(word);
+	kunmap_local(word);
+
+	tf->fired_ns = ktime_get_mono_fast_ns();
+	irq_work_queue(&tf->irq_work);
+}
+
+static enum hrtimer_restart timed_flip_timer(struct hrtimer *timer)
+{
+	timed_flip_fire(container_of(timer, struct timed_flip, timer));
+	return HRTIMER_NORESTART;
+}
+
+// May run in NMI context, only fire() is allowed here.
+static void timed_flip_overflow(struct perf_event *event,
+				struct perf_sample_data *data,
+				struct pt_regs *regs)
+{
+	timed_flip_fire(event->overflow_handler_context);
+}
+
+static void timed_flip_irq_work(struct irq_work *work)
+{
+	struct timed_flip *tf = container_of(work, struct timed_flip, irq_work);
+
+	queue_work(bitflip_wq, &tf->work);
+}
+
+static void timed_flip_done(struct work_struct *work)
+{
+	struct timed_flip *tf = container_of(work, struct timed_flip, work);
+
+	if (tf->event)
+		perf_event_release_kernel(tf->event);
+
+	if (!tf->res)
+		bf_info("[bitflip] Timed flip fired %llu ns after arming\n",
+			tf->fired_ns - tf->armed_ns);
+	put_page(tf->page);
+
+	if (READ_ONCE(tf->ctx->ring))
+		bitflip_post_cqe(tf->ctx, tf->user_data, tf->res);
+	kref_put(&tf->ctx->ref, bitflip_ctx_free);
+
+	mutex_lock(&timed_lock);
+	list_del(&tf->node);
+	mutex_unlock(&timed_lock);
+	kfree(tf);
+}
+
+// Called with timed_lock held. A flip that has not fired completes with
+// -ECANCELED; one that has is left to the work its irq_work queues, which
+// is queued by the time this returns.
+static void timed_flip_cancel(struct timed_flip *tf)
+{
+	if (tf->timer.function)
+		hrtimer_cancel(&tf->timer);
+	if (!atomic_xchg(&tf->fired, 1)) {
+		tf->res = -ECANCELED;
+		queue_work(bitflip_wq, &tf->work);
 	} else {
-		pr_info("[bitflip] Old value: %#llx\n", val);
+		irq_work_sync(&tf->irq_work);
 	}
+}
 
-	val ^= (1 << target_bit);
+/*
+ * Arm a flip that fires `delay_ns` from now on an hrtimer, or, when
+ * `insn_count` is set, once the victim has retired that many user-mode
+ * instructions (PMU overflow on the victim task, subject to the PMU's
+ * interrupt skid). The completion is posted to the ring of `ctx`. Code
+ * pages get their I-cache synced as the flip fires, see
+ * timed_flip_sync_icache().
+ */
+static int bitflip_timed_op(struct bitflip_ctx *ctx,
+			    const struct bitflip_timed_args *args)
+{
+	unsigned long vaddr = args->flip.vaddr;
+	int target_bit = args->flip.target_bit;
+	struct pid *pid_struct;
+	struct task_struct *task;
+	struct mm_struct *mm;
+	struct vm_area_struct *vma;
+	struct timed_flip *tf;
+	long pinned;
 
-	pr_info("[bitflip] New value: %#llx\n", val);
+	target_bit = (target_bit < 0) ? 16 : target_bit; // default: 16
+	if (target_bit >= 64 || offset_in_page(vaddr) > PAGE_SIZE - sizeof(u64))
+		return -EINVAL;
 
-	ret = put_user(val, (uint64_t __user *)vaddr);
+	pid_struct = find_get_pid(args->flip.pid);
+	task = get_pid_task(pid_struct, PIDTYPE_PID);
+	put_pid(pid_struct);
+	if (!task)
+		return -ESRCH;
 
-	if (ret) {
-        pr_err("Failed to write data to user space\n");
-        return -EFAULT;
-    }
+	tf = kzalloc(sizeof(*tf), GFP_KERNEL);
+	mm = get_task_mm(task);
+	if (!tf || !mm) {
+		kfree(tf);
+		if (mm)
+			mmput(mm);
+		put_task_struct(task);
+		return tf ? -ESRCH : -ENOMEM;
+	}
+
+	// FOLL_FORCE breaks COW up front so the handler writes the page the
+	// victim actually maps
+	mmap_read_lock(mm);
+	vma = find_vma(mm, vaddr);
+	tf->exec = vma && (vma->vm_flags & VM_EXEC);
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 5, 0)
+	pinned = get_user_pages_remote(mm, vaddr, 1, FOLL_WRITE | FOLL_FORCE,
+				       &tf->page, NULL, NULL);
+#else
+	pinned = get_user_pages_remote(mm, vaddr, 1, FOLL_WRITE | FOLL_FORCE,
+				       &tf->page, NULL);
+#endif
+	mmap_read_unlock(mm);
+	mmput(mm);
+	if (pinned != 1) {
+		put_task_struct(task);
+		kfree(tf);
+		return pinned < 0 ? pinned : -EFAULT;
+	}
+
+	tf->offset = offset_in_page(vaddr);
+	tf->mask = 1ULL << target_bit;
+	tf->user_data = args->user_data;
+	tf->ctx = ctx;
+	kref_get(&ctx->ref);
+	init_irq_work(&tf->irq_work, timed_flip_irq_work);
+	INIT_WORK(&tf->work, timed_flip_done);
 
-	pr_info("[bitflip] Successfully flipped a bit in physical memory.\n");
+	mutex_lock(&timed_lock);
+	list_add_tail(&tf->node, &timed_flips);
+	mutex_unlock(&timed_lock);
 
+	tf->armed_ns = ktime_get_mono_fast_ns();
+	if (args->insn_count) {
+		struct perf_event_attr attr = {
+			.type = PERF_TYPE_HARDWARE,
+			.config = PERF_COUNT_HW_INSTRUCTIONS,
+			.size = sizeof(attr),
+			.sample_period = args->insn_count,
+			.pinned = 1,
+			.exclude_kernel = 1,
+			.exclude_hv = 1,
+		};
+		struct perf_event *event = perf_event_create_kernel_counter(
+			&attr, -1, task, timed_flip_overflow, tf);
+
+		// never armed: the ioctl reports it, no completion
+		if (IS_ERR(event)) {
+			put_task_struct(task);
+			mutex_lock(&timed_lock);
+			list_del(&tf->node);
+			mutex_unlock(&timed_lock);
+			put_page(tf->page);
+			kref_put(&ctx->ref, bitflip_ctx_free);
+			kfree(tf);
+			return PTR_ERR(event);
+		}
+		tf->event = event;
+	} else {
+		hrtimer_init(&tf->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_HARD);
+		tf->timer.function = timed_flip_timer;
+		hrtimer_start(&tf->timer, ns_to_ktime(args->delay_ns),
+			      HRTIMER_MODE_REL_HARD);
+	}
+	put_task_struct(task);
+
+	return 0;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 12, 0)
+static int uprobe_flip_handler(struct uprobe_consumer *self,
+			       struct pt_regs *regs)
+#else
+static int uprobe_flip_handler(struct uprobe_consumer *self,
+			       struct pt_regs *regs, __u64 *data)
+#endif
+{
+	struct uprobe_flip *uf =
+		container_of(self, struct uprobe_flip, consumer);
+	int res;
+
+	if (current->mm != uf->mm)
+		return 0;
+	if (atomic_xchg(&uf->fired, 1))
+		return UPROBE_HANDLER_REMOVE;
+
+	res = bitflip_remote_flip(current->mm, uf->vaddr, uf->target_bit);
+	bf_info("[bitflip] uprobe at %#llx hit by pid %d, flip at %#lx: %d\n",
+		uf->offset, current->pid, uf->vaddr, res);
+
+	if (READ_ONCE(uf->ctx->ring))
+		bitflip_post_cqe(uf->ctx, uf->user_data, res);
+	// the probe cannot be unregistered from its own handler
+	queue_work(bitflip_wq, &uf->work);
+	return UPROBE_HANDLER_REMOVE;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 12, 0)
+static bool uprobe_flip_filter(struct uprobe_consumer *self,
+			       enum uprobe_filter_ctx ctx, struct mm_struct *mm)
+#else
+static bool uprobe_flip_filter(struct uprobe_consumer *self,
+			       struct mm_struct *mm)
+#endif
+{
+	struct uprobe_flip *uf =
+		container_of(self, struct uprobe_flip, consumer);
+
+	return mm == uf->mm && !atomic_read(&uf->fired);
+}
+
+static void uprobe_flip_free(struct uprobe_flip *uf)
+{
+	iput(uf->inode);
+	mmdrop(uf->mm);
+	kref_put(&uf->ctx->ref, bitflip_ctx_free);
+	kfree(uf);
+}
+
+// Called with uprobe_lock held. A flip that has not fired completes with
+// -ECANCELED, its work unregisters the probe and drops the references.
+static void uprobe_flip_cancel(struct uprobe_flip *uf)
+{
+	if (atomic_xchg(&uf->fired, 1))
+		return;
+	if (READ_ONCE(uf->ctx->ring))
+		bitflip_post_cqe(uf->ctx, uf->user_data, -ECANCELED);
+	queue_work(bitflip_wq, &uf->work);
+}
+
+static void uprobe_flip_done(struct work_struct *work)
+{
+	struct uprobe_flip *uf = container_of(work, struct uprobe_flip, work);
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 12, 0)
+	uprobe_unregister(uf->inode, uf->offset, &uf->consumer);
+#else
+	uprobe_unregister_nosync(uf->uprobe, &uf->consumer);
+	uprobe_unregister_sync();
+#endif
+
+	mutex_lock(&uprobe_lock);
+	list_del(&uf->node);
+	mutex_unlock(&uprobe_lock);
+	uprobe_flip_free(uf);
+}
+
+/*
+ * Register a uprobe at `offset` in the file at `path` that applies the flip
+ * once the victim executes the probed instruction.
+ */
+static int bitflip_uprobe_op(struct bitflip_ctx *ctx,
+			     const struct bitflip_uprobe_args *args)
+{
+	int target_bit = args->flip.target_bit;
+	struct mm_struct *mm;
+	struct uprobe_flip *uf;
+	struct path path;
+	char *name;
+	int ret;
+
+	target_bit = (target_bit < 0) ? 16 : target_bit; // default: 16
+	if (target_bit >= 64)
+		return -EINVAL;
+
+	name = strndup_user(u64_to_user_ptr(args->path), PATH_MAX);
+	if (IS_ERR(name))
+		return PTR_ERR(name);
+	ret = kern_path(name, LOOKUP_FOLLOW, &path);
+	kfree(name);
+	if (ret)
+		return ret;
+
+	mm = bitflip_get_mm(args->flip.pid);
+	uf = kzalloc(sizeof(*uf), GFP_KERNEL);
+	if (!mm || !uf) {
+		path_put(&path);
+		kfree(uf);
+		if (mm)
+			mmput(mm);
+		return mm ? -ENOMEM : -ESRCH;
+	}
+
+	uf->inode = igrab(d_inode(path.dentry));
+	path_put(&path);
+	uf->offset = args->offset;
+	mmgrab(mm);
+	uf->mm = mm;
+	mmput(mm);
+	uf->vaddr = args->flip.vaddr;
+	uf->target_bit = target_bit;
+	uf->user_data = args->user_data;
+	uf->ctx = ctx;
+	kref_get(&ctx->ref);
+	uf->consumer.handler = uprobe_flip_handler;
+	uf->consumer.filter = uprobe_flip_filter;
+	INIT_WORK(&uf->work, uprobe_flip_done);
+
+	mutex_lock(&uprobe_lock);
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 12, 0)
+	ret = uprobe_register(uf->inode, uf->offset, &uf->consumer);
+#else
+	uf->uprobe = uprobe_register(uf->inode, uf->offset, 0, &uf->consumer);
+	ret = IS_ERR(uf->uprobe) ? PTR_ERR(uf->uprobe) : 0;
+#endif
+	if (!ret)
+		list_add_tail(&uf->node, &uprobe_flips);
+	mutex_unlock(&uprobe_lock);
+
+	if (ret) {
+		uprobe_flip_free(uf);
+		return ret;
+	}
 	return 0;
 }
 
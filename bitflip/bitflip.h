@@ -0,0 +1,138 @@
+#ifndef BITFLIP_H
+#define BITFLIP_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/ioctl.h>
+#else
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <linux/types.h>
+#endif
+
+#define BITFLIP_MAGIC 0xF5
+#define IOCTL_FLIP_BIT _IOW(BITFLIP_MAGIC, 0, unsigned long)
+// queue the flip and apply it once the page's access flag is seen set. The
+// flag is polled every lazy_poll_ms, rounded up to whole jiffies, so the
+// flip lands one to a few ticks after the access, which sees the old value.
+// Anything setting the flag triggers it, the caller's own process_vm_readv
+// or ptrace peeks included; reclaim clearing it first misses that access
+// and waits for the next one.
+#define IOCTL_FLIP_BIT_LAZY _IOW(BITFLIP_MAGIC, 1, unsigned long)
+// flip bit `pfn_shift` of the frame number in the PTE/PMD/PUD mapping vaddr
+#define IOCTL_FLIP_PFN _IOW(BITFLIP_MAGIC, 2, unsigned long)
+// allocate the submission/completion rings, then mmap() params.size bytes
+#define IOCTL_RING_SETUP _IOWR(BITFLIP_MAGIC, 3, struct bitflip_ring_params)
+// consume up to `arg` submissions (0: all), returns the number consumed
+#define IOCTL_RING_ENTER _IO(BITFLIP_MAGIC, 4)
+// arm a flip that fires without stopping the victim, see bitflip_timed_args
+#define IOCTL_FLIP_TIMED _IOW(BITFLIP_MAGIC, 5, struct bitflip_timed_args)
+// flip when the victim reaches a file offset, see bitflip_uprobe_args
+#define IOCTL_FLIP_UPROBE _IOW(BITFLIP_MAGIC, 6, struct bitflip_uprobe_args)
+// XOR whole 64-bit words with masks, see bitflip_mask_args
+#define IOCTL_FLIP_MASK _IOW(BITFLIP_MAGIC, 7, struct bitflip_mask_args)
+
+struct bitflip_args {
+	unsigned long vaddr;
+	pid_t pid;
+	int target_bit;
+	int pfn_shift;
+};
+
+/*
+ * The flip fires `delay_ns` after the ioctl, or once the victim has retired
+ * `insn_count` user-mode instructions when that is non-zero. If the file
+ * has a ring, a CQE carrying `user_data` is posted after it fired (res 0)
+ * or was cancelled by closing the file (res -ECANCELED). On executable
+ * pages the I-cache is invalidated as the flip fires, but no CPU is
+ * interrupted: one that already fetched the old instruction may execute it
+ * once more before its next exception or context switch.
+ */
+struct bitflip_timed_args {
+	struct bitflip_args flip;
+	__u64 delay_ns;
+	__u64 insn_count;
+	__u64 user_data;
+};
+
+/*
+ * A uprobe at `offset` in the binary at `path` applies the flip from the
+ * victim's own context right before the probed instruction executes, then
+ * the probe is removed. Probe a different word than the one being flipped,
+ * the probed instruction itself runs from an out-of-line copy. Completions
+ * are posted as for timed flips; closing the file removes the probes it has
+ * not seen hit, which complete with -ECANCELED.
+ */
+struct bitflip_uprobe_args {
+	struct bitflip_args flip;
+	__u64 path; // const char *
+	__u64 offset;
+	__u64 user_data;
+};
+
+#define BITFLIP_MASK_WORDS 8 // one cache line
+
+/*
+ * Multi-bit flips: `nwords` consecutive 64-bit words from `vaddr`, which is
+ * 8-byte aligned, are XORed with `mask`. They must lie in one 64-byte line
+ * (-EINVAL otherwise). Each word with a non-zero mask is XORed atomically
+ * in place, so concurrent stores by the victim are not lost, but the words
+ * do not change together. Bursts within a word and along a line are one call.
+ */
+struct bitflip_mask_args {
+	__u64 vaddr;
+	__s32 pid;
+	__u32 nwords; // 1 to BITFLIP_MASK_WORDS
+	__u64 mask[BITFLIP_MASK_WORDS];
+};
+
+/*
+ * Shared rings, io_uring style. Userspace fills SQEs and publishes them by
+ * advancing sq_tail with a release store; the kernel consumes them on
+ * IOCTL_RING_ENTER and posts one CQE per SQE at cq_tail. Heads belong to the
+ * consumer and tails to the producer of each ring.
+ */
+enum bitflip_op {
+	BITFLIP_OP_FLIP,
+	BITFLIP_OP_FLIP_LAZY,
+	BITFLIP_OP_FLIP_PFN,
+};
+
+struct bitflip_ring_params {
+	__u32 sq_entries; // in: power of two, at most BITFLIP_RING_MAX
+	__u32 cq_entries; // out: twice sq_entries
+	__u32 sq_off; // out: offset of the SQE array in the mapping
+	__u32 cq_off; // out: offset of the CQE array in the mapping
+	__u32 size; // out: length to mmap
+	__u32 resv;
+};
+
+#define BITFLIP_RING_MAX 4096
+
+struct bitflip_ring_hdr {
+	__u32 sq_head;
+	__u32 sq_tail;
+	__u32 cq_head;
+	__u32 cq_tail;
+	__u32 sq_mask;
+	__u32 cq_mask;
+	__u32 cq_overflow; // completions dropped because the CQ was full
+};
+
+struct bitflip_sqe {
+	__u8 opcode; // enum bitflip_op
+	__u8 resv[3];
+	__s32 pid;
+	__s32 target_bit;
+	__s32 pfn_shift;
+	__u64 vaddr;
+	__u64 user_data; // copied to the CQE
+};
+
+struct bitflip_cqe {
+	__u64 user_data;
+	__s32 res; // 0 or -errno
+	__u32 flags;
+};
+
+#endif
@@ -1,63 +1,77 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <fcntl.h>
 #include <unistd.h>
 #include <sys/mman.h>
-#include <sys/ioctl.h>
 #include <string.h>
 #include <stdint.h>
 
-#define BITFLIP_MAGIC 0xF5
-#define IOCTL_FLIP_BIT _IOW(BITFLIP_MAGIC, 0, unsigned long)
+#include "../libflip/flip.h"
 
 #define SIZE_MB 0x100000 // 1024 * 1024
 
-struct bitflip_args {
-	unsigned long vaddr;
-	pid_t pid;
-	int target_bit;
-	int pfn_shift;
-};
-
-int main()
+// Submit `count` copies of the flip through the shared rings and reap them.
+static int ring_flip(struct flip_dev *dev, pid_t pid, unsigned long vaddr,
+		     int bit, int count)
 {
-	int fd;
-	void *block = mmap(NULL, SIZE_MB, PROT_WRITE,
-			   MAP_PRIVATE | MAP_ANON | MAP_POPULATE, -1, 0);
+	struct flip_completion cqe;
 
-	if (block == MAP_FAILED) {
-		perror("mmap 1MB");
+	if (flip_ring_setup(dev, 64)) {
+		perror("ring setup failed");
+		return -1;
+	}
+
+	for (int i = 0; i < count; i++)
+		flip_ring_submit(dev, FLIP_OP_BIT, pid, vaddr, bit, i);
+
+	long consumed = flip_ring_enter(dev, 0);
+	printf("ring consumed %ld submissions\n", consumed);
+
+	while (flip_ring_reap(dev, &cqe, 1) == 1)
+		printf("completion %llu: %d\n", (unsigned long long)cqe.user_data,
+		       cqe.res);
+
+	return consumed == count ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+	struct flip_dev *dev;
+	// `./test-program lazy` defers the flip until the page is touched
+	int lazy = argc > 1 && strcmp(argv[1], "lazy") == 0;
+	// `./test-program ring` flips the bit twice through the shared rings
+	int ring = argc > 1 && strcmp(argv[1], "ring") == 0;
+	// `./test-program timed` arms the flip on a 1ms hrtimer
+	int timed = argc > 1 && strcmp(argv[1], "timed") == 0;
+	void *block;
+	int vdimm;
+
+	dev = flip_dev_open(NULL);
+	if (!dev) {
+		perror("Failed to open the device");
 		exit(EXIT_FAILURE);
 	}
 
-	FILE *maps_file = fopen("/proc/self/maps", "r");
-	if (maps_file == NULL) {
-		perror("Failed to open /proc/[pid]/maps");
-		return;
+	// with FLIP_DEV=vdimm only the block is flippable, and it is the target
+	block = flip_vdimm_map(dev, NULL, SIZE_MB, PROT_READ | PROT_WRITE);
+	vdimm = block != NULL;
+	if (!vdimm)
+		block = mmap(NULL, SIZE_MB, PROT_WRITE,
+			     MAP_PRIVATE | MAP_ANON | MAP_POPULATE, -1, 0);
+
+	if (!block || block == MAP_FAILED) {
+		perror("mmap 1MB");
+		exit(EXIT_FAILURE);
 	}
 
-	char line[256];
-	unsigned long text_start, text_end;
-	while (fgets(line, sizeof(line), maps_file)) {
-		unsigned long start, end;
-		char perms[5], offset[9], dev[6], inode[11], pathname[256];
-
-		printf("%s", line);
-
-		// Parse the line
-		if (sscanf(line, "%lx-%lx %4s %8s %5s %10s %s", &start, &end,
-			   perms, offset, dev, inode, pathname) == 7) {
-			if (strchr(perms, 'x')) {
-				printf("Text section found at address range: 0x%lx - 0x%lx\n",
-				       start, end);
-				text_start = start;
-				text_end = end;
-				break;
-			}
-		}
+	struct flip_map text;
+	if (flip_maps_find(0, NULL, FLIP_PROT_EXEC, &text)) {
+		perror("Failed to find the text section");
+		exit(EXIT_FAILURE);
 	}
+	unsigned long text_start = text.start, text_end = text.end;
+	printf("Text section found at address range: 0x%lx - 0x%lx\n",
+	       text_start, text_end);
 	// text_start = 0xaaaaaaaa0000;
-	fclose(maps_file);
 	printf("text_start+c78: %#lx\n", text_start+0xc78);
 	printf("text_end: %#lx\n", text_end);
 
@@ -66,35 +80,49 @@ int main()
 	printf("text_start's value: %#lx\n", *(uint64_t *)text_start);
 
 	unsigned long vaddr = (unsigned long)block;
+	unsigned long target = vdimm ? vaddr : text_start;
 
-	fd = open("/dev/bitflip", O_RDWR);
-	if (fd < 0) {
-		perror("Failed to open the device");
-		exit(EXIT_FAILURE);
-	}
+	if (vdimm)
+		*(uint64_t *)block = *(uint64_t *)text_start;
 
-	struct bitflip_args arg = {
-		.vaddr = text_start,
-		.pid = getpid(),
-		.target_bit = 5,
-		.pfn_shift = 0,
-	};
+	pid_t pid = getpid();
+	int target_bit = 5;
 
 	printf("value: %#lx\n", *(unsigned long *)block);
 
-	printf("[bitflip] vaddr: %#lx, pid: %d, target_bit: %d\n", arg.vaddr, arg.pid, arg.target_bit);
+	printf("[bitflip] vaddr: %#lx, pid: %d, target_bit: %d\n", target, pid, target_bit);
 
-	if (ioctl(fd, IOCTL_FLIP_BIT, &arg) == -1) {
+	if (ring) {
+		if (ring_flip(dev, pid, target, target_bit, 2)) {
+			flip_dev_close(dev);
+			exit(EXIT_FAILURE);
+		}
+	} else if (timed) {
+		if (flip_timed(dev, pid, target, target_bit, 1000000, 0, 0)) {
+			perror("ioctl failed");
+			flip_dev_close(dev);
+			exit(EXIT_FAILURE);
+		}
+		printf("target's value: %#lx\n", *(uint64_t *)target);
+		usleep(10000);
+	} else if ((lazy ? flip_bit_lazy : flip_bit)(dev, pid, target,
+						    target_bit)) {
 		perror("ioctl failed");
-		close(fd);
+		flip_dev_close(dev);
 		exit(EXIT_FAILURE);
 	}
 
 	printf("value: %#lx\n", *(unsigned long *)block);
 
-	printf("text_start's value: %#lx\n", *(uint64_t *)text_start);
+	printf("target's value: %#lx\n", *(uint64_t *)target);
+
+	if (lazy) {
+		// the read above touched the page, give the module a poll period
+		usleep(10000);
+		printf("target's value: %#lx\n", *(uint64_t *)target);
+	}
 
 	printf("Bit flip operation completed\n");
-	close(fd);
+	flip_dev_close(dev);
 	return 0;
 }
@@ -0,0 +1,228 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "flippat.h"
+
+// What the current weight does with a pattern.
+enum pat_fate {
+	FATE_KEEP,
+	FATE_DEFER,
+	FATE_DECODED,
+	FATE_COVERED,
+};
+
+void patgen_init(struct patgen *g, int exhaustive)
+{
+	memset(g, 0, sizeof(*g));
+	g->exhaustive = exhaustive;
+	g->pass = 2; // nothing to hand out before patgen_weight()
+}
+
+void patgen_free(struct patgen *g)
+{
+	free(g->insns);
+	free(g->found);
+}
+
+static int contains_found(const struct patgen *g, unsigned long offset,
+			  uint32_t mask)
+{
+	for (size_t i = 0; i < g->nfound; i++) {
+		if (g->found[i].offset == offset &&
+		    !(g->found[i].mask & ~mask))
+			return 1;
+	}
+	return 0;
+}
+
+// Some bit of `mask` can be left unflipped without changing what runs.
+static int covered(uint32_t insn, uint32_t mask)
+{
+	uint32_t flipped = insn ^ mask;
+
+	for (uint32_t m = mask; m; m &= m - 1) {
+		if (a64_equivalent(flipped, flipped ^ (m & -m)))
+			return 1;
+	}
+	return 0;
+}
+
+static struct pat_insn *insn_of(struct patgen *g, unsigned long offset)
+{
+	for (size_t i = 0; i < g->ninsns; i++) {
+		if (g->insns[i].offset == offset)
+			return &g->insns[i];
+	}
+	return NULL;
+}
+
+// All bits of `mask` land in the same field, and it is not the opcode.
+static int one_field(const uint8_t *field, uint32_t mask)
+{
+	int f = field[__builtin_ctz(mask)];
+
+	if (f == A64_F_OPCODE)
+		return 0;
+	for (mask &= mask - 1; mask; mask &= mask - 1) {
+		if (field[__builtin_ctz(mask)] != f)
+			return 0;
+	}
+	return 1;
+}
+
+static enum pat_fate fate_of(const struct patgen *g,
+			     const struct pat_insn *pi, uint32_t mask)
+{
+	enum a64_outcome o;
+
+	if (!g->exhaustive) {
+		o = a64_mask_outcome(pi->insn, mask);
+		if (o == A64_O_UNDEFINED || o == A64_O_SAME)
+			return FATE_DECODED;
+		if (g->weight > 1 && covered(pi->insn, mask))
+			return FATE_COVERED;
+	}
+	// single bits hint at what the pattern does, they do not prove it
+	if (!(mask & ~pi->hint_crashed) ||
+	    (!(mask & ~pi->hint_quiet) && one_field(pi->field, mask)))
+		return FATE_DEFER;
+	return FATE_KEEP;
+}
+
+// The next pattern of this instruction for the current pass, if any.
+static int take(struct patgen *g, struct pat_insn *pi, struct pattern *out)
+{
+	// every 32-bit mask of `weight` bits, in increasing order (Gosper)
+	while (pi->next >> 32 == 0) {
+		uint32_t mask = pi->next;
+		uint64_t low = pi->next & -pi->next, ripple = pi->next + low;
+		enum pat_fate fate = fate_of(g, pi, mask);
+
+		pi->next = ripple | (((pi->next ^ ripple) >> 2) / low);
+
+		// the first pass counts what it drops, the second only runs
+		// what the first deferred
+		if (g->pass == 0) {
+			if (fate == FATE_DECODED) {
+				g->decoded++;
+				continue;
+			}
+			if (fate == FATE_COVERED) {
+				g->covered++;
+				continue;
+			}
+			if (fate == FATE_DEFER) {
+				g->deferred++;
+				continue;
+			}
+		} else if (fate != FATE_DEFER) {
+			continue;
+		}
+		if (contains_found(g, pi->offset, mask)) {
+			g->superset++;
+			continue;
+		}
+		out->offset = pi->offset;
+		out->insn = pi->insn;
+		out->mask = mask;
+		out->prior = pi->prior;
+		return 1;
+	}
+	return 0;
+}
+
+static void restart(struct patgen *g)
+{
+	for (size_t i = 0; i < g->ninsns; i++)
+		g->insns[i].next = (1ULL << g->weight) - 1;
+	g->turn = 0;
+}
+
+int patgen_add(struct patgen *g, unsigned long offset, uint32_t insn,
+	       double prior)
+{
+	struct pat_insn *pi;
+
+	if (g->ninsns == g->insns_cap) {
+		size_t cap = g->insns_cap ? 2 * g->insns_cap : 64;
+		struct pat_insn *a = realloc(g->insns, cap * sizeof(*a));
+
+		if (!a)
+			return -1;
+		g->insns = a;
+		g->insns_cap = cap;
+	}
+	pi = &g->insns[g->ninsns++];
+	memset(pi, 0, sizeof(*pi));
+	pi->offset = offset;
+	pi->insn = insn;
+	pi->prior = prior;
+	pi->next = ~0ULL; // done until patgen_weight()
+	for (int bit = 0; bit < 32; bit++)
+		pi->field[bit] = a64_field_of(insn, bit);
+	return 0;
+}
+
+int patgen_weight(struct patgen *g, int weight)
+{
+	if (weight < 1 || weight > 32)
+		return -1;
+	g->weight = weight;
+	g->pass = 0;
+	for (size_t i = 0; i < g->ninsns; i++) {
+		g->insns[i].hint_crashed = g->insns[i].crashed;
+		g->insns[i].hint_quiet = g->insns[i].quiet;
+	}
+	restart(g);
+	return 0;
+}
+
+int patgen_next(struct patgen *g, struct pattern *out)
+{
+	while (g->pass < 2 && g->ninsns) {
+		// one pattern per instruction and turn, until all run dry
+		for (size_t n = 0; n < g->ninsns; n++) {
+			struct pat_insn *pi = &g->insns[g->turn];
+
+			g->turn = (g->turn + 1) % g->ninsns;
+			if (take(g, pi, out))
+				return 1;
+		}
+		if (++g->pass < 2)
+			restart(g);
+	}
+	return 0;
+}
+
+int patgen_found(struct patgen *g, unsigned long offset, uint32_t mask)
+{
+	if (g->nfound == g->found_cap) {
+		size_t cap = g->found_cap ? 2 * g->found_cap : 64;
+		struct pattern *a = realloc(g->found, cap * sizeof(*a));
+
+		if (!a)
+			return -1;
+		g->found = a;
+		g->found_cap = cap;
+	}
+	g->found[g->nfound++] = (struct pattern){ .offset = offset,
+						  .mask = mask };
+	return 0;
+}
+
+int patgen_single(struct patgen *g, unsigned long offset, uint32_t bits,
+		  enum pat_result result)
+{
+	struct pat_insn *pi = insn_of(g, offset);
+
+	if (!pi)
+		return -1;
+	// a bit has one result, the last trial wins
+	pi->crashed &= ~bits;
+	pi->quiet &= ~bits;
+	if (result == PAT_CRASH)
+		pi->crashed |= bits;
+	else if (result == PAT_QUIET)
+		pi->quiet |= bits;
+	return 0;
+}
@@ -0,0 +1,97 @@
+#ifndef FLIPPAT_H
+#define FLIPPAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "a64.h"
+
+/*
+ * Multi-bit flip patterns over one instruction word, for faults that flip
+ * several bits of a word at once.
+ *
+ * There are C(32, k) patterns of weight k per instruction, more than a
+ * sweep can run from k = 3 or so, so they are never built up front. Each
+ * instruction keeps where its enumeration of the current weight stands and
+ * patgen_next() takes one pattern from each instruction in turn, lightest
+ * weight first, for as long as trials ask for more. A pattern is dropped
+ * when the lighter ones already tell what it does:
+ *
+ *  - decoded: the flipped word is unallocated or does what the original
+ *    does, as for single bits (kept when exhaustive);
+ *  - covered: flipping back one of its bits gives an equivalent word, so it
+ *    behaves as that lighter pattern (kept when exhaustive);
+ *  - found: it contains a pattern, or a single bit, already reported
+ *    exploitable with patgen_found(); the lighter one is the finding.
+ *
+ * Patterns the single-bit results passed to patgen_single() argue against
+ * are only deferred, to after every other pattern of their weight (as of
+ * the results recorded before patgen_weight()):
+ *
+ *  - each of its bits crashed the victim on its own;
+ *  - its bits all land in one operand field and none of them did anything
+ *    on its own.
+ *
+ * Neither is implied: two unallocated single flips can combine into an
+ * allocated word, and x0 -> x1 and x0 -> x2 being harmless says nothing
+ * about x0 -> x3. Not thread safe.
+ */
+
+// What flipping one bit did, or is known to do.
+enum pat_result {
+	PAT_QUIET, // ran as unflipped, or decodes to the same operation
+	PAT_CRASH, // killed by a signal, or decodes to an unallocated word
+	PAT_CHANGED, // anything else
+};
+
+struct pattern {
+	unsigned long offset; // file offset of the instruction
+	uint32_t insn;
+	uint32_t mask; // bits flipped
+	double prior;
+};
+
+// One instruction's enumeration of the current weight.
+struct pat_insn {
+	unsigned long offset;
+	uint32_t insn;
+	double prior;
+	uint32_t crashed, quiet; // single-bit results so far
+	uint32_t hint_crashed, hint_quiet; // as of patgen_weight()
+	uint64_t next; // next mask to look at, past 32 bits when done
+	uint8_t field[32]; // a64_field_of() per bit
+};
+
+struct patgen {
+	int exhaustive;
+	int weight;
+	int pass; // 0: plausible patterns, 1: deferred ones, 2: done
+	struct pat_insn *insns;
+	size_t ninsns, insns_cap;
+	size_t turn; // instruction the next pattern comes from
+	struct pattern *found;
+	size_t nfound, found_cap;
+	// pruned, by reason
+	unsigned long decoded, covered, superset;
+	unsigned long deferred; // run last, not pruned
+};
+
+void patgen_init(struct patgen *g, int exhaustive);
+void patgen_free(struct patgen *g);
+
+// Add an instruction to generate patterns for, in the order they are run.
+int patgen_add(struct patgen *g, unsigned long offset, uint32_t insn,
+	       double prior);
+// Start over with the patterns of `weight` bits of every instruction.
+int patgen_weight(struct patgen *g, int weight);
+// Store the next pattern of the current weight that survives pruning in
+// `out`. Returns 0 once there are none left.
+int patgen_next(struct patgen *g, struct pattern *out);
+// Patterns containing `mask` at `offset` need no trial from now on.
+int patgen_found(struct patgen *g, unsigned long offset, uint32_t mask);
+// Record `result` for every bit set in `bits` of the instruction added at
+// `offset`; it defers patterns from the next patgen_weight() on.
+int patgen_single(struct patgen *g, unsigned long offset, uint32_t bits,
+		  enum pat_result result);
+
+#endif
@@ -0,0 +1,172 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "flipsched.h"
+
+int sched_init(struct sched *s, double explore)
+{
+	memset(s, 0, sizeof(*s));
+	s->explore = explore > 0 ? explore : M_SQRT2;
+	for (int c = 0; c < A64_NCLASSES; c++) {
+		for (int f = 0; f < A64_NFIELDS; f++) {
+			s->arms[c * A64_NFIELDS + f].cls = c;
+			s->arms[c * A64_NFIELDS + f].field = f;
+		}
+	}
+	return pthread_mutex_init(&s->lock, NULL) ? -1 : 0;
+}
+
+void sched_free(struct sched *s)
+{
+	for (size_t a = 0; a < A64_NCLASSES * A64_NFIELDS; a++)
+		free(s->arms[a].order);
+	free(s->cands);
+	pthread_mutex_destroy(&s->lock);
+}
+
+int sched_add_insn(struct sched *s, unsigned long offset, uint32_t insn,
+		   double prior)
+{
+	return sched_add_bits(s, offset, insn, 0xFFFFFFFF, prior);
+}
+
+int sched_add_bits(struct sched *s, unsigned long offset, uint32_t insn,
+		   uint32_t bits, double prior)
+{
+	enum a64_class cls = a64_class_of(insn);
+
+	if (s->ready)
+		return -1;
+
+	if (s->ncands + 32 > s->cap) {
+		size_t cap = s->cap ? 2 * s->cap : 1024;
+		struct sched_cand *c = realloc(s->cands, cap * sizeof(*c));
+
+		if (!c)
+			return -1;
+		s->cands = c;
+		s->cap = cap;
+	}
+
+	for (int bit = 0; bit < 32; bit++) {
+		struct sched_cand *c;
+
+		if (!((bits >> bit) & 1))
+			continue;
+		c = &s->cands[s->ncands++];
+
+		c->offset = offset;
+		c->insn = insn;
+		c->bit = bit;
+		c->arm = cls * A64_NFIELDS + a64_field_of(insn, bit);
+		c->prior = prior;
+		s->arms[c->arm].count++;
+	}
+	return 0;
+}
+
+static int cmp_prior(const void *a, const void *b, void *cands)
+{
+	double pa = ((struct sched_cand *)cands)[*(const size_t *)a].prior;
+	double pb = ((struct sched_cand *)cands)[*(const size_t *)b].prior;
+
+	return (pa < pb) - (pa > pb);
+}
+
+// Called with s->lock held.
+static int build_arms(struct sched *s)
+{
+	for (size_t a = 0; a < A64_NCLASSES * A64_NFIELDS; a++) {
+		struct sched_arm *arm = &s->arms[a];
+
+		if (!arm->count)
+			continue;
+		arm->order = malloc(arm->count * sizeof(*arm->order));
+		if (!arm->order)
+			return -1;
+		arm->count = 0;
+	}
+	for (size_t i = 0; i < s->ncands; i++) {
+		struct sched_arm *arm = &s->arms[s->cands[i].arm];
+
+		arm->order[arm->count++] = i;
+	}
+
+	for (size_t a = 0; a < A64_NCLASSES * A64_NFIELDS; a++) {
+		if (s->arms[a].count)
+			qsort_r(s->arms[a].order, s->arms[a].count,
+				sizeof(size_t), cmp_prior, s->cands);
+	}
+
+	s->ready = 1;
+	return 0;
+}
+
+// Arms nobody has tried yet go first, best prior first. After that the UCB1
+// index decides, with an optimistic mean for arms whose trials are all
+// still running.
+static double arm_index(const struct sched *s, const struct sched_arm *arm)
+{
+	unsigned long n = arm->pulls + arm->inflight;
+	double mean;
+
+	if (!n)
+		return HUGE_VAL;
+	mean = arm->pulls ? arm->reward / arm->pulls : 1.0;
+	return mean + s->explore * sqrt(log((double)s->total) / n);
+}
+
+long sched_next(struct sched *s)
+{
+	struct sched_arm *best = NULL;
+	double best_index = -HUGE_VAL, best_prior = -HUGE_VAL;
+	size_t cand;
+
+	pthread_mutex_lock(&s->lock);
+	if (!s->ready && build_arms(s)) {
+		pthread_mutex_unlock(&s->lock);
+		return -1;
+	}
+
+	for (size_t a = 0; a < A64_NCLASSES * A64_NFIELDS; a++) {
+		struct sched_arm *arm = &s->arms[a];
+		double index, prior;
+
+		if (arm->next == arm->count)
+			continue;
+		index = arm_index(s, arm);
+		prior = s->cands[arm->order[arm->next]].prior;
+		if (index > best_index ||
+		    (index == best_index && prior > best_prior)) {
+			best = arm;
+			best_index = index;
+			best_prior = prior;
+		}
+	}
+
+	if (!best) {
+		pthread_mutex_unlock(&s->lock);
+		return -1;
+	}
+
+	cand = best->order[best->next++];
+	best->inflight++;
+	s->total++;
+	pthread_mutex_unlock(&s->lock);
+
+	return cand;
+}
+
+void sched_report(struct sched *s, long cand, double reward)
+{
+	struct sched_arm *arm;
+
+	pthread_mutex_lock(&s->lock);
+	arm = &s->arms[s->cands[cand].arm];
+	arm->inflight--;
+	arm->pulls++;
+	arm->reward += reward;
+	pthread_mutex_unlock(&s->lock);
+}
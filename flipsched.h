@@ -0,0 +1,67 @@
+#ifndef FLIPSCHED_H
+#define FLIPSCHED_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "a64.h"
+
+/*
+ * Feedback-guided order for (instruction, bit) flip candidates.
+ *
+ * Candidates are grouped into arms by the encoding class and field the bit
+ * lands in (the cond field of a b.cond, the Rn field of a cmp, ...), since
+ * neighbouring bits of one field mostly do the same thing. Arms are chosen
+ * with UCB1 on the rewards reported for their finished trials; within an
+ * arm candidates go out in order of their prior, e.g. the heat score from
+ * heatmap_rank(). Trials still running count as pulls for the exploration
+ * term so concurrent workers spread over arms. All calls are thread safe.
+ */
+
+struct sched_cand {
+	unsigned long offset; // file offset of the instruction
+	uint32_t insn;
+	uint8_t bit;
+	uint16_t arm;
+	double prior;
+};
+
+struct sched_arm {
+	enum a64_class cls;
+	enum a64_field field;
+	size_t *order; // candidate indices, best prior first
+	size_t count;
+	size_t next;
+	unsigned long pulls; // finished trials
+	unsigned long inflight;
+	double reward;
+};
+
+struct sched {
+	pthread_mutex_t lock;
+	struct sched_cand *cands;
+	size_t ncands, cap;
+	int ready; // arms built, no more candidates
+	struct sched_arm arms[A64_NCLASSES * A64_NFIELDS];
+	unsigned long total; // pulls + inflight over all arms
+	double explore; // UCB1 exploration weight, sqrt(2) by default
+};
+
+int sched_init(struct sched *s, double explore);
+void sched_free(struct sched *s);
+
+// Add every bit of `insn` as a candidate. Call before the first sched_next().
+int sched_add_insn(struct sched *s, unsigned long offset, uint32_t insn,
+		   double prior);
+// The same for the bits set in `bits` only, e.g. those a64_classify() does
+// not already know the outcome of.
+int sched_add_bits(struct sched *s, unsigned long offset, uint32_t insn,
+		   uint32_t bits, double prior);
+
+// Hand out the next candidate; returns its index, or -1 once all are out.
+long sched_next(struct sched *s);
+// Report the reward in [0, 1] of a finished trial.
+void sched_report(struct sched *s, long cand, double reward);
+
+#endif
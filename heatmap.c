@@ -0,0 +1,607 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <elf.h>
+#include <signal.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/user.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "a64.h"
+#include "heatmap.h"
+#include "libflip/flip.h"
+
+#ifndef PAGE_SIZE
+#define PAGE_SIZE 4096UL
+#endif
+#define PERF_RING_PAGES 1024 // 4MB, 256k samples
+#define MAX_EXEC_MAPS 8
+#define GUARD_CALL_WINDOW 4 // a guard's call is at most this far before it
+
+#define PM_PRESENT (1ULL << 63)
+#define PM_SWAPPED (1ULL << 62)
+#define PM_SOFT_DIRTY (1ULL << 55)
+
+struct exec_map {
+	unsigned long start, end, offset;
+};
+
+int heatmap_init(struct heatmap *hm, const char *path)
+{
+	const Elf64_Phdr *text;
+
+	memset(hm, 0, sizeof(*hm));
+	if (!realpath(path, hm->path)) {
+		perror(path);
+		return -1;
+	}
+
+	hm->elf = flip_elf_open(hm->path);
+	if (!hm->elf) {
+		perror("Failed to open victim");
+		return -1;
+	}
+	hm->image = flip_elf_image(hm->elf, &hm->image_size);
+
+	text = flip_elf_text(hm->elf);
+	if (text) {
+		hm->text_off = text->p_offset;
+		hm->text_len = text->p_filesz & ~3UL;
+	}
+	if (!hm->text_len) {
+		fprintf(stderr, "%s: no executable segment\n", hm->path);
+		goto err;
+	}
+
+	hm->hits = calloc(hm->text_len / 4, sizeof(*hm->hits));
+	hm->heat = calloc(hm->text_len / 4, sizeof(*hm->heat));
+	if (!hm->hits || !hm->heat)
+		goto err;
+
+	return 0;
+
+err:
+	heatmap_free(hm);
+	return -1;
+}
+
+void heatmap_free(struct heatmap *hm)
+{
+	flip_elf_close(hm->elf);
+	free(hm->hits);
+	free(hm->heat);
+	free(hm->pages);
+	free(hm->page_index);
+	hm->elf = NULL;
+	hm->image = NULL;
+	hm->hits = NULL;
+	hm->heat = NULL;
+	hm->pages = NULL;
+	hm->page_index = NULL;
+	hm->npages = hm->pages_cap = 0;
+}
+
+static void add_hit(struct heatmap *hm, const struct exec_map *maps,
+		    int nmaps, unsigned long ip, unsigned long weight)
+{
+	for (int i = 0; i < nmaps; i++) {
+		unsigned long off;
+
+		if (ip < maps[i].start || ip >= maps[i].end)
+			continue;
+		off = ip - maps[i].start + maps[i].offset;
+		if (off >= hm->text_off && off < hm->text_off + hm->text_len)
+			hm->hits[(off - hm->text_off) / 4] += weight;
+		return;
+	}
+}
+
+struct exec_maps_ctx {
+	const char *path;
+	struct exec_map *maps;
+	int n;
+};
+
+static int add_exec_map(void *arg, const struct flip_map *map)
+{
+	struct exec_maps_ctx *c = arg;
+
+	if (!(map->prot & FLIP_PROT_EXEC) || strcmp(map->path, c->path) != 0)
+		return 0;
+	c->maps[c->n].start = map->start;
+	c->maps[c->n].end = map->end;
+	c->maps[c->n].offset = map->offset;
+	return ++c->n == MAX_EXEC_MAPS;
+}
+
+// Executable mappings of the profiled binary, present from the exec stop on.
+static int read_exec_maps(struct heatmap *hm, pid_t pid, struct exec_map *maps)
+{
+	struct exec_maps_ctx c = { .path = hm->path, .maps = maps };
+
+	if (flip_maps_each(pid, add_exec_map, &c) < 0)
+		perror("Failed to open /proc/[pid]/maps");
+	return c.n;
+}
+
+static size_t page_hash(const char *region, unsigned long page)
+{
+	uint64_t h = 0xcbf29ce484222325ULL; // FNV-1a
+
+	for (; *region; region++)
+		h = (h ^ (uint8_t)*region) * 0x100000001b3ULL;
+	h = (h ^ page) * 0x100000001b3ULL;
+	return h ^ (h >> 32);
+}
+
+// Slot of the index where (region, page) is, or would go. The index has
+// twice pages_cap slots, a power of two, so it is never full.
+static size_t *page_lookup(struct heatmap *hm, const char *region,
+			   unsigned long page)
+{
+	size_t mask = 2 * hm->pages_cap - 1;
+	size_t i = page_hash(region, page) & mask;
+
+	for (;; i = (i + 1) & mask) {
+		const struct page_heat *p;
+
+		if (!hm->page_index[i])
+			return &hm->page_index[i];
+		p = &hm->pages[hm->page_index[i] - 1];
+		if (p->page == page && strcmp(p->region, region) == 0)
+			return &hm->page_index[i];
+	}
+}
+
+static int pages_grow(struct heatmap *hm)
+{
+	size_t cap = hm->pages_cap ? 2 * hm->pages_cap : 64;
+	struct page_heat *p = realloc(hm->pages, cap * sizeof(*p));
+	size_t *index = calloc(2 * cap, sizeof(*index));
+
+	if (p)
+		hm->pages = p;
+	if (!p || !index) {
+		free(index);
+		return -1;
+	}
+	free(hm->page_index);
+	hm->page_index = index;
+	hm->pages_cap = cap;
+	for (size_t i = 0; i < hm->npages; i++)
+		*page_lookup(hm, hm->pages[i].region, hm->pages[i].page) = i + 1;
+	return 0;
+}
+
+static struct page_heat *page_slot(struct heatmap *hm, const char *region,
+				   unsigned long page)
+{
+	char name[sizeof(hm->pages->region)];
+	struct page_heat *p;
+	size_t *slot;
+
+	// keyed by the name as stored, which may be truncated
+	snprintf(name, sizeof(name), "%.63s", region);
+	if (hm->npages == hm->pages_cap && pages_grow(hm))
+		return NULL;
+
+	slot = page_lookup(hm, name, page);
+	if (*slot)
+		return &hm->pages[*slot - 1];
+
+	p = &hm->pages[hm->npages++];
+	memset(p, 0, sizeof(*p));
+	memcpy(p->region, name, sizeof(name));
+	p->page = page;
+	*slot = hm->npages;
+	return p;
+}
+
+struct pages_ctx {
+	struct heatmap *hm;
+	int pagemap;
+};
+
+static int read_map_pages(void *arg, const struct flip_map *map)
+{
+	struct pages_ctx *c = arg;
+	struct heatmap *hm = c->hm;
+	const char *region;
+	int file_backed = 0;
+
+	if (strcmp(map->path, hm->path) == 0) {
+		region = hm->path;
+		file_backed = 1;
+	} else if (!strcmp(map->path, "[heap]") ||
+		   !strcmp(map->path, "[stack]")) {
+		region = map->path;
+	} else if (!map->path[0]) {
+		region = "[anon]";
+	} else {
+		return 0;
+	}
+
+	for (unsigned long va = map->start; va < map->end; va += PAGE_SIZE) {
+		struct page_heat *p;
+		uint64_t ent;
+		unsigned long page;
+
+		if (pread(c->pagemap, &ent, sizeof(ent),
+			  va / PAGE_SIZE * sizeof(ent)) != sizeof(ent))
+			break;
+		if (!(ent & (PM_PRESENT | PM_SWAPPED)))
+			continue;
+
+		if (file_backed)
+			page = (map->offset + va - map->start) / PAGE_SIZE;
+		else if (!strcmp(region, "[stack]"))
+			page = (map->end - va) / PAGE_SIZE - 1;
+		else
+			page = (va - map->start) / PAGE_SIZE;
+
+		p = page_slot(hm, region, page);
+		if (!p)
+			return 1;
+		// a page can be seen through several mappings
+		if (p->last_run == hm->runs + 1)
+			continue;
+		p->last_run = hm->runs + 1;
+		p->touched++;
+		if (ent & PM_SOFT_DIRTY)
+			p->written++;
+	}
+	return 0;
+}
+
+// Record which pages of the victim's own mappings, heap, stack and anonymous
+// memory were mapped and written. File mappings are indexed by file page,
+// the stack from its top, everything else from the start of the mapping.
+// Fault-around maps a few untouched neighbours of file pages as well.
+static void read_pages(struct heatmap *hm, pid_t pid)
+{
+	struct pages_ctx c = { .hm = hm };
+	char path[64];
+
+	snprintf(path, sizeof(path), "/proc/%d/pagemap", pid);
+	c.pagemap = open(path, O_RDONLY);
+	if (c.pagemap < 0 || flip_maps_each(pid, read_map_pages, &c) < 0)
+		perror("Failed to open /proc/[pid]/pagemap");
+	if (c.pagemap >= 0)
+		close(c.pagemap);
+}
+
+static int perf_open(pid_t pid, unsigned long period)
+{
+	struct perf_event_attr attr = {
+		.size = sizeof(attr),
+		.type = PERF_TYPE_HARDWARE,
+		.config = PERF_COUNT_HW_INSTRUCTIONS,
+		.sample_period = period,
+		.sample_type = PERF_SAMPLE_IP,
+		.exclude_kernel = 1,
+		.exclude_hv = 1,
+	};
+
+	return syscall(SYS_perf_event_open, &attr, pid, -1, -1,
+		       PERF_FLAG_FD_CLOEXEC);
+}
+
+static void perf_drain(struct heatmap *hm, void *ring,
+		       const struct exec_map *maps, int nmaps,
+		       unsigned long period)
+{
+	struct perf_event_mmap_page *meta = ring;
+	uint8_t *data = (uint8_t *)ring + PAGE_SIZE;
+	uint64_t size = (uint64_t)PERF_RING_PAGES * PAGE_SIZE;
+	uint64_t head = __atomic_load_n(&meta->data_head, __ATOMIC_ACQUIRE);
+	uint64_t tail = meta->data_tail;
+
+	while (tail < head) {
+		struct perf_event_header hdr;
+		uint64_t rec[4];
+
+		// records may wrap around the end of the ring
+		for (size_t i = 0; i < sizeof(hdr); i++)
+			((uint8_t *)&hdr)[i] = data[(tail + i) % size];
+		if (hdr.size < sizeof(hdr))
+			break;
+		for (size_t i = 0; i < sizeof(rec) && i < hdr.size; i++)
+			((uint8_t *)rec)[i] = data[(tail + i) % size];
+
+		if (hdr.type == PERF_RECORD_SAMPLE) {
+			add_hit(hm, maps, nmaps, rec[1], period);
+			hm->samples++;
+		} else if (hdr.type == PERF_RECORD_LOST) {
+			hm->lost += rec[2];
+		}
+		tail += hdr.size;
+	}
+	__atomic_store_n(&meta->data_tail, tail, __ATOMIC_RELEASE);
+}
+
+static unsigned long get_pc(pid_t pid)
+{
+	struct user_regs_struct regs;
+	struct iovec iov = { &regs, sizeof(regs) };
+
+	if (ptrace(PTRACE_GETREGSET, pid, (void *)NT_PRSTATUS, &iov) < 0)
+		return 0;
+#if defined(__aarch64__)
+	return regs.pc;
+#elif defined(__x86_64__)
+	return regs.rip;
+#else
+#error "get_pc: unsupported architecture"
+#endif
+}
+
+// Step the victim one instruction at a time until it is about to exit.
+static int step_until_exit(struct heatmap *hm, pid_t pid,
+			   const struct exec_map *maps, int nmaps)
+{
+	int status, sig = 0;
+
+	for (;;) {
+		if (ptrace(PTRACE_SINGLESTEP, pid, NULL, sig) < 0 ||
+		    waitpid(pid, &status, 0) < 0)
+			return -1;
+		if (WIFEXITED(status) || WIFSIGNALED(status))
+			return -1;
+		if (status >> 8 == (SIGTRAP | (PTRACE_EVENT_EXIT << 8)))
+			return 0;
+
+		sig = WSTOPSIG(status);
+		if (sig == SIGTRAP) {
+			add_hit(hm, maps, nmaps, get_pc(pid), 1);
+			hm->samples++;
+			sig = 0;
+		}
+	}
+}
+
+static int cont_until_exit(pid_t pid)
+{
+	int status, sig = 0;
+
+	for (;;) {
+		if (ptrace(PTRACE_CONT, pid, NULL, sig) < 0 ||
+		    waitpid(pid, &status, 0) < 0)
+			return -1;
+		if (WIFEXITED(status) || WIFSIGNALED(status))
+			return -1;
+		if (status >> 8 == (SIGTRAP | (PTRACE_EVENT_EXIT << 8)))
+			return 0;
+		sig = WSTOPSIG(status);
+		if (sig == SIGTRAP)
+			sig = 0;
+	}
+}
+
+int heatmap_run(struct heatmap *hm, char *const argv[], const char *input,
+		unsigned long period)
+{
+	struct exec_map maps[MAX_EXEC_MAPS];
+	char path[64];
+	void *ring = MAP_FAILED;
+	int nmaps, status, perf_fd = -1, fd, ret;
+	pid_t pid;
+
+	pid = fork();
+	if (pid < 0) {
+		perror("fork failed");
+		return -1;
+	}
+	if (pid == 0) {
+		fd = open(input ? input : "/dev/null", O_RDONLY);
+		if (fd < 0 || dup2(fd, STDIN_FILENO) < 0) {
+			perror("Failed to redirect stdin");
+			_exit(EXIT_FAILURE);
+		}
+		if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) < 0)
+			perror("PTRACE_TRACEME failed");
+		execv(argv[0], argv);
+		perror("execv failed");
+		_exit(EXIT_FAILURE);
+	}
+
+	// stopped right after exec, before the first user instruction
+	if (waitpid(pid, &status, 0) < 0 || !WIFSTOPPED(status)) {
+		fprintf(stderr, "victim did not stop after exec\n");
+		return -1;
+	}
+	ptrace(PTRACE_SETOPTIONS, pid, 0,
+	       PTRACE_O_EXITKILL | PTRACE_O_TRACEEXIT);
+
+	// start soft-dirty tracking from a clean slate
+	snprintf(path, sizeof(path), "/proc/%d/clear_refs", pid);
+	fd = open(path, O_WRONLY);
+	if (fd < 0 || write(fd, "4", 1) != 1)
+		fprintf(stderr, "soft-dirty tracking unavailable\n");
+	if (fd >= 0)
+		close(fd);
+
+	nmaps = read_exec_maps(hm, pid, maps);
+
+	if (period) {
+		perf_fd = perf_open(pid, period);
+		if (perf_fd >= 0)
+			ring = mmap(NULL, (PERF_RING_PAGES + 1) * PAGE_SIZE,
+				    PROT_READ | PROT_WRITE, MAP_SHARED, perf_fd,
+				    0);
+		if (ring == MAP_FAILED) {
+			perror("perf sampling unavailable, single-stepping");
+			period = 0;
+		}
+	}
+
+	ret = period ? cont_until_exit(pid) : step_until_exit(hm, pid, maps,
+							      nmaps);
+	if (ret == 0) {
+		read_pages(hm, pid);
+		hm->runs++;
+	} else {
+		fprintf(stderr, "victim died before its exit stop\n");
+	}
+
+	if (ring != MAP_FAILED) {
+		if (ret == 0)
+			perf_drain(hm, ring, maps, nmaps, period);
+		munmap(ring, (PERF_RING_PAGES + 1) * PAGE_SIZE);
+	}
+	if (perf_fd >= 0)
+		close(perf_fd);
+
+	ptrace(PTRACE_DETACH, pid, NULL, NULL);
+	waitpid(pid, NULL, 0);
+	return ret;
+}
+
+static const char *insn_kind(uint32_t insn)
+{
+	if (a64_is_call(insn))
+		return "bl";
+	if (a64_is_cond_branch(insn))
+		return a64_class_name[a64_class_of(insn)];
+	if (a64_is_branch(insn))
+		return "branch";
+	if (a64_sets_flags(insn))
+		return "flags";
+	return "other";
+}
+
+static uint32_t insn_at(const struct heatmap *hm, size_t i)
+{
+	uint32_t insn;
+
+	memcpy(&insn, hm->image + hm->text_off + i * 4, sizeof(insn));
+	return insn;
+}
+
+void heatmap_finish(struct heatmap *hm)
+{
+	size_t n = hm->text_len / 4;
+	uint8_t *leader = calloc(n + 1, 1);
+
+	if (!leader || !hm->runs) {
+		free(leader);
+		return;
+	}
+
+	leader[0] = 1;
+	for (size_t i = 0; i < n; i++) {
+		uint32_t insn = insn_at(hm, i);
+		int64_t t;
+
+		if (!a64_is_branch(insn))
+			continue;
+		leader[i + 1] = 1;
+		t = (int64_t)i + a64_branch_disp(insn);
+		if (a64_branch_disp(insn) && t >= 0 && (size_t)t < n)
+			leader[t] = 1;
+	}
+	leader[n] = 1;
+
+	for (size_t start = 0; start < n;) {
+		size_t end = start + 1;
+		uint64_t sum = hm->hits[start];
+		double heat;
+
+		while (!leader[end]) {
+			sum += hm->hits[end];
+			end++;
+		}
+		heat = (double)sum / (end - start) / hm->runs;
+		for (size_t i = start; i < end; i++)
+			hm->heat[i] = heat;
+		start = end;
+	}
+
+	free(leader);
+}
+
+static int cmp_score(const void *a, const void *b)
+{
+	const struct flip_candidate *ca = a, *cb = b;
+
+	return (ca->score < cb->score) - (ca->score > cb->score);
+}
+
+size_t heatmap_rank(const struct heatmap *hm, struct flip_candidate *out,
+		    size_t max)
+{
+	size_t n = hm->text_len / 4, count = 0;
+	unsigned *dist = malloc(n * sizeof(*dist));
+	struct flip_candidate *all;
+
+	if (!dist)
+		return 0;
+
+	// a guard is a conditional branch shortly after a call, as in
+	// bl check_password; cmp w0, #0; b.ne
+	for (size_t i = 0; i < n; i++)
+		dist[i] = UINT32_MAX;
+	for (size_t i = 0; i < n; i++) {
+		int guard = 0;
+
+		if (!a64_is_cond_branch(insn_at(hm, i)))
+			continue;
+		for (size_t k = 1; k <= GUARD_CALL_WINDOW && k <= i; k++) {
+			uint32_t prev = insn_at(hm, i - k);
+
+			if (a64_is_call(prev))
+				guard = 1;
+			if (a64_is_branch(prev))
+				break;
+		}
+		if (guard)
+			dist[i] = 0;
+	}
+	// two-pass distance transform
+	for (size_t i = 1; i < n; i++)
+		if (dist[i - 1] != UINT32_MAX && dist[i - 1] + 1 < dist[i])
+			dist[i] = dist[i - 1] + 1;
+	for (size_t i = n - 1; i-- > 0;)
+		if (dist[i + 1] != UINT32_MAX && dist[i + 1] + 1 < dist[i])
+			dist[i] = dist[i + 1] + 1;
+
+	all = malloc(n * sizeof(*all));
+	if (!all) {
+		free(dist);
+		return 0;
+	}
+
+	// Cold code cannot change the outcome and is dropped. Beyond running
+	// at all, more executions matter much less than being next to a
+	// guard, hence the logarithm.
+	for (size_t i = 0; i < n; i++) {
+		struct flip_candidate *c = &all[count];
+
+		if (hm->heat[i] <= 0 || dist[i] == UINT32_MAX)
+			continue;
+		c->offset = hm->text_off + i * 4;
+		c->insn = insn_at(hm, i);
+		c->kind = insn_kind(c->insn);
+		c->heat = hm->heat[i];
+		c->distance = dist[i];
+		c->score = log2(1 + c->heat) / (1 + c->distance);
+		count++;
+	}
+
+	qsort(all, count, sizeof(*all), cmp_score);
+	if (count > max)
+		count = max;
+	memcpy(out, all, count * sizeof(*all));
+
+	free(all);
+	free(dist);
+	return count;
+}
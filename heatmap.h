@@ -0,0 +1,76 @@
+#ifndef HEATMAP_H
+#define HEATMAP_H
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Execution profile of a victim binary, accumulated over several runs.
+ *
+ * Instruction heat is kept per 4-byte slot of the binary's executable
+ * segment, keyed by file offset so it is independent of ASLR. Runs either
+ * sample user-mode instructions with perf (`period` instructions apart) or,
+ * with period 0 or when no PMU is available, single-step the victim under
+ * ptrace for exact counts. Touched and written data pages are read from
+ * /proc/pid/pagemap while the victim is stopped on its way out.
+ */
+
+struct flip_elf;
+
+struct page_heat {
+	char region[64]; // mapped file or [heap]/[stack]/[anon]
+	unsigned long page; // page index within the region
+	unsigned touched; // runs in which it was mapped at exit
+	unsigned written; // runs in which it was soft-dirty at exit
+	unsigned last_run;
+};
+
+struct heatmap {
+	char path[PATH_MAX]; // canonical, as it appears in /proc/pid/maps
+	struct flip_elf *elf;
+	const uint8_t *image; // the whole file
+	size_t image_size;
+	unsigned long text_off; // executable PT_LOAD, file offsets
+	unsigned long text_len;
+	uint64_t *hits; // per instruction: estimated executions, all runs
+	double *heat; // per instruction: estimated executions per run
+
+	struct page_heat *pages;
+	size_t npages, pages_cap;
+	size_t *page_index; // open addressing, 1 + index into pages, 0 free
+
+	unsigned runs;
+	unsigned long samples;
+	unsigned long lost;
+};
+
+struct flip_candidate {
+	unsigned long offset; // file offset of the instruction
+	uint32_t insn;
+	const char *kind;
+	double heat;
+	unsigned distance; // instructions to the nearest guarding branch
+	double score;
+};
+
+int heatmap_init(struct heatmap *hm, const char *path);
+void heatmap_free(struct heatmap *hm);
+
+// Run `argv` (argv[0] must name the profiled binary) once with stdin from
+// `input` (/dev/null if NULL) and add it to the profile.
+int heatmap_run(struct heatmap *hm, char *const argv[], const char *input,
+		unsigned long period);
+
+// Spread raw hits evenly over basic blocks into hm->heat. Every instruction
+// in a straight-line block executes equally often, so this fills in the
+// instructions sampling skipped.
+void heatmap_finish(struct heatmap *hm);
+
+// Rank executed instructions near security-relevant branches (a call whose
+// result feeds a conditional branch). Returns the number stored in `out`,
+// best first.
+size_t heatmap_rank(const struct heatmap *hm, struct flip_candidate *out,
+		    size_t max);
+
+#endif
@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "heatmap.h"
+
+#define VICTIM_PATH "/usr/local/bin/mysudo"
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"USAGE: %s [-n runs] [-p sample period, 0 to single-step] [-i stdin file]\n"
+		"          [-k candidates] [-d] [victim [args...]]\n",
+		prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	static char *default_argv[] = { VICTIM_PATH, "../test/test-exe",
+					NULL };
+	struct heatmap hm;
+	struct flip_candidate *cands;
+	char **victim_argv = default_argv;
+	const char *input = NULL;
+	unsigned long period = 1000, top = 20;
+	unsigned runs = 5;
+	int show_pages = 0, opt;
+	size_t n;
+
+	while ((opt = getopt(argc, argv, "+n:p:i:k:d")) != -1) {
+		switch (opt) {
+		case 'n':
+			runs = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			period = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			input = optarg;
+			break;
+		case 'k':
+			top = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			show_pages = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind < argc)
+		victim_argv = &argv[optind];
+	if (!runs || !top)
+		usage(argv[0]);
+
+	if (heatmap_init(&hm, victim_argv[0]))
+		exit(EXIT_FAILURE);
+
+	for (unsigned i = 0; i < runs; i++)
+		heatmap_run(&hm, victim_argv, input, period);
+	if (!hm.runs) {
+		fprintf(stderr, "no complete run of %s\n", hm.path);
+		exit(EXIT_FAILURE);
+	}
+	heatmap_finish(&hm);
+
+	printf("%s: %u runs, %lu samples, %lu lost\n", hm.path, hm.runs,
+	       hm.samples, hm.lost);
+
+	cands = calloc(top, sizeof(*cands));
+	if (!cands)
+		exit(EXIT_FAILURE);
+	n = heatmap_rank(&hm, cands, top);
+
+	printf("\n%10s %10s %-8s %12s %6s %8s\n", "offset", "insn", "kind",
+	       "execs/run", "dist", "score");
+	for (size_t i = 0; i < n; i++)
+		printf("%#10lx %#10x %-8s %12.1f %6u %8.3f\n", cands[i].offset,
+		       cands[i].insn, cands[i].kind, cands[i].heat,
+		       cands[i].distance, cands[i].score);
+
+	if (show_pages) {
+		printf("\n%-40s %8s %8s %8s\n", "region", "page", "touched",
+		       "written");
+		for (size_t i = 0; i < hm.npages; i++)
+			printf("%-40s %8lu %8u %8u\n", hm.pages[i].region,
+			       hm.pages[i].page, hm.pages[i].touched,
+			       hm.pages[i].written);
+	}
+
+	free(cands);
+	heatmap_free(&hm);
+	return EXIT_SUCCESS;
+}
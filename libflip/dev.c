@@ -0,0 +1,416 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "internal.h"
+
+#define FLIP_DEV_PATH "/dev/bitflip"
+#define FLIP_DEV_ENV "FLIP_DEV"
+
+// the ring opcodes are the kernel's
+_Static_assert((int)FLIP_OP_BIT == BITFLIP_OP_FLIP &&
+		       (int)FLIP_OP_BIT_LAZY == BITFLIP_OP_FLIP_LAZY &&
+		       (int)FLIP_OP_PFN == BITFLIP_OP_FLIP_PFN,
+	       "flip_op out of sync with bitflip_op");
+_Static_assert(FLIP_MASK_WORDS == BITFLIP_MASK_WORDS,
+	       "FLIP_MASK_WORDS out of sync with the module");
+
+struct flip_dev *flip_dev_open(const char *path)
+{
+	struct flip_dev *dev = calloc(1, sizeof(*dev));
+	int ret;
+
+	if (!dev)
+		return NULL;
+	if (!path)
+		path = getenv(FLIP_DEV_ENV);
+	if (!path || !*path)
+		path = FLIP_DEV_PATH;
+
+	dev->fd = -1;
+	pthread_mutex_init(&dev->lock, NULL);
+	if (strncmp(path, "vdimm", 5) == 0 && (!path[5] || path[5] == ':'))
+		ret = flip_vdimm_open(dev, path);
+	else
+		ret = flip_kernel_open(dev, path);
+	if (ret) {
+		int err = errno;
+
+		pthread_mutex_destroy(&dev->lock);
+		free(dev);
+		errno = err;
+		return NULL;
+	}
+	return dev;
+}
+
+void flip_dev_close(struct flip_dev *dev)
+{
+	if (!dev)
+		return;
+	dev->ops->close(dev);
+	pthread_mutex_destroy(&dev->lock);
+	free(dev->journal);
+	free(dev->pending);
+	free(dev);
+}
+
+int flip_dev_fd(const struct flip_dev *dev)
+{
+	return dev->fd;
+}
+
+int flip_dev_backend(const struct flip_dev *dev)
+{
+	return dev->ops->kind;
+}
+
+static int undo_push(struct flip_undo **arr, size_t *n, size_t *cap,
+		     const struct flip_undo *u)
+{
+	if (*n == *cap) {
+		size_t ncap = *cap ? 2 * *cap : 64;
+		struct flip_undo *p = realloc(*arr, ncap * sizeof(*p));
+
+		if (!p)
+			return -1;
+		*arr = p;
+		*cap = ncap;
+	}
+	(*arr)[(*n)++] = *u;
+	return 0;
+}
+
+int flip_journal_add(struct flip_dev *dev, enum flip_op op, pid_t pid,
+		     unsigned long vaddr, int arg)
+{
+	struct flip_undo u = { .op = op, .pid = pid, .vaddr = vaddr,
+			       .arg = arg };
+
+	return undo_push(&dev->journal, &dev->njournal, &dev->journal_cap, &u);
+}
+
+static void journal(struct flip_dev *dev, enum flip_op op, pid_t pid,
+		    unsigned long vaddr, int arg)
+{
+	pthread_mutex_lock(&dev->lock);
+	flip_journal_add(dev, op, pid, vaddr, arg);
+	pthread_mutex_unlock(&dev->lock);
+}
+
+int flip_bit(struct flip_dev *dev, pid_t pid, unsigned long vaddr, int bit)
+{
+	if (dev->ops->bit(dev, pid, vaddr, bit))
+		return -1;
+	journal(dev, FLIP_OP_BIT, pid, vaddr, bit);
+	return 0;
+}
+
+int flip_bit_lazy(struct flip_dev *dev, pid_t pid, unsigned long vaddr,
+		  int bit)
+{
+	return dev->ops->bit_lazy(dev, pid, vaddr, bit);
+}
+
+int flip_pfn(struct flip_dev *dev, pid_t pid, unsigned long vaddr, int shift)
+{
+	if (dev->ops->pfn(dev, pid, vaddr, shift))
+		return -1;
+	journal(dev, FLIP_OP_PFN, pid, vaddr, shift);
+	return 0;
+}
+
+int flip_mask(struct flip_dev *dev, pid_t pid, unsigned long vaddr,
+	      const uint64_t *mask, unsigned nwords)
+{
+	if (!nwords || nwords > FLIP_MASK_WORDS || vaddr % sizeof(*mask) ||
+	    vaddr % 64 + nwords * sizeof(*mask) > 64) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (dev->ops->mask(dev, pid, vaddr, mask, nwords))
+		return -1;
+
+	pthread_mutex_lock(&dev->lock);
+	for (unsigned i = 0; i < nwords; i++) {
+		struct flip_undo u = { .op = FLIP_UNDO_MASK, .pid = pid,
+				       .vaddr = vaddr + i * sizeof(*mask),
+				       .mask = mask[i] };
+
+		if (mask[i])
+			undo_push(&dev->journal, &dev->njournal,
+				  &dev->journal_cap, &u);
+	}
+	pthread_mutex_unlock(&dev->lock);
+	return 0;
+}
+
+// Stand in for `*user_data` until the completion comes back. Added before
+// the flip can complete, EBUSY once a full CQ's worth is outstanding.
+static int expect_completion(struct flip_dev *dev, enum flip_op op,
+			     pid_t pid, unsigned long vaddr, int arg,
+			     uint64_t *user_data)
+{
+	struct flip_undo u = { .op = op, .pid = pid, .vaddr = vaddr,
+			       .arg = arg, .user_data = *user_data };
+	int ret = -1;
+
+	if (!dev->ring)
+		return 0;
+	pthread_mutex_lock(&dev->lock);
+	if (dev->npending >= dev->params.cq_entries) {
+		errno = EBUSY;
+	} else {
+		u.tag = dev->next_tag++;
+		ret = undo_push(&dev->pending, &dev->npending,
+				&dev->pending_cap, &u);
+		*user_data = u.tag;
+	}
+	pthread_mutex_unlock(&dev->lock);
+	return ret;
+}
+
+static struct flip_undo *find_pending(struct flip_dev *dev, uint64_t tag)
+{
+	for (size_t i = 0; i < dev->npending; i++) {
+		if (dev->pending[i].tag == tag)
+			return &dev->pending[i];
+	}
+	return NULL;
+}
+
+static void drop_pending(struct flip_dev *dev, struct flip_undo *u)
+{
+	*u = dev->pending[--dev->npending];
+}
+
+// The flip was refused, no completion will come.
+static void unexpect_completion(struct flip_dev *dev, uint64_t tag)
+{
+	struct flip_undo *u;
+
+	if (!dev->ring)
+		return;
+	pthread_mutex_lock(&dev->lock);
+	u = find_pending(dev, tag);
+	if (u)
+		drop_pending(dev, u);
+	pthread_mutex_unlock(&dev->lock);
+}
+
+int flip_timed(struct flip_dev *dev, pid_t pid, unsigned long vaddr, int bit,
+	       uint64_t delay_ns, uint64_t insn_count, uint64_t user_data)
+{
+	if (expect_completion(dev, FLIP_OP_BIT, pid, vaddr, bit, &user_data))
+		return -1;
+	if (dev->ops->timed(dev, pid, vaddr, bit, delay_ns, insn_count,
+			    user_data)) {
+		int err = errno;
+
+		unexpect_completion(dev, user_data);
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+int flip_uprobe(struct flip_dev *dev, pid_t pid, unsigned long vaddr, int bit,
+		const char *path, uint64_t offset, uint64_t user_data)
+{
+	if (expect_completion(dev, FLIP_OP_BIT, pid, vaddr, bit, &user_data))
+		return -1;
+	if (dev->ops->uprobe(dev, pid, vaddr, bit, path, offset, user_data)) {
+		int err = errno;
+
+		unexpect_completion(dev, user_data);
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+void flip_ring_layout(struct bitflip_ring_params *params)
+{
+	size_t line = 64, page = sysconf(_SC_PAGESIZE);
+	size_t sq_off, cq_off;
+
+	sq_off = (sizeof(struct bitflip_ring_hdr) + line - 1) & ~(line - 1);
+	cq_off = (sq_off + params->sq_entries * sizeof(struct bitflip_sqe) +
+		  line - 1) & ~(line - 1);
+	params->cq_entries = 2 * params->sq_entries;
+	params->sq_off = sq_off;
+	params->cq_off = cq_off;
+	params->size = (cq_off + params->cq_entries *
+				 sizeof(struct bitflip_cqe) + page - 1) &
+		       ~(page - 1);
+}
+
+int flip_ring_setup(struct flip_dev *dev, unsigned entries)
+{
+	unsigned sq = 1;
+
+	if (dev->ring) {
+		errno = EBUSY;
+		return -1;
+	}
+	while (sq < entries && sq < BITFLIP_RING_MAX)
+		sq <<= 1;
+
+	if (dev->ops->ring_setup(dev, sq))
+		return -1;
+	dev->sq_tail = ((struct bitflip_ring_hdr *)dev->ring)->sq_tail;
+	return 0;
+}
+
+int flip_ring_submit(struct flip_dev *dev, enum flip_op op, pid_t pid,
+		     unsigned long vaddr, int arg, uint64_t user_data)
+{
+	struct bitflip_ring_hdr *hdr = dev->ring;
+	struct bitflip_sqe *sqe;
+
+	if (!hdr) {
+		errno = ENXIO;
+		return -1;
+	}
+	if (dev->sq_tail - __atomic_load_n(&hdr->sq_head, __ATOMIC_ACQUIRE) >
+	    hdr->sq_mask) {
+		errno = EBUSY;
+		return -1;
+	}
+	if (expect_completion(dev, op, pid, vaddr, arg, &user_data))
+		return -1;
+
+	sqe = (struct bitflip_sqe *)((char *)dev->ring + dev->params.sq_off) +
+	      (dev->sq_tail & hdr->sq_mask);
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = op;
+	sqe->pid = pid;
+	if (op == FLIP_OP_PFN)
+		sqe->pfn_shift = arg;
+	else
+		sqe->target_bit = arg;
+	sqe->vaddr = vaddr;
+	sqe->user_data = user_data;
+	dev->sq_tail++;
+	return 0;
+}
+
+long flip_ring_enter(struct flip_dev *dev, unsigned max)
+{
+	struct bitflip_ring_hdr *hdr = dev->ring;
+
+	if (!hdr) {
+		errno = ENXIO;
+		return -1;
+	}
+	__atomic_store_n(&hdr->sq_tail, dev->sq_tail, __ATOMIC_RELEASE);
+	return dev->ops->ring_enter(dev, max);
+}
+
+// Journal the flip a completion reports and give back the caller's
+// user_data. A lazy flip completes once armed, not once applied.
+static void completed(struct flip_dev *dev, struct flip_completion *c)
+{
+	struct flip_undo *u = find_pending(dev, c->user_data);
+
+	if (!u)
+		return;
+	if (c->res == 0 && u->op != FLIP_OP_BIT_LAZY)
+		flip_journal_add(dev, u->op, u->pid, u->vaddr, u->arg);
+	c->user_data = u->user_data;
+	drop_pending(dev, u);
+}
+
+int flip_ring_reap(struct flip_dev *dev, struct flip_completion *out,
+		   unsigned max)
+{
+	struct bitflip_ring_hdr *hdr = dev->ring;
+	struct bitflip_cqe *cqes;
+	unsigned head, tail;
+	int n = 0;
+
+	if (!hdr) {
+		errno = ENXIO;
+		return -1;
+	}
+	cqes = (struct bitflip_cqe *)((char *)dev->ring + dev->params.cq_off);
+	head = hdr->cq_head;
+	tail = __atomic_load_n(&hdr->cq_tail, __ATOMIC_ACQUIRE);
+	pthread_mutex_lock(&dev->lock);
+	while (head != tail && (unsigned)n < max) {
+		const struct bitflip_cqe *cqe = &cqes[head & hdr->cq_mask];
+
+		out[n].user_data = cqe->user_data;
+		out[n].res = cqe->res;
+		out[n].flags = cqe->flags;
+		completed(dev, &out[n]);
+		n++;
+		head++;
+	}
+	pthread_mutex_unlock(&dev->lock);
+	__atomic_store_n(&hdr->cq_head, head, __ATOMIC_RELEASE);
+	return n;
+}
+
+int flip_commit(struct flip_dev *dev)
+{
+	pthread_mutex_lock(&dev->lock);
+	if (dev->ops->sync)
+		dev->ops->sync(dev);
+	dev->njournal = 0;
+	pthread_mutex_unlock(&dev->lock);
+	return 0;
+}
+
+long flip_rollback(struct flip_dev *dev)
+{
+	struct flip_undo *undo;
+	size_t n;
+	long done = 0;
+
+	pthread_mutex_lock(&dev->lock);
+	if (dev->ops->sync)
+		dev->ops->sync(dev);
+	undo = dev->journal;
+	n = dev->njournal;
+	dev->journal = NULL;
+	dev->njournal = dev->journal_cap = 0;
+	pthread_mutex_unlock(&dev->lock);
+
+	// newest first, PFN flips may have moved the words flipped before
+	while (n--) {
+		if (dev->ops->undo(dev, &undo[n]) == 0)
+			done++;
+	}
+	free(undo);
+	return done;
+}
+
+void *flip_vdimm_map(struct flip_dev *dev, void *addr, size_t len, int prot)
+{
+	if (!dev->ops->map) {
+		errno = EOPNOTSUPP;
+		return NULL;
+	}
+	return dev->ops->map(dev, addr, len, prot);
+}
+
+// Only in this process: the child's descriptor table is its own.
+int flip_vdimm_inherit(struct flip_dev *dev)
+{
+	if (dev->ops->kind != FLIP_BACKEND_VDIMM)
+		return 0;
+	return fcntl(dev->fd, F_SETFD, 0) == -1 ? -1 : 0;
+}
+
+int flip_vdimm_adopt(struct flip_dev *dev, pid_t pid, unsigned long addr,
+		     size_t len)
+{
+	if (!dev->ops->adopt) {
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+	return dev->ops->adopt(dev, pid, addr, len);
+}
@@ -0,0 +1,175 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "flip.h"
+
+struct flip_elf {
+	const uint8_t *image;
+	size_t size;
+	const Elf64_Ehdr *ehdr;
+	const Elf64_Phdr *phdrs;
+	const Elf64_Shdr *shdrs; // NULL if the section table is unusable
+};
+
+static int in_image(const struct flip_elf *elf, uint64_t off, uint64_t len)
+{
+	return off <= elf->size && len <= elf->size - off;
+}
+
+// Every PT_LOAD's file bytes lie in the image and fit in its memory size,
+// so a loader may copy them without checking again.
+static int loads_ok(const struct flip_elf *elf)
+{
+	for (unsigned i = 0; i < elf->ehdr->e_phnum; i++) {
+		const Elf64_Phdr *p = &elf->phdrs[i];
+
+		if (p->p_type == PT_LOAD &&
+		    (!in_image(elf, p->p_offset, p->p_filesz) ||
+		     p->p_filesz > p->p_memsz))
+			return 0;
+	}
+	return 1;
+}
+
+struct flip_elf *flip_elf_open(const char *path)
+{
+	struct flip_elf *elf;
+	const Elf64_Ehdr *ehdr;
+	struct stat st;
+	void *image;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return NULL;
+	}
+	if ((size_t)st.st_size < sizeof(*ehdr)) {
+		close(fd);
+		errno = ENOEXEC;
+		return NULL;
+	}
+	image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (image == MAP_FAILED)
+		return NULL;
+
+	elf = calloc(1, sizeof(*elf));
+	if (!elf) {
+		munmap(image, st.st_size);
+		return NULL;
+	}
+	elf->image = image;
+	elf->size = st.st_size;
+
+	ehdr = image;
+	if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 ||
+	    ehdr->e_ident[EI_CLASS] != ELFCLASS64 ||
+	    ehdr->e_phentsize != sizeof(Elf64_Phdr) ||
+	    !in_image(elf, ehdr->e_phoff,
+		      (uint64_t)ehdr->e_phnum * sizeof(Elf64_Phdr))) {
+		flip_elf_close(elf);
+		errno = ENOEXEC;
+		return NULL;
+	}
+	elf->ehdr = ehdr;
+	elf->phdrs = (const Elf64_Phdr *)(elf->image + ehdr->e_phoff);
+	if (!loads_ok(elf)) {
+		flip_elf_close(elf);
+		errno = ENOEXEC;
+		return NULL;
+	}
+	if (ehdr->e_shentsize == sizeof(Elf64_Shdr) &&
+	    in_image(elf, ehdr->e_shoff,
+		     (uint64_t)ehdr->e_shnum * sizeof(Elf64_Shdr)))
+		elf->shdrs = (const Elf64_Shdr *)(elf->image + ehdr->e_shoff);
+
+	return elf;
+}
+
+void flip_elf_close(struct flip_elf *elf)
+{
+	if (!elf)
+		return;
+	munmap((void *)elf->image, elf->size);
+	free(elf);
+}
+
+const void *flip_elf_image(const struct flip_elf *elf, size_t *size)
+{
+	if (size)
+		*size = elf->size;
+	return elf->image;
+}
+
+const Elf64_Ehdr *flip_elf_ehdr(const struct flip_elf *elf)
+{
+	return elf->ehdr;
+}
+
+const Elf64_Phdr *flip_elf_phdrs(const struct flip_elf *elf, unsigned *n)
+{
+	if (n)
+		*n = elf->ehdr->e_phnum;
+	return elf->phdrs;
+}
+
+const Elf64_Phdr *flip_elf_text(const struct flip_elf *elf)
+{
+	for (unsigned i = 0; i < elf->ehdr->e_phnum; i++) {
+		const Elf64_Phdr *p = &elf->phdrs[i];
+
+		if (p->p_type == PT_LOAD && (p->p_flags & PF_X))
+			return p;
+	}
+	return NULL;
+}
+
+static int find_in(const struct flip_elf *elf, unsigned type,
+		   const char *name, uint64_t *value)
+{
+	for (unsigned i = 0; i < elf->ehdr->e_shnum; i++) {
+		const Elf64_Shdr *sh = &elf->shdrs[i];
+		const Elf64_Shdr *str;
+		const Elf64_Sym *syms;
+		const char *strtab;
+
+		if (sh->sh_type != type || sh->sh_link >= elf->ehdr->e_shnum)
+			continue;
+		str = &elf->shdrs[sh->sh_link];
+		if (!in_image(elf, sh->sh_offset, sh->sh_size) ||
+		    !in_image(elf, str->sh_offset, str->sh_size))
+			continue;
+
+		syms = (const Elf64_Sym *)(elf->image + sh->sh_offset);
+		strtab = (const char *)elf->image + str->sh_offset;
+		for (size_t j = 0; j < sh->sh_size / sizeof(*syms); j++) {
+			uint32_t off = syms[j].st_name;
+
+			if (!off || off >= str->sh_size)
+				continue;
+			if (strncmp(strtab + off, name, str->sh_size - off) == 0) {
+				*value = syms[j].st_value;
+				return 0;
+			}
+		}
+	}
+	return -1;
+}
+
+int flip_elf_symbol(const struct flip_elf *elf, const char *name,
+		    uint64_t *value)
+{
+	if (elf->shdrs && (!find_in(elf, SHT_SYMTAB, name, value) ||
+			   !find_in(elf, SHT_DYNSYM, name, value)))
+		return 0;
+	errno = ENOENT;
+	return -1;
+}
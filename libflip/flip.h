@@ -0,0 +1,210 @@
+#ifndef FLIP_H
+#define FLIP_H
+
+#include <elf.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * libflip: the injection toolkit as a shared library, so harnesses can
+ * locate targets and flip bits in-process instead of running a CLI per
+ * experiment.
+ *
+ * ABI rules: symbols are versioned (libflip.map) and only ever added in a
+ * new version node; structs in this header never change size or layout,
+ * and handles are opaque. Functions return -1 (or NULL) and set errno on
+ * failure, like the system calls they wrap.
+ */
+
+#define FLIP_VERSION_MAJOR 1
+#define FLIP_VERSION_MINOR 3
+#define FLIP_VERSION ((FLIP_VERSION_MAJOR << 16) | FLIP_VERSION_MINOR)
+
+// FLIP_VERSION of the library actually loaded.
+unsigned flip_version(void);
+
+/* /proc/pid/maps, pid 0 is the calling process */
+
+#define FLIP_PROT_READ 0x1
+#define FLIP_PROT_WRITE 0x2
+#define FLIP_PROT_EXEC 0x4
+#define FLIP_PROT_SHARED 0x8
+
+struct flip_map {
+	unsigned long start;
+	unsigned long end;
+	unsigned long offset; // file offset of `start`
+	unsigned prot; // FLIP_PROT_*
+	const char *path; // "" if anonymous
+};
+
+// Called once per mapping, `map` is only valid during the call. A non-zero
+// return stops the walk and is passed through.
+typedef int (*flip_map_cb)(void *ctx, const struct flip_map *map);
+
+int flip_maps_each(pid_t pid, flip_map_cb cb, void *ctx);
+// First mapping of `path` (any if NULL) with all of `prot`. out->path
+// points at `path`. Returns -1 with ENOENT if there is none.
+int flip_maps_find(pid_t pid, const char *path, unsigned prot,
+		   struct flip_map *out);
+int flip_vaddr_to_offset(pid_t pid, unsigned long vaddr,
+			 unsigned long *offset);
+int flip_offset_to_vaddr(pid_t pid, const char *path, unsigned long offset,
+			 unsigned long *vaddr);
+
+/* ELF64 files, mapped read-only */
+
+struct flip_elf;
+
+// ENOEXEC unless the program headers, and the file bytes of every PT_LOAD,
+// lie within the file and no PT_LOAD has more file than memory bytes.
+struct flip_elf *flip_elf_open(const char *path);
+void flip_elf_close(struct flip_elf *elf);
+
+const void *flip_elf_image(const struct flip_elf *elf, size_t *size);
+const Elf64_Ehdr *flip_elf_ehdr(const struct flip_elf *elf);
+const Elf64_Phdr *flip_elf_phdrs(const struct flip_elf *elf, unsigned *n);
+// The first executable PT_LOAD, NULL if there is none.
+const Elf64_Phdr *flip_elf_text(const struct flip_elf *elf);
+// Value of `name` in .symtab, or .dynsym if the file is stripped.
+int flip_elf_symbol(const struct flip_elf *elf, const char *name,
+		    uint64_t *value);
+
+/* Instruction pattern scanning over 4-byte aligned words */
+
+struct flip_insn_match {
+	uint32_t mask;
+	uint32_t value;
+};
+
+// bl <backwards>; cmp wN, #imm; b.cond: a call whose result guards a branch
+#define FLIP_PATTERN_CHECK_CALL                                          \
+	{                                                                \
+		{ 0xff000000, 0x97000000 }, { 0xff000000, 0x71000000 }, \
+			{ 0xff000000, 0x54000000 },                      \
+	}
+
+// Byte offsets of the first `max` places in `text` where `npat` consecutive
+// words match `pat`. Returns the total number of matches.
+size_t flip_scan(const void *text, size_t len,
+		 const struct flip_insn_match *pat, size_t npat, size_t *hits,
+		 size_t max);
+// The same over [start, end) of another process, hits are addresses.
+ssize_t flip_scan_pid(pid_t pid, unsigned long start, unsigned long end,
+		      const struct flip_insn_match *pat, size_t npat,
+		      unsigned long *hits, size_t max);
+
+/* /dev/bitflip, or a virtual DIMM in the calling process */
+
+struct flip_dev;
+
+// NULL opens $FLIP_DEV, or /dev/bitflip if it is unset. "vdimm[:MB]"
+// (64 MB by default) emulates the device in userspace without privileges:
+// flips only reach memory from flip_vdimm_map() or flip_vdimm_adopt(),
+// `pid` must be 0, the caller, or a process that adopted DIMM memory
+// (ESRCH otherwise), and insn_count and uprobe triggers fail with
+// EOPNOTSUPP. Since 1.1.
+struct flip_dev *flip_dev_open(const char *path);
+// Timed and uprobe flips still waiting for their trigger complete with
+// -ECANCELED, as do armed lazy flips on the virtual DIMM, whose pages are
+// given back.
+void flip_dev_close(struct flip_dev *dev);
+int flip_dev_fd(const struct flip_dev *dev);
+
+int flip_bit(struct flip_dev *dev, pid_t pid, unsigned long vaddr, int bit);
+// Applied after the victim next touches the page. The kernel device polls
+// the access flag every few jiffies, so the flip lands a tick or more after
+// the access, which sees the old value; the caller's own reads of the page
+// also trigger it, and reclaim can delay it. The virtual DIMM flips before
+// that access completes.
+int flip_bit_lazy(struct flip_dev *dev, pid_t pid, unsigned long vaddr,
+		  int bit);
+// Flip bit `shift` of the frame number mapping `vaddr`.
+int flip_pfn(struct flip_dev *dev, pid_t pid, unsigned long vaddr, int shift);
+// Fires `delay_ns` from now, or after `insn_count` user instructions of the
+// victim if non-zero. With a ring, completes with `user_data`, and fails
+// with EBUSY while a completion queue's worth of flips is outstanding. A
+// flip in code is seen as it fires, bar an instruction a CPU of the
+// running victim already fetched, see bitflip_timed_args.
+int flip_timed(struct flip_dev *dev, pid_t pid, unsigned long vaddr, int bit,
+	       uint64_t delay_ns, uint64_t insn_count, uint64_t user_data);
+// Fires when the victim reaches `offset` in `path`, see bitflip_uprobe_args.
+int flip_uprobe(struct flip_dev *dev, pid_t pid, unsigned long vaddr, int bit,
+		const char *path, uint64_t offset, uint64_t user_data);
+
+/* Batched submission through the shared rings */
+
+enum flip_op {
+	FLIP_OP_BIT,
+	FLIP_OP_BIT_LAZY,
+	FLIP_OP_PFN,
+};
+
+struct flip_completion {
+	uint64_t user_data;
+	int32_t res; // 0 or -errno
+	uint32_t flags;
+};
+
+// `entries` is rounded up to a power of two. Once per device.
+int flip_ring_setup(struct flip_dev *dev, unsigned entries);
+// Queue one flip, `arg` is the bit or the PFN shift. -1 with EBUSY when
+// the submission ring is full or a completion queue's worth of flips,
+// timed ones included, is waiting to be reaped.
+int flip_ring_submit(struct flip_dev *dev, enum flip_op op, pid_t pid,
+		     unsigned long vaddr, int arg, uint64_t user_data);
+// Hand queued flips to the device, at most `max` (0: all). Returns the
+// number consumed.
+long flip_ring_enter(struct flip_dev *dev, unsigned max);
+// Completions posted so far, without blocking. Returns the number stored.
+int flip_ring_reap(struct flip_dev *dev, struct flip_completion *out,
+		   unsigned max);
+
+/* Since 1.1 */
+
+// Map `len` bytes of virtual DIMM frames at `addr` (anywhere if NULL),
+// `prot` as for mmap. A fixed `addr` replaces other mappings but not an
+// earlier region (EEXIST). Shared with children. EOPNOTSUPP on the kernel
+// device.
+void *flip_vdimm_map(struct flip_dev *dev, void *addr, size_t len, int prot);
+// Flip back, newest first, every flip known to have landed since the last
+// commit: synchronous ones, and ring and timed ones once their completion
+// was reaped. Flips still waiting for their trigger are left alone, as are
+// lazy flips on the kernel device. Returns the number undone.
+long flip_rollback(struct flip_dev *dev);
+// Forget the flips so far, they stay.
+int flip_commit(struct flip_dev *dev);
+
+/* Since 1.2 */
+
+#define FLIP_MASK_WORDS 8 // one cache line
+
+// XOR `nwords` 64-bit words from `vaddr`, which is 8-byte aligned, with
+// `mask` in one go: several bits of a word, or a burst along a line. The
+// words must not cross a 64-byte boundary (EINVAL).
+int flip_mask(struct flip_dev *dev, pid_t pid, unsigned long vaddr,
+	      const uint64_t *mask, unsigned nwords);
+
+/* Since 1.3 */
+
+#define FLIP_BACKEND_KERNEL 0
+#define FLIP_BACKEND_VDIMM 1
+
+int flip_dev_backend(const struct flip_dev *dev);
+
+// A forked victim reaches the virtual DIMM through its memfd: keep it open
+// across exec, called in the child before exec(). Nothing to do, and 0, on
+// the kernel device.
+int flip_vdimm_inherit(struct flip_dev *dev);
+// Move [addr, addr + len), within one mapping of `pid`, onto fresh DIMM
+// frames with the same contents and protection, so that flips aimed at
+// `pid` reach it; lazy and PFN flips stay limited to the caller's own
+// regions (EOPNOTSUPP). `pid` is a ptrace-stopped tracee of the caller
+// that inherited the DIMM (EBADF otherwise), and runs an mmap() for it.
+// The frames go back to the DIMM once it has exited. AArch64 and x86-64
+// only (ENOSYS), EOPNOTSUPP on the kernel device.
+int flip_vdimm_adopt(struct flip_dev *dev, pid_t pid, unsigned long addr,
+		     size_t len);
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef FLIP_INTERNAL_H
+#define FLIP_INTERNAL_H
+
+#include <pthread.h>
+
+#include "../bitflip/bitflip.h"
+#include "flip.h"
+
+// A flip known to have been applied, kept until flip_commit() so that
+// flip_rollback() can apply it again: every flip is its own inverse.
+struct flip_undo {
+	enum flip_op op; // FLIP_OP_BIT, FLIP_OP_PFN or FLIP_UNDO_*
+	pid_t pid;
+	unsigned long vaddr;
+	int arg;
+	uint64_t mask; // of the word at vaddr, for FLIP_UNDO_MASK
+	// While waiting for its completion: the device sees `tag`, unique
+	// per flip, and the caller gets its own user_data back.
+	uint64_t tag, user_data;
+};
+
+// Not a ring opcode: flip_mask() journals one record per word it changed.
+#define FLIP_UNDO_MASK ((enum flip_op)16)
+// Nor this: a vdimm flip of byte `vaddr` of the alias by mask `arg`,
+// undone on the frame whatever maps it by then.
+#define FLIP_UNDO_PHYS ((enum flip_op)17)
+
+struct flip_dev;
+
+struct flip_backend {
+	int (*bit)(struct flip_dev *dev, pid_t pid, unsigned long vaddr,
+		   int bit);
+	int (*bit_lazy)(struct flip_dev *dev, pid_t pid, unsigned long vaddr,
+			int bit);
+	int (*pfn)(struct flip_dev *dev, pid_t pid, unsigned long vaddr,
+		   int shift);
+	// `nwords` is 1 to FLIP_MASK_WORDS and `vaddr` aligned, checked.
+	int (*mask)(struct flip_dev *dev, pid_t pid, unsigned long vaddr,
+		    const uint64_t *mask, unsigned nwords);
+	int (*timed)(struct flip_dev *dev, pid_t pid, unsigned long vaddr,
+		     int bit, uint64_t delay_ns, uint64_t insn_count,
+		     uint64_t user_data);
+	int (*uprobe)(struct flip_dev *dev, pid_t pid, unsigned long vaddr,
+		      int bit, const char *path, uint64_t offset,
+		      uint64_t user_data);
+	// Allocate dev->ring laid out as the kernel's and fill dev->params.
+	int (*ring_setup)(struct flip_dev *dev, unsigned sq_entries);
+	long (*ring_enter)(struct flip_dev *dev, unsigned max);
+	// Apply an undo record without journaling it.
+	int (*undo)(struct flip_dev *dev, const struct flip_undo *u);
+	// Move flips applied behind the library's back into the journal.
+	void (*sync)(struct flip_dev *dev);
+	void *(*map)(struct flip_dev *dev, void *addr, size_t len, int prot);
+	int (*adopt)(struct flip_dev *dev, pid_t pid, unsigned long addr,
+		     size_t len);
+	void (*close)(struct flip_dev *dev);
+	int kind; // FLIP_BACKEND_*
+};
+
+struct flip_dev {
+	const struct flip_backend *ops;
+	void *priv;
+	int fd;
+
+	void *ring;
+	struct bitflip_ring_params params;
+	unsigned sq_tail; // submitted but not yet published
+
+	pthread_mutex_t lock; // journal and pending
+	struct flip_undo *journal;
+	size_t njournal, journal_cap;
+	// Awaiting their completion, at most cq_entries so that the CQ never
+	// overflows. Ring and timed flips are journaled once it is reaped.
+	struct flip_undo *pending;
+	size_t npending, pending_cap;
+	uint64_t next_tag;
+};
+
+extern const struct flip_backend flip_kernel_backend;
+extern const struct flip_backend flip_vdimm_backend;
+
+int flip_kernel_open(struct flip_dev *dev, const char *path);
+int flip_vdimm_open(struct flip_dev *dev, const char *spec);
+
+// Callers hold dev->lock.
+int flip_journal_add(struct flip_dev *dev, enum flip_op op, pid_t pid,
+		     unsigned long vaddr, int arg);
+
+// Ring layout shared by both backends, as bitflip_ring_setup() computes it.
+void flip_ring_layout(struct bitflip_ring_params *params);
+
+// Run syscall `nr` in `pid`, a ptrace-stopped tracee of the caller, and
+// store what it returned (-errno on failure) in `*ret`. ENOSYS on
+// architectures other than AArch64 and x86-64.
+int flip_remote_syscall(pid_t pid, long nr, const long args[6], long *ret);
+
+#endif
@@ -0,0 +1,142 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include "internal.h"
+
+static int flip_ioctl(struct flip_dev *dev, unsigned long cmd, pid_t pid,
+		      unsigned long vaddr, int bit, int shift)
+{
+	struct bitflip_args arg = {
+		.vaddr = vaddr,
+		.pid = pid,
+		.target_bit = bit,
+		.pfn_shift = shift,
+	};
+
+	return ioctl(dev->fd, cmd, &arg) == -1 ? -1 : 0;
+}
+
+static int kernel_bit(struct flip_dev *dev, pid_t pid, unsigned long vaddr,
+		      int bit)
+{
+	return flip_ioctl(dev, IOCTL_FLIP_BIT, pid, vaddr, bit, 0);
+}
+
+static int kernel_bit_lazy(struct flip_dev *dev, pid_t pid,
+			   unsigned long vaddr, int bit)
+{
+	return flip_ioctl(dev, IOCTL_FLIP_BIT_LAZY, pid, vaddr, bit, 0);
+}
+
+static int kernel_pfn(struct flip_dev *dev, pid_t pid, unsigned long vaddr,
+		      int shift)
+{
+	return flip_ioctl(dev, IOCTL_FLIP_PFN, pid, vaddr, 0, shift);
+}
+
+static int kernel_mask(struct flip_dev *dev, pid_t pid, unsigned long vaddr,
+		       const uint64_t *mask, unsigned nwords)
+{
+	struct bitflip_mask_args arg = {
+		.vaddr = vaddr,
+		.pid = pid,
+		.nwords = nwords,
+	};
+
+	memcpy(arg.mask, mask, nwords * sizeof(*mask));
+	return ioctl(dev->fd, IOCTL_FLIP_MASK, &arg) == -1 ? -1 : 0;
+}
+
+static int kernel_timed(struct flip_dev *dev, pid_t pid, unsigned long vaddr,
+			int bit, uint64_t delay_ns, uint64_t insn_count,
+			uint64_t user_data)
+{
+	struct bitflip_timed_args arg = {
+		.flip = { .vaddr = vaddr, .pid = pid, .target_bit = bit },
+		.delay_ns = delay_ns,
+		.insn_count = insn_count,
+		.user_data = user_data,
+	};
+
+	return ioctl(dev->fd, IOCTL_FLIP_TIMED, &arg) == -1 ? -1 : 0;
+}
+
+static int kernel_uprobe(struct flip_dev *dev, pid_t pid, unsigned long vaddr,
+			 int bit, const char *path, uint64_t offset,
+			 uint64_t user_data)
+{
+	struct bitflip_uprobe_args arg = {
+		.flip = { .vaddr = vaddr, .pid = pid, .target_bit = bit },
+		.path = (uintptr_t)path,
+		.offset = offset,
+		.user_data = user_data,
+	};
+
+	return ioctl(dev->fd, IOCTL_FLIP_UPROBE, &arg) == -1 ? -1 : 0;
+}
+
+static int kernel_ring_setup(struct flip_dev *dev, unsigned sq_entries)
+{
+	void *ring;
+
+	memset(&dev->params, 0, sizeof(dev->params));
+	dev->params.sq_entries = sq_entries;
+	if (ioctl(dev->fd, IOCTL_RING_SETUP, &dev->params) == -1)
+		return -1;
+	ring = mmap(NULL, dev->params.size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		    dev->fd, 0);
+	if (ring == MAP_FAILED)
+		return -1;
+	dev->ring = ring;
+	return 0;
+}
+
+static long kernel_ring_enter(struct flip_dev *dev, unsigned max)
+{
+	return ioctl(dev->fd, IOCTL_RING_ENTER, max);
+}
+
+static int kernel_undo(struct flip_dev *dev, const struct flip_undo *u)
+{
+	if (u->op == FLIP_OP_PFN)
+		return kernel_pfn(dev, u->pid, u->vaddr, u->arg);
+	if (u->op == FLIP_UNDO_MASK)
+		return kernel_mask(dev, u->pid, u->vaddr, &u->mask, 1);
+	return kernel_bit(dev, u->pid, u->vaddr, u->arg);
+}
+
+static void kernel_close(struct flip_dev *dev)
+{
+	if (dev->ring)
+		munmap(dev->ring, dev->params.size);
+	close(dev->fd);
+}
+
+// The module keeps no history, rollback is the library reissuing flips.
+// Lazy flips are not journaled: nothing reports when they land.
+const struct flip_backend flip_kernel_backend = {
+	.bit = kernel_bit,
+	.bit_lazy = kernel_bit_lazy,
+	.pfn = kernel_pfn,
+	.mask = kernel_mask,
+	.timed = kernel_timed,
+	.uprobe = kernel_uprobe,
+	.ring_setup = kernel_ring_setup,
+	.ring_enter = kernel_ring_enter,
+	.undo = kernel_undo,
+	.close = kernel_close,
+	.kind = FLIP_BACKEND_KERNEL,
+};
+
+int flip_kernel_open(struct flip_dev *dev, const char *path)
+{
+	dev->fd = open(path, O_RDWR | O_CLOEXEC);
+	if (dev->fd < 0)
+		return -1;
+	dev->ops = &flip_kernel_backend;
+	return 0;
+}
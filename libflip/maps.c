@@ -0,0 +1,148 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "flip.h"
+
+unsigned flip_version(void)
+{
+	return FLIP_VERSION;
+}
+
+static unsigned parse_prot(const char *perms)
+{
+	unsigned prot = 0;
+
+	if (perms[0] == 'r')
+		prot |= FLIP_PROT_READ;
+	if (perms[1] == 'w')
+		prot |= FLIP_PROT_WRITE;
+	if (perms[2] == 'x')
+		prot |= FLIP_PROT_EXEC;
+	if (perms[3] == 's')
+		prot |= FLIP_PROT_SHARED;
+	return prot;
+}
+
+int flip_maps_each(pid_t pid, flip_map_cb cb, void *ctx)
+{
+	char path[64];
+	char *line = NULL;
+	size_t cap = 0;
+	ssize_t len;
+	FILE *maps_file;
+	int ret = 0;
+
+	if (pid)
+		snprintf(path, sizeof(path), "/proc/%d/maps", pid);
+	else
+		snprintf(path, sizeof(path), "/proc/self/maps");
+	maps_file = fopen(path, "r");
+	if (!maps_file)
+		return -1;
+
+	while (!ret && (len = getline(&line, &cap, maps_file)) > 0) {
+		struct flip_map map;
+		char perms[5];
+		int name = 0;
+
+		if (line[len - 1] == '\n')
+			line[len - 1] = '\0';
+		// the path is the rest of the line, it may contain spaces
+		if (sscanf(line, "%lx-%lx %4s %lx %*s %*s %n", &map.start,
+			   &map.end, perms, &map.offset, &name) < 4 ||
+		    !name)
+			continue;
+		map.prot = parse_prot(perms);
+		map.path = line + name;
+		ret = cb(ctx, &map);
+	}
+
+	free(line);
+	fclose(maps_file);
+	return ret;
+}
+
+struct find_ctx {
+	const char *path;
+	unsigned prot;
+	unsigned long vaddr; // or file offset, for offset_to_vaddr
+	struct flip_map *out;
+};
+
+static int match_find(void *arg, const struct flip_map *map)
+{
+	struct find_ctx *c = arg;
+
+	if ((map->prot & c->prot) != c->prot ||
+	    (c->path && strcmp(map->path, c->path) != 0))
+		return 0;
+	*c->out = *map;
+	c->out->path = c->path;
+	return 1;
+}
+
+int flip_maps_find(pid_t pid, const char *path, unsigned prot,
+		   struct flip_map *out)
+{
+	struct find_ctx c = { .path = path, .prot = prot, .out = out };
+	int ret = flip_maps_each(pid, match_find, &c);
+
+	if (ret == 0)
+		errno = ENOENT;
+	return ret == 1 ? 0 : -1;
+}
+
+static int match_vaddr(void *arg, const struct flip_map *map)
+{
+	struct find_ctx *c = arg;
+
+	if (c->vaddr < map->start || c->vaddr >= map->end)
+		return 0;
+	*c->out = *map;
+	return 1;
+}
+
+int flip_vaddr_to_offset(pid_t pid, unsigned long vaddr,
+			 unsigned long *offset)
+{
+	struct flip_map map;
+	struct find_ctx c = { .vaddr = vaddr, .out = &map };
+	int ret = flip_maps_each(pid, match_vaddr, &c);
+
+	if (ret != 1) {
+		if (ret == 0)
+			errno = ENOENT;
+		return -1;
+	}
+	*offset = vaddr - map.start + map.offset;
+	return 0;
+}
+
+static int match_offset(void *arg, const struct flip_map *map)
+{
+	struct find_ctx *c = arg;
+
+	if (strcmp(map->path, c->path) != 0 || c->vaddr < map->offset ||
+	    c->vaddr >= map->offset + (map->end - map->start))
+		return 0;
+	*c->out = *map;
+	return 1;
+}
+
+int flip_offset_to_vaddr(pid_t pid, const char *path, unsigned long offset,
+			 unsigned long *vaddr)
+{
+	struct flip_map map;
+	struct find_ctx c = { .path = path, .vaddr = offset, .out = &map };
+	int ret = flip_maps_each(pid, match_offset, &c);
+
+	if (ret != 1) {
+		if (ret == 0)
+			errno = ENOENT;
+		return -1;
+	}
+	*vaddr = map.start + offset - map.offset;
+	return 0;
+}
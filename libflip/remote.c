@@ -0,0 +1,138 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sys/ptrace.h>
+#include <sys/uio.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+
+#include "internal.h"
+
+/*
+ * A system call run by a stopped tracee: overwrite the instruction at its
+ * PC with a syscall instruction, single-step it with the arguments in
+ * place, then put the instruction and registers back. Putting the
+ * instruction back may fail, harmlessly, when the call itself replaced
+ * that page with a copy taken beforehand.
+ */
+
+#if defined(__aarch64__)
+
+#define INSN_SYSCALL 0xd4000001UL // svc #0
+#define INSN_MASK 0xffffffffUL
+
+typedef struct user_regs_struct regs_t;
+
+static unsigned long regs_pc(const regs_t *r)
+{
+	return r->pc;
+}
+
+static void regs_set(regs_t *r, long nr, const long args[6])
+{
+	for (int i = 0; i < 6; i++)
+		r->regs[i] = args[i];
+	r->regs[8] = nr;
+}
+
+static long regs_ret(const regs_t *r)
+{
+	return r->regs[0];
+}
+
+#elif defined(__x86_64__)
+
+#define INSN_SYSCALL 0x050fUL // syscall
+#define INSN_MASK 0xffffUL
+
+typedef struct user_regs_struct regs_t;
+
+static unsigned long regs_pc(const regs_t *r)
+{
+	return r->rip;
+}
+
+static void regs_set(regs_t *r, long nr, const long args[6])
+{
+	r->rax = nr;
+	r->orig_rax = -1; // no syscall to restart
+	r->rdi = args[0];
+	r->rsi = args[1];
+	r->rdx = args[2];
+	r->r10 = args[3];
+	r->r8 = args[4];
+	r->r9 = args[5];
+}
+
+static long regs_ret(const regs_t *r)
+{
+	return r->rax;
+}
+
+#endif
+
+#ifdef INSN_SYSCALL
+
+static int get_regs(pid_t pid, regs_t *r)
+{
+	struct iovec iov = { .iov_base = r, .iov_len = sizeof(*r) };
+
+	return ptrace(PTRACE_GETREGSET, pid, NT_PRSTATUS, &iov) == -1 ? -1 : 0;
+}
+
+static int set_regs(pid_t pid, regs_t *r)
+{
+	struct iovec iov = { .iov_base = r, .iov_len = sizeof(*r) };
+
+	return ptrace(PTRACE_SETREGSET, pid, NT_PRSTATUS, &iov) == -1 ? -1 : 0;
+}
+
+int flip_remote_syscall(pid_t pid, long nr, const long args[6], long *ret)
+{
+	regs_t saved, regs;
+	unsigned long pc;
+	long word;
+	int status, err = 0;
+
+	if (get_regs(pid, &saved))
+		return -1;
+	pc = regs_pc(&saved);
+	errno = 0;
+	word = ptrace(PTRACE_PEEKTEXT, pid, (void *)pc, NULL);
+	if (errno)
+		return -1;
+	if (ptrace(PTRACE_POKETEXT, pid, (void *)pc,
+		   (void *)((word & ~INSN_MASK) | INSN_SYSCALL)) == -1)
+		return -1;
+
+	regs = saved;
+	regs_set(&regs, nr, args);
+	if (set_regs(pid, &regs) ||
+	    ptrace(PTRACE_SINGLESTEP, pid, NULL, NULL) == -1 ||
+	    waitpid(pid, &status, __WALL) != pid) {
+		err = errno;
+	} else if (!WIFSTOPPED(status) || WSTOPSIG(status) != SIGTRAP) {
+		// killed, or stopped by a signal that is now lost
+		err = ECHILD;
+	} else if (get_regs(pid, &regs)) {
+		err = errno;
+	}
+
+	ptrace(PTRACE_POKETEXT, pid, (void *)pc, (void *)word);
+	set_regs(pid, &saved);
+	if (err) {
+		errno = err;
+		return -1;
+	}
+	*ret = regs_ret(&regs);
+	return 0;
+}
+
+#else
+
+int flip_remote_syscall(pid_t pid, long nr, const long args[6], long *ret)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+#endif
@@ -0,0 +1,79 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "flip.h"
+
+size_t flip_scan(const void *text, size_t len,
+		 const struct flip_insn_match *pat, size_t npat, size_t *hits,
+		 size_t max)
+{
+	const uint8_t *p = text;
+	size_t nwords = len / 4, total = 0;
+
+	if (!npat || nwords < npat)
+		return 0;
+
+	for (size_t i = 0; i + npat <= nwords; i++) {
+		size_t k;
+
+		for (k = 0; k < npat; k++) {
+			uint32_t w;
+
+			memcpy(&w, p + 4 * (i + k), sizeof(w));
+			if ((w & pat[k].mask) != pat[k].value)
+				break;
+		}
+		if (k < npat)
+			continue;
+		if (total < max)
+			hits[total] = 4 * i;
+		total++;
+	}
+	return total;
+}
+
+ssize_t flip_scan_pid(pid_t pid, unsigned long start, unsigned long end,
+		      const struct flip_insn_match *pat, size_t npat,
+		      unsigned long *hits, size_t max)
+{
+	size_t len = (end - start) & ~3UL;
+	struct iovec local, remote;
+	size_t *offs, total;
+	ssize_t n;
+	void *text;
+
+	if (end < start) {
+		errno = EINVAL;
+		return -1;
+	}
+	text = malloc(len);
+	offs = malloc((max ? max : 1) * sizeof(*offs));
+	if (!text || !offs)
+		goto err;
+
+	local.iov_base = text;
+	local.iov_len = len;
+	remote.iov_base = (void *)start;
+	remote.iov_len = len;
+	n = process_vm_readv(pid, &local, 1, &remote, 1, 0);
+	if (n != (ssize_t)len) {
+		if (n >= 0)
+			errno = EFAULT;
+		goto err;
+	}
+
+	total = flip_scan(text, len, pat, npat, offs, max);
+	for (size_t i = 0; i < total && i < max; i++)
+		hits[i] = start + offs[i];
+	free(offs);
+	free(text);
+	return total;
+
+err:
+	free(offs);
+	free(text);
+	return -1;
+}
@@ -0,0 +1,1149 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/userfaultfd.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "internal.h"
+
+/*
+ * A virtual DIMM: a memfd stands in for physical memory and is mapped twice.
+ * flip_vdimm_map() hands out MAP_SHARED windows onto it, one frame per page,
+ * and the library keeps a read-write alias of the whole file as its view of
+ * "physical" memory. Bit flips go through the alias, behind the mapping's
+ * protection like a disturbance error; PFN flips remap a page onto another
+ * frame. No privileges are needed: flips reach the caller's own regions, for
+ * `pid` 0 or its own, and those of tracees that moved memory onto the DIMM
+ * with flip_vdimm_adopt(). Their regions are kept by pid, and their frames
+ * go back to the DIMM once the process is gone.
+ *
+ * Lazy flips wait for the next touch of their page. With userfaultfd minor
+ * faults the page is zapped and a service thread flips and maps it back on
+ * the fault; without userfaultfd the page is made PROT_NONE and a SIGSEGV
+ * handler does the same. Timed flips run on the service thread.
+ */
+
+#define VDIMM_DEFAULT_MB 64
+#define DEFAULT_BIT 16 // as the module
+#define LAZY_SLOTS 256
+
+struct region {
+	pid_t pid; // 0 for the caller's
+	int pidfd; // of an adopted region's process, readable once it exited
+	unsigned long start;
+	size_t npages;
+	int prot;
+	size_t *frames; // frame behind each page
+};
+
+enum {
+	SLOT_FREE,
+	SLOT_CLAIMED,
+	SLOT_ARMED,
+	SLOT_FIRING,
+	SLOT_FIRED, // applied, not yet in the journal
+};
+
+// Read from the SIGSEGV handler, so fixed size and lock free.
+struct lazy_slot {
+	int state;
+	int prot; // of the region, restored once fired
+	unsigned long page;
+	size_t off; // of the flipped byte in the alias
+	uint8_t mask;
+	int queued; // through the ring, with user_data
+	uint64_t user_data;
+};
+
+struct timer {
+	uint64_t deadline; // CLOCK_MONOTONIC ns
+	pid_t pid;
+	unsigned long vaddr;
+	int bit;
+	uint64_t user_data;
+};
+
+struct vdimm {
+	struct flip_dev *dev;
+	int memfd;
+	uint8_t *phys;
+	size_t page, nframes;
+	uint8_t *used; // per frame
+
+	pthread_mutex_t lock; // regions, frames and timers
+	struct region *regions;
+	size_t nregions, regions_cap;
+	struct timer *timers;
+	size_t ntimers, timers_cap;
+
+	struct lazy_slot lazy[LAZY_SLOTS];
+
+	int uffd; // -1: lazy flips go through SIGSEGV
+	int efd; // wakes the service thread
+	int stop;
+	pthread_t thread;
+
+	pthread_mutex_t ring_lock; // serialises ring_enter
+	pthread_mutex_t cq_lock;
+};
+
+static struct vdimm *segv_owner;
+static struct sigaction segv_prev;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Regions of the caller are filed under pid 0.
+static pid_t owner_of(pid_t pid)
+{
+	return pid == getpid() ? 0 : pid;
+}
+
+// First fit, zeroed frames. SIZE_MAX if there is no run of `n`.
+static size_t alloc_frames(struct vdimm *v, size_t n)
+{
+	size_t run = 0;
+
+	for (size_t i = 0; i < v->nframes; i++) {
+		run = v->used[i] ? 0 : run + 1;
+		if (run == n) {
+			memset(&v->used[i + 1 - n], 1, n);
+			return i + 1 - n;
+		}
+	}
+	return SIZE_MAX;
+}
+
+static void free_frames(struct vdimm *v, const struct region *r)
+{
+	for (size_t i = 0; i < r->npages; i++) {
+		memset(&v->phys[r->frames[i] * v->page], 0, v->page);
+		v->used[r->frames[i]] = 0;
+	}
+}
+
+static int region_dead(const struct region *r)
+{
+	struct pollfd pfd = { .fd = r->pidfd, .events = POLLIN };
+
+	return r->pid && poll(&pfd, 1, 0) > 0;
+}
+
+// Give back the frames of adopted regions whose process has exited; a
+// new process reusing the pid must not see them.
+static void reap_regions(struct vdimm *v)
+{
+	for (size_t i = 0; i < v->nregions;) {
+		struct region *r = &v->regions[i];
+
+		if (!region_dead(r)) {
+			i++;
+			continue;
+		}
+		free_frames(v, r);
+		close(r->pidfd);
+		free(r->frames);
+		*r = v->regions[--v->nregions];
+	}
+}
+
+static struct region *find_region(struct vdimm *v, pid_t pid,
+				  unsigned long addr)
+{
+	for (size_t i = 0; i < v->nregions; i++) {
+		struct region *r = &v->regions[i];
+
+		if (r->pid == pid && addr >= r->start &&
+		    addr - r->start < r->npages * v->page)
+			return r;
+	}
+	return NULL;
+}
+
+static int has_regions(struct vdimm *v, pid_t pid)
+{
+	for (size_t i = 0; i < v->nregions; i++) {
+		if (v->regions[i].pid == pid)
+			return 1;
+	}
+	return 0;
+}
+
+// Offset in the alias of the byte `pid` maps at `addr`, with v->lock held.
+// ESRCH if `pid` has no region on the DIMM, or no longer exists.
+static int resolve(struct vdimm *v, pid_t pid, unsigned long addr,
+		   size_t *off, struct region **out)
+{
+	struct region *r;
+
+	pid = owner_of(pid);
+	r = find_region(v, pid, addr);
+	if (r && region_dead(r)) {
+		reap_regions(v);
+		r = NULL;
+	}
+	if (!r) {
+		errno = pid && !has_regions(v, pid) ? ESRCH : EFAULT;
+		return -1;
+	}
+	*off = r->frames[(addr - r->start) / v->page] * v->page +
+	       (addr & (v->page - 1));
+	if (out)
+		*out = r;
+	return 0;
+}
+
+static void xor_phys(struct vdimm *v, size_t off, uint8_t mask, int exec)
+{
+	__atomic_fetch_xor(&v->phys[off], mask, __ATOMIC_SEQ_CST);
+	// the alias and the victim's mapping share the frame
+	if (exec)
+		__builtin___clear_cache((char *)&v->phys[off],
+					(char *)&v->phys[off] + 1);
+}
+
+// Lazy and PFN flips rework the mapping, only the caller's own.
+static int check_own(pid_t pid)
+{
+	if (owner_of(pid)) {
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+	return 0;
+}
+
+static int check_bit(int *bit)
+{
+	if (*bit < 0)
+		*bit = DEFAULT_BIT;
+	if (*bit >= 64) {
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+static int flip_locked(struct vdimm *v, pid_t pid, unsigned long vaddr,
+		       int bit)
+{
+	struct region *r;
+	size_t off;
+
+	if (resolve(v, pid, vaddr + bit / 8, &off, &r))
+		return -1;
+	xor_phys(v, off, 1 << (bit % 8), r->prot & PROT_EXEC);
+	return 0;
+}
+
+static int vdimm_bit(struct flip_dev *dev, pid_t pid, unsigned long vaddr,
+		     int bit)
+{
+	struct vdimm *v = dev->priv;
+	int ret;
+
+	if (check_bit(&bit))
+		return -1;
+	pthread_mutex_lock(&v->lock);
+	ret = flip_locked(v, pid, vaddr, bit);
+	pthread_mutex_unlock(&v->lock);
+	return ret;
+}
+
+// An aligned word never straddles a page: resolve every word before
+// touching any, so a line running off a region flips nothing.
+static int vdimm_mask(struct flip_dev *dev, pid_t pid, unsigned long vaddr,
+		      const uint64_t *mask, unsigned nwords)
+{
+	struct vdimm *v = dev->priv;
+	struct region *r[FLIP_MASK_WORDS];
+	size_t off[FLIP_MASK_WORDS];
+	int ret = 0;
+
+	pthread_mutex_lock(&v->lock);
+	for (unsigned i = 0; i < nwords && !ret; i++)
+		ret = resolve(v, pid, vaddr + i * sizeof(*mask), &off[i],
+			      &r[i]);
+	for (unsigned i = 0; i < nwords && !ret; i++) {
+		for (unsigned b = 0; b < sizeof(*mask); b++) {
+			uint8_t m = mask[i] >> (8 * b);
+
+			if (m)
+				xor_phys(v, off[i] + b, m,
+					 r[i]->prot & PROT_EXEC);
+		}
+	}
+	pthread_mutex_unlock(&v->lock);
+	return ret;
+}
+
+static void segv_handler(int sig, siginfo_t *si, void *uc)
+{
+	struct vdimm *v = __atomic_load_n(&segv_owner, __ATOMIC_ACQUIRE);
+	unsigned long page;
+	int ours = 0, prot = 0;
+
+	if (v) {
+		page = (unsigned long)si->si_addr & ~(v->page - 1);
+		for (int i = 0; i < LAZY_SLOTS; i++) {
+			struct lazy_slot *s = &v->lazy[i];
+			int st = __atomic_load_n(&s->state, __ATOMIC_ACQUIRE);
+
+			if (st < SLOT_ARMED || s->page != page)
+				continue;
+			ours = 1;
+			prot = s->prot;
+			if (st == SLOT_ARMED &&
+			    __atomic_compare_exchange_n(&s->state, &st,
+							SLOT_FIRING, 0,
+							__ATOMIC_ACQUIRE,
+							__ATOMIC_RELAXED)) {
+				xor_phys(v, s->off, s->mask, prot & PROT_EXEC);
+				__atomic_store_n(&s->state, SLOT_FIRED,
+						 __ATOMIC_RELEASE);
+			}
+			// another thread is flipping it, do not read it early
+			while (__atomic_load_n(&s->state, __ATOMIC_ACQUIRE) ==
+			       SLOT_FIRING)
+				;
+		}
+	}
+	if (ours) {
+		mprotect((void *)page, v->page, prot);
+		return;
+	}
+
+	if (segv_prev.sa_flags & SA_SIGINFO) {
+		segv_prev.sa_sigaction(sig, si, uc);
+	} else if (segv_prev.sa_handler != SIG_DFL &&
+		   segv_prev.sa_handler != SIG_IGN) {
+		segv_prev.sa_handler(sig);
+	} else {
+		// fault again with the default action
+		signal(sig, SIG_DFL);
+	}
+}
+
+static int segv_install(struct vdimm *v)
+{
+	struct sigaction sa = { .sa_sigaction = segv_handler,
+				.sa_flags = SA_SIGINFO | SA_NODEFER };
+	struct vdimm *none = NULL;
+
+	if (__atomic_load_n(&segv_owner, __ATOMIC_ACQUIRE) == v)
+		return 0;
+	if (!__atomic_compare_exchange_n(&segv_owner, &none, v, 0,
+					 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		// one handler per process, the first device owns it
+		errno = EBUSY;
+		return -1;
+	}
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGSEGV, &sa, &segv_prev) == -1) {
+		__atomic_store_n(&segv_owner, NULL, __ATOMIC_RELEASE);
+		return -1;
+	}
+	return 0;
+}
+
+// Take the page away so the next touch faults into the library.
+static int arm_page(struct vdimm *v, unsigned long page)
+{
+	if (v->uffd >= 0)
+		return madvise((void *)page, v->page, MADV_DONTNEED);
+	return mprotect((void *)page, v->page, PROT_NONE);
+}
+
+// Journal the lazy flips that fired, with dev->lock held. They may have
+// fired before a PFN flip that is already journaled, so they are undone on
+// the frame they hit rather than through their page.
+static void vdimm_sync(struct flip_dev *dev)
+{
+	struct vdimm *v = dev->priv;
+
+	for (int i = 0; i < LAZY_SLOTS; i++) {
+		struct lazy_slot *s = &v->lazy[i];
+
+		if (__atomic_load_n(&s->state, __ATOMIC_ACQUIRE) != SLOT_FIRED)
+			continue;
+		flip_journal_add(dev, FLIP_UNDO_PHYS, 0, s->off, s->mask);
+		__atomic_store_n(&s->state, SLOT_FREE, __ATOMIC_RELEASE);
+	}
+}
+
+static struct lazy_slot *claim_slot(struct vdimm *v)
+{
+	for (int i = 0; i < LAZY_SLOTS; i++) {
+		int st = SLOT_FREE;
+
+		if (__atomic_compare_exchange_n(&v->lazy[i].state, &st,
+						SLOT_CLAIMED, 0,
+						__ATOMIC_ACQUIRE,
+						__ATOMIC_RELAXED))
+			return &v->lazy[i];
+	}
+	return NULL;
+}
+
+static int arm_lazy(struct flip_dev *dev, pid_t pid, unsigned long vaddr,
+		    int bit, int queued, uint64_t user_data)
+{
+	struct vdimm *v = dev->priv;
+	struct lazy_slot *s;
+	struct region *r;
+	unsigned long addr;
+	size_t off;
+	int ret;
+
+	if (check_own(pid) || check_bit(&bit))
+		return -1;
+	if (v->uffd < 0 && segv_install(v))
+		return -1;
+
+	addr = vaddr + bit / 8;
+	pthread_mutex_lock(&v->lock);
+	if (resolve(v, 0, addr, &off, &r)) {
+		pthread_mutex_unlock(&v->lock);
+		return -1;
+	}
+	s = claim_slot(v);
+	if (!s) {
+		// make room by journaling the ones that already fired
+		pthread_mutex_lock(&dev->lock);
+		vdimm_sync(dev);
+		pthread_mutex_unlock(&dev->lock);
+		s = claim_slot(v);
+	}
+	if (!s) {
+		pthread_mutex_unlock(&v->lock);
+		errno = EAGAIN;
+		return -1;
+	}
+	s->prot = r->prot;
+	s->page = addr & ~(v->page - 1);
+	s->off = off;
+	s->mask = 1 << (bit % 8);
+	s->queued = queued;
+	s->user_data = user_data;
+	__atomic_store_n(&s->state, SLOT_ARMED, __ATOMIC_RELEASE);
+	ret = arm_page(v, s->page);
+	if (ret)
+		__atomic_store_n(&s->state, SLOT_FREE, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&v->lock);
+	return ret;
+}
+
+static int vdimm_bit_lazy(struct flip_dev *dev, pid_t pid,
+			  unsigned long vaddr, int bit)
+{
+	return arm_lazy(dev, pid, vaddr, bit, 0, 0);
+}
+
+static int uffd_register(struct vdimm *v, unsigned long start, size_t len)
+{
+	struct uffdio_register reg = {
+		.range = { .start = start, .len = len },
+		.mode = UFFDIO_REGISTER_MODE_MINOR,
+	};
+
+	if (v->uffd < 0)
+		return 0;
+	return ioctl(v->uffd, UFFDIO_REGISTER, &reg) == -1 ? -1 : 0;
+}
+
+static int vdimm_pfn(struct flip_dev *dev, pid_t pid, unsigned long vaddr,
+		     int shift)
+{
+	struct vdimm *v = dev->priv;
+	unsigned long page = vaddr & ~(v->page - 1);
+	size_t idx, frame;
+	struct region *r;
+	int armed = 0;
+	void *p;
+
+	if (check_own(pid))
+		return -1;
+	pthread_mutex_lock(&v->lock);
+	r = find_region(v, 0, vaddr);
+	if (!r) {
+		errno = EFAULT;
+		goto err;
+	}
+	idx = (page - r->start) / v->page;
+	if (shift < 0 || shift >= (int)(8 * sizeof(frame)) ||
+	    (frame = r->frames[idx] ^ (1UL << shift)) >= v->nframes) {
+		errno = EINVAL;
+		goto err;
+	}
+
+	p = mmap((void *)page, v->page, r->prot,
+		 MAP_SHARED | MAP_FIXED | MAP_POPULATE, v->memfd,
+		 frame * v->page);
+	if (p == MAP_FAILED)
+		goto err;
+	r->frames[idx] = frame;
+	// the new mapping is a new VMA, neither registered nor armed
+	if (uffd_register(v, page, v->page))
+		goto err;
+	for (int i = 0; i < LAZY_SLOTS; i++) {
+		struct lazy_slot *s = &v->lazy[i];
+
+		if (__atomic_load_n(&s->state, __ATOMIC_ACQUIRE) ==
+			    SLOT_ARMED &&
+		    s->page == page) {
+			s->off = frame * v->page + (s->off & (v->page - 1));
+			armed = 1;
+		}
+	}
+	if (armed && arm_page(v, page))
+		goto err;
+	pthread_mutex_unlock(&v->lock);
+	return 0;
+
+err:
+	pthread_mutex_unlock(&v->lock);
+	return -1;
+}
+
+static void post_cqe(struct flip_dev *dev, uint64_t user_data, int res)
+{
+	struct vdimm *v = dev->priv;
+	struct bitflip_ring_hdr *hdr;
+	struct bitflip_cqe *cqe;
+
+	hdr = __atomic_load_n(&dev->ring, __ATOMIC_ACQUIRE);
+	if (!hdr)
+		return;
+	pthread_mutex_lock(&v->cq_lock);
+	if (hdr->cq_tail - __atomic_load_n(&hdr->cq_head, __ATOMIC_ACQUIRE) <
+	    dev->params.cq_entries) {
+		cqe = (struct bitflip_cqe *)((char *)hdr + dev->params.cq_off) +
+		      (hdr->cq_tail & hdr->cq_mask);
+		cqe->user_data = user_data;
+		cqe->res = res;
+		cqe->flags = 0;
+		__atomic_store_n(&hdr->cq_tail, hdr->cq_tail + 1,
+				 __ATOMIC_RELEASE);
+	} else {
+		hdr->cq_overflow++;
+	}
+	pthread_mutex_unlock(&v->cq_lock);
+}
+
+static int vdimm_timed(struct flip_dev *dev, pid_t pid, unsigned long vaddr,
+		       int bit, uint64_t delay_ns, uint64_t insn_count,
+		       uint64_t user_data)
+{
+	struct vdimm *v = dev->priv;
+	uint64_t one = 1;
+
+	// there is no PMU to count the victim's instructions with
+	if (insn_count) {
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+	if (check_bit(&bit))
+		return -1;
+
+	pthread_mutex_lock(&v->lock);
+	if (v->ntimers == v->timers_cap) {
+		size_t cap = v->timers_cap ? 2 * v->timers_cap : 16;
+		struct timer *t = realloc(v->timers, cap * sizeof(*t));
+
+		if (!t) {
+			pthread_mutex_unlock(&v->lock);
+			return -1;
+		}
+		v->timers = t;
+		v->timers_cap = cap;
+	}
+	v->timers[v->ntimers++] = (struct timer){
+		.deadline = now_ns() + delay_ns,
+		.pid = pid,
+		.vaddr = vaddr,
+		.bit = bit,
+		.user_data = user_data,
+	};
+	pthread_mutex_unlock(&v->lock);
+
+	return write(v->efd, &one, sizeof(one)) == sizeof(one) ? 0 : -1;
+}
+
+static int vdimm_uprobe(struct flip_dev *dev, pid_t pid, unsigned long vaddr,
+			int bit, const char *path, uint64_t offset,
+			uint64_t user_data)
+{
+	errno = EOPNOTSUPP;
+	return -1;
+}
+
+// Fire due timers. Returns ns until the next one, -1 if there is none.
+static int64_t run_timers(struct vdimm *v)
+{
+	struct flip_dev *dev = v->dev;
+
+	for (;;) {
+		uint64_t now = now_ns(), next = UINT64_MAX;
+		struct timer t;
+		size_t due = SIZE_MAX;
+		int ret;
+
+		pthread_mutex_lock(&v->lock);
+		for (size_t i = 0; i < v->ntimers; i++) {
+			if (v->timers[i].deadline <= now) {
+				due = i;
+				break;
+			}
+			if (v->timers[i].deadline < next)
+				next = v->timers[i].deadline;
+		}
+		if (due == SIZE_MAX) {
+			pthread_mutex_unlock(&v->lock);
+			return next == UINT64_MAX ? -1 : (int64_t)(next - now);
+		}
+		t = v->timers[due];
+		v->timers[due] = v->timers[--v->ntimers];
+		ret = flip_locked(v, t.pid, t.vaddr, t.bit) ? -errno : 0;
+		pthread_mutex_unlock(&v->lock);
+
+		post_cqe(dev, t.user_data, ret);
+	}
+}
+
+// A minor fault on a zapped page: apply its flips and map it back.
+static void handle_minor(struct vdimm *v, unsigned long addr)
+{
+	unsigned long page = addr & ~(v->page - 1);
+	struct uffdio_continue cont = {
+		.range = { .start = page, .len = v->page },
+	};
+
+	pthread_mutex_lock(&v->lock);
+	for (int i = 0; i < LAZY_SLOTS; i++) {
+		struct lazy_slot *s = &v->lazy[i];
+
+		if (__atomic_load_n(&s->state, __ATOMIC_ACQUIRE) !=
+			    SLOT_ARMED ||
+		    s->page != page)
+			continue;
+		xor_phys(v, s->off, s->mask, s->prot & PROT_EXEC);
+		__atomic_store_n(&s->state, SLOT_FIRED, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&v->lock);
+
+	// EEXIST: another thread's fault on the page got there first
+	ioctl(v->uffd, UFFDIO_CONTINUE, &cont);
+}
+
+static void *service_main(void *arg)
+{
+	struct vdimm *v = arg;
+	struct pollfd fds[2] = {
+		{ .fd = v->efd, .events = POLLIN },
+		{ .fd = v->uffd, .events = POLLIN },
+	};
+	int nfds = v->uffd >= 0 ? 2 : 1;
+
+	while (!__atomic_load_n(&v->stop, __ATOMIC_ACQUIRE)) {
+		int64_t wait = run_timers(v);
+		struct timespec ts, *tsp = NULL;
+		struct uffd_msg msg;
+		uint64_t n;
+
+		if (wait >= 0) {
+			ts.tv_sec = wait / 1000000000;
+			ts.tv_nsec = wait % 1000000000;
+			tsp = &ts;
+		}
+		if (ppoll(fds, nfds, tsp, NULL) <= 0)
+			continue;
+		if (fds[0].revents & POLLIN)
+			(void)!read(v->efd, &n, sizeof(n));
+		if (nfds < 2 || !(fds[1].revents & POLLIN))
+			continue;
+		while (read(v->uffd, &msg, sizeof(msg)) == sizeof(msg)) {
+			if (msg.event == UFFD_EVENT_PAGEFAULT &&
+			    (msg.arg.pagefault.flags &
+			     UFFD_PAGEFAULT_FLAG_MINOR))
+				handle_minor(v, msg.arg.pagefault.address);
+		}
+	}
+	return NULL;
+}
+
+static int vdimm_ring_setup(struct flip_dev *dev, unsigned sq_entries)
+{
+	struct bitflip_ring_hdr *hdr;
+
+	memset(&dev->params, 0, sizeof(dev->params));
+	dev->params.sq_entries = sq_entries;
+	flip_ring_layout(&dev->params);
+	hdr = mmap(NULL, dev->params.size, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (hdr == MAP_FAILED)
+		return -1;
+	hdr->sq_mask = dev->params.sq_entries - 1;
+	hdr->cq_mask = dev->params.cq_entries - 1;
+	__atomic_store_n(&dev->ring, hdr, __ATOMIC_RELEASE);
+	return 0;
+}
+
+// Journaled, as on the kernel device, when the caller reaps the completion.
+static int run_sqe(struct flip_dev *dev, const struct bitflip_sqe *sqe)
+{
+	int ret;
+
+	switch (sqe->opcode) {
+	case BITFLIP_OP_FLIP:
+		ret = vdimm_bit(dev, sqe->pid, sqe->vaddr, sqe->target_bit);
+		break;
+	case BITFLIP_OP_FLIP_LAZY:
+		ret = arm_lazy(dev, sqe->pid, sqe->vaddr, sqe->target_bit, 1,
+			       sqe->user_data);
+		break;
+	case BITFLIP_OP_FLIP_PFN:
+		ret = vdimm_pfn(dev, sqe->pid, sqe->vaddr, sqe->pfn_shift);
+		break;
+	default:
+		return -EINVAL;
+	}
+	return ret ? -errno : 0;
+}
+
+// Mirrors bitflip_ring_enter(), synchronously in the caller.
+static long vdimm_ring_enter(struct flip_dev *dev, unsigned max)
+{
+	struct vdimm *v = dev->priv;
+	struct bitflip_ring_hdr *hdr = dev->ring;
+	struct bitflip_sqe *sqes =
+		(struct bitflip_sqe *)((char *)hdr + dev->params.sq_off);
+	long done = 0;
+	unsigned head, tail;
+
+	pthread_mutex_lock(&v->ring_lock);
+	head = hdr->sq_head;
+	tail = __atomic_load_n(&hdr->sq_tail, __ATOMIC_ACQUIRE);
+	while (head != tail && (!max || done < max)) {
+		struct bitflip_sqe sqe;
+
+		// leave the SQE queued while its completion has nowhere to go
+		if (__atomic_load_n(&hdr->cq_tail, __ATOMIC_ACQUIRE) -
+			    __atomic_load_n(&hdr->cq_head, __ATOMIC_ACQUIRE) >=
+		    dev->params.cq_entries)
+			break;
+
+		sqe = sqes[head & hdr->sq_mask];
+		__atomic_store_n(&hdr->sq_head, ++head, __ATOMIC_RELEASE);
+		post_cqe(dev, sqe.user_data, run_sqe(dev, &sqe));
+		done++;
+	}
+	pthread_mutex_unlock(&v->ring_lock);
+	return done;
+}
+
+static int vdimm_undo(struct flip_dev *dev, const struct flip_undo *u)
+{
+	struct vdimm *v = dev->priv;
+
+	if (u->op == FLIP_OP_PFN)
+		return vdimm_pfn(dev, u->pid, u->vaddr, u->arg);
+	if (u->op == FLIP_UNDO_MASK)
+		return vdimm_mask(dev, u->pid, u->vaddr, &u->mask, 1);
+	if (u->op == FLIP_UNDO_PHYS) {
+		xor_phys(v, u->vaddr, u->arg, 1);
+		return 0;
+	}
+	return vdimm_bit(dev, u->pid, u->vaddr, u->arg);
+}
+
+// Fresh frames for `npages` of `pid` at `addr` (any if 0), with v->lock
+// held. Counted in v->nregions once mapped.
+static struct region *new_region(struct vdimm *v, pid_t pid,
+				 unsigned long addr, size_t npages)
+{
+	struct region *r;
+	size_t first;
+
+	// the frame tables would no longer describe the old mapping
+	for (size_t i = 0; addr && i < v->nregions; i++) {
+		r = &v->regions[i];
+		if (r->pid == pid && addr < r->start + r->npages * v->page &&
+		    r->start < addr + npages * v->page) {
+			errno = EEXIST;
+			return NULL;
+		}
+	}
+	if (v->nregions == v->regions_cap) {
+		size_t cap = v->regions_cap ? 2 * v->regions_cap : 8;
+
+		r = realloc(v->regions, cap * sizeof(*r));
+		if (!r)
+			return NULL;
+		v->regions = r;
+		v->regions_cap = cap;
+	}
+	r = &v->regions[v->nregions];
+	r->frames = malloc(npages * sizeof(*r->frames));
+	if (!r->frames)
+		return NULL;
+	first = alloc_frames(v, npages);
+	if (first == SIZE_MAX) {
+		free(r->frames);
+		errno = ENOMEM;
+		return NULL;
+	}
+	r->pid = pid;
+	r->pidfd = -1;
+	r->start = addr;
+	r->npages = npages;
+	for (size_t i = 0; i < npages; i++)
+		r->frames[i] = first + i;
+	return r;
+}
+
+static void drop_region(struct vdimm *v, struct region *r)
+{
+	int err = errno;
+
+	if (r->pidfd >= 0)
+		close(r->pidfd);
+	free_frames(v, r);
+	free(r->frames);
+	errno = err;
+}
+
+static void *vdimm_map(struct flip_dev *dev, void *addr, size_t len,
+		       int prot)
+{
+	struct vdimm *v = dev->priv;
+	size_t npages = (len + v->page - 1) / v->page;
+	struct region *r;
+	void *p;
+
+	if (!npages || ((unsigned long)addr & (v->page - 1))) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&v->lock);
+	reap_regions(v);
+	r = new_region(v, 0, (unsigned long)addr, npages);
+	if (!r)
+		goto err;
+	p = mmap(addr, npages * v->page, prot,
+		 MAP_SHARED | MAP_POPULATE | (addr ? MAP_FIXED : 0), v->memfd,
+		 r->frames[0] * v->page);
+	if (p == MAP_FAILED ||
+	    uffd_register(v, (unsigned long)p, npages * v->page)) {
+		if (p != MAP_FAILED)
+			munmap(p, npages * v->page);
+		drop_region(v, r);
+		goto err;
+	}
+	r->start = (unsigned long)p;
+	r->prot = prot;
+	v->nregions++;
+	pthread_mutex_unlock(&v->lock);
+	return p;
+
+err:
+	pthread_mutex_unlock(&v->lock);
+	return NULL;
+}
+
+struct adopt_ctx {
+	unsigned long start, end;
+	int prot, found;
+};
+
+static int match_adopt(void *arg, const struct flip_map *map)
+{
+	struct adopt_ctx *c = arg;
+
+	if (c->start < map->start || c->end > map->end)
+		return 0;
+	c->prot = (map->prot & FLIP_PROT_READ ? PROT_READ : 0) |
+		  (map->prot & FLIP_PROT_WRITE ? PROT_WRITE : 0) |
+		  (map->prot & FLIP_PROT_EXEC ? PROT_EXEC : 0);
+	c->found = 1;
+	return 1;
+}
+
+// The tracee must hold the memfd under our number, flip_vdimm_inherit().
+static int tracee_has_memfd(struct vdimm *v, pid_t pid)
+{
+	struct stat ours, theirs;
+	char path[64];
+
+	snprintf(path, sizeof(path), "/proc/%d/fd/%d", pid, v->memfd);
+	if (stat(path, &theirs) || fstat(v->memfd, &ours))
+		return 0;
+	return ours.st_dev == theirs.st_dev && ours.st_ino == theirs.st_ino;
+}
+
+// Copy what `pid` has at [addr, addr + len) to r's frames.
+static int copy_from(struct vdimm *v, pid_t pid, const struct region *r)
+{
+	size_t len = r->npages * v->page;
+	char path[64];
+	ssize_t n;
+	int fd;
+
+	snprintf(path, sizeof(path), "/proc/%d/mem", pid);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	n = pread(fd, &v->phys[r->frames[0] * v->page], len, r->start);
+	close(fd);
+	if (n != (ssize_t)len) {
+		if (n >= 0)
+			errno = EIO;
+		return -1;
+	}
+	return 0;
+}
+
+static int vdimm_adopt(struct flip_dev *dev, pid_t pid, unsigned long addr,
+		       size_t len)
+{
+	struct vdimm *v = dev->priv;
+	size_t npages = (len + v->page - 1) / v->page;
+	struct adopt_ctx c = { .start = addr,
+			       .end = addr + npages * v->page };
+	struct region *r;
+	long ret;
+
+	if (!npages || (addr & (v->page - 1)) || !owner_of(pid)) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (flip_maps_each(pid, match_adopt, &c) < 0)
+		return -1;
+	if (!c.found || !tracee_has_memfd(v, pid)) {
+		errno = c.found ? EBADF : EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock(&v->lock);
+	reap_regions(v);
+	r = new_region(v, pid, addr, npages);
+	if (!r)
+		goto err;
+	r->prot = c.prot;
+	r->pidfd = syscall(SYS_pidfd_open, pid, 0);
+	// contents first, the mmap may replace the page it runs from
+	if (r->pidfd < 0 || copy_from(v, pid, r) ||
+	    flip_remote_syscall(pid, SYS_mmap,
+				(long[6]){ addr, npages * v->page, c.prot,
+					   MAP_SHARED | MAP_FIXED, v->memfd,
+					   r->frames[0] * v->page },
+				&ret))
+		goto err_region;
+	if ((unsigned long)ret != addr) {
+		errno = ret < 0 && ret > -4096 ? -ret : EIO;
+		goto err_region;
+	}
+	v->nregions++;
+	pthread_mutex_unlock(&v->lock);
+	return 0;
+
+err_region:
+	drop_region(v, r);
+err:
+	pthread_mutex_unlock(&v->lock);
+	return -1;
+}
+// Give back the pages still armed before their fault handling goes away,
+// and cancel what never fired. A lazy flip from the ring completed once
+// armed, so it completes a second time here.
+static void cancel_all(struct flip_dev *dev)
+{
+	struct vdimm *v = dev->priv;
+
+	for (int i = 0; i < LAZY_SLOTS; i++) {
+		struct lazy_slot *s = &v->lazy[i];
+		int st = SLOT_ARMED;
+
+		if (__atomic_load_n(&s->state, __ATOMIC_ACQUIRE) != SLOT_ARMED)
+			continue;
+		// before the slot is freed, or a touch faults past the handler;
+		// a zapped page simply faults in again once the uffd is closed
+		if (v->uffd < 0)
+			mprotect((void *)s->page, v->page, s->prot);
+		// lost to a touch racing with us: the flip landed
+		if (!__atomic_compare_exchange_n(&s->state, &st, SLOT_FREE, 0,
+						 __ATOMIC_ACQUIRE,
+						 __ATOMIC_RELAXED))
+			continue;
+		if (s->queued)
+			post_cqe(dev, s->user_data, -ECANCELED);
+	}
+
+	pthread_mutex_lock(&v->lock);
+	for (size_t i = 0; i < v->ntimers; i++)
+		post_cqe(dev, v->timers[i].user_data, -ECANCELED);
+	v->ntimers = 0;
+	pthread_mutex_unlock(&v->lock);
+}
+
+static void vdimm_close(struct flip_dev *dev)
+{
+	struct vdimm *v = dev->priv;
+	uint64_t one = 1;
+
+	__atomic_store_n(&v->stop, 1, __ATOMIC_RELEASE);
+	(void)!write(v->efd, &one, sizeof(one));
+	pthread_join(v->thread, NULL);
+	cancel_all(dev);
+
+	if (__atomic_load_n(&segv_owner, __ATOMIC_ACQUIRE) == v) {
+		sigaction(SIGSEGV, &segv_prev, NULL);
+		__atomic_store_n(&segv_owner, NULL, __ATOMIC_RELEASE);
+	}
+	// mapped regions stay usable, they hold their own reference
+	if (v->uffd >= 0)
+		close(v->uffd);
+	close(v->efd);
+	if (dev->ring)
+		munmap(dev->ring, dev->params.size);
+	munmap(v->phys, v->nframes * v->page);
+	close(v->memfd);
+	for (size_t i = 0; i < v->nregions; i++) {
+		if (v->regions[i].pidfd >= 0)
+			close(v->regions[i].pidfd);
+		free(v->regions[i].frames);
+	}
+	free(v->regions);
+	free(v->used);
+	free(v->timers);
+	pthread_mutex_destroy(&v->lock);
+	pthread_mutex_destroy(&v->ring_lock);
+	pthread_mutex_destroy(&v->cq_lock);
+	free(v);
+}
+
+const struct flip_backend flip_vdimm_backend = {
+	.bit = vdimm_bit,
+	.bit_lazy = vdimm_bit_lazy,
+	.pfn = vdimm_pfn,
+	.mask = vdimm_mask,
+	.timed = vdimm_timed,
+	.uprobe = vdimm_uprobe,
+	.ring_setup = vdimm_ring_setup,
+	.ring_enter = vdimm_ring_enter,
+	.undo = vdimm_undo,
+	.sync = vdimm_sync,
+	.map = vdimm_map,
+	.adopt = vdimm_adopt,
+	.close = vdimm_close,
+	.kind = FLIP_BACKEND_VDIMM,
+};
+
+// Minor faults on shmem, without privileges if the kernel allows it for
+// user-mode faults only. -1 if unavailable.
+static int uffd_open(void)
+{
+	struct uffdio_api api = { .api = UFFD_API,
+				  .features = UFFD_FEATURE_MINOR_SHMEM };
+	int fd;
+
+	fd = syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+	if (fd < 0)
+		fd = syscall(SYS_userfaultfd,
+			     O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY);
+	if (fd < 0)
+		return -1;
+	if (ioctl(fd, UFFDIO_API, &api) == -1 ||
+	    !(api.features & UFFD_FEATURE_MINOR_SHMEM)) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int flip_vdimm_open(struct flip_dev *dev, const char *spec)
+{
+	unsigned long mb = VDIMM_DEFAULT_MB;
+	struct vdimm *v;
+	char *end;
+	int err;
+
+	if (spec[5] == ':') {
+		mb = strtoul(spec + 6, &end, 10);
+		if (!mb || *end || mb > (SIZE_MAX >> 20)) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	v = calloc(1, sizeof(*v));
+	if (!v)
+		return -1;
+	v->dev = dev;
+	v->page = sysconf(_SC_PAGESIZE);
+	v->nframes = (mb << 20) / v->page;
+	v->uffd = v->efd = -1;
+	v->used = calloc(v->nframes, 1);
+	if (!v->used)
+		goto err_free;
+	v->memfd = memfd_create("vdimm", MFD_CLOEXEC);
+	if (v->memfd < 0)
+		goto err_free;
+	if (ftruncate(v->memfd, v->nframes * v->page) == -1)
+		goto err_memfd;
+	v->phys = mmap(NULL, v->nframes * v->page, PROT_READ | PROT_WRITE,
+		       MAP_SHARED, v->memfd, 0);
+	if (v->phys == MAP_FAILED)
+		goto err_memfd;
+	v->efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (v->efd < 0)
+		goto err_phys;
+	v->uffd = uffd_open();
+
+	pthread_mutex_init(&v->lock, NULL);
+	pthread_mutex_init(&v->ring_lock, NULL);
+	pthread_mutex_init(&v->cq_lock, NULL);
+	err = pthread_create(&v->thread, NULL, service_main, v);
+	if (err) {
+		errno = err;
+		goto err_fds;
+	}
+
+	dev->ops = &flip_vdimm_backend;
+	dev->priv = v;
+	dev->fd = v->memfd;
+	return 0;
+
+err_fds:
+	pthread_mutex_destroy(&v->lock);
+	pthread_mutex_destroy(&v->ring_lock);
+	pthread_mutex_destroy(&v->cq_lock);
+	if (v->uffd >= 0)
+		close(v->uffd);
+	close(v->efd);
+err_phys:
+	munmap(v->phys, v->nframes * v->page);
+err_memfd:
+	close(v->memfd);
+err_free:
+	err = errno;
+	free(v->used);
+	free(v);
+	errno = err;
+	return -1;
+}
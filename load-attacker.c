@@ -1,30 +1,22 @@
-#include <fcntl.h>
 #include <unistd.h>
 #include <elf.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/mman.h>
 #include <string.h>
 #include <assert.h>
-#include <sys/ioctl.h>
 
-#define BITFLIP_MAGIC 0xF5
-#define IOCTL_FLIP_BIT _IOW(BITFLIP_MAGIC, 0, unsigned long)
-
-struct bitflip_args {
-	unsigned long vaddr;
-	pid_t pid;
-	int target_bit;
-	int pfn_shift;
-};
+#include "libflip/flip.h"
 
 typedef struct elf_s {
 	char *filename;
+	struct flip_elf *file;
+	const uint8_t *image;
 	Elf64_Ehdr ehdr;
-	Elf64_Phdr *phdrs;
+	const Elf64_Phdr *phdrs;
 	uint64_t text_start;
 	uint64_t text_size;
-	int fd;
 } elf_t;
 
 void err_quit(const char *msg)
@@ -45,43 +37,36 @@ static size_t count_arg(char **args)
 elf_t *parse_elf_headers(const char *elf_file)
 {
 	elf_t *elf = malloc(sizeof(elf_t));
-	elf->fd = open(elf_file, O_RDONLY);
-	if (elf->fd == -1) {
+	elf->file = flip_elf_open(elf_file);
+	if (!elf->file) {
 		err_quit("Open ELF format file");
 	}
 
 	elf->filename = malloc(strlen(elf_file) + 1);
 	strcpy(elf->filename, elf_file);
 
-	Elf64_Ehdr *ehdr = &elf->ehdr;
-	if (read(elf->fd, ehdr, sizeof(Elf64_Ehdr)) != sizeof(Elf64_Ehdr)) {
-		close(elf->fd);
-		err_quit("Read ELF header");
-	}
-
-	if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0) {
-		err_quit("This file is not in ELF format");
-	}
-
-	elf->phdrs = malloc(ehdr->e_phentsize * ehdr->e_phnum);
-	Elf64_Phdr *phdrs = elf->phdrs;
-
-	if (!phdrs) {
-		close(elf->fd);
-		err_quit("Memory allocation for program headers");
-	}
-
-	lseek(elf->fd, ehdr->e_phoff, SEEK_SET);
-	if (read(elf->fd, phdrs, ehdr->e_phentsize * ehdr->e_phnum) !=
-	    ehdr->e_phentsize * ehdr->e_phnum) {
-		free(phdrs);
-		close(elf->fd);
-		err_quit("Reading program headers");
-	}
+	elf->image = flip_elf_image(elf->file, NULL);
+	elf->ehdr = *flip_elf_ehdr(elf->file);
+	elf->phdrs = flip_elf_phdrs(elf->file, NULL);
 
 	return elf;
 }
 
+// Segments go on the virtual DIMM when that is the device, the flip can
+// only reach memory mapped from it.
+static void *map_segment(struct flip_dev *dev, uint64_t addr, size_t len)
+{
+	int prot = PROT_READ | PROT_WRITE | PROT_EXEC;
+	void *mem = flip_vdimm_map(dev, (void *)addr, len, prot);
+
+	if (mem)
+		return mem;
+	if (errno != EOPNOTSUPP)
+		return MAP_FAILED;
+	return mmap((void *)addr, len, prot, MAP_PRIVATE | MAP_ANONYMOUS, -1,
+		    0);
+}
+
 char *setup_stack(elf_t *elf, char **argv, char **envp)
 {
 	size_t argc = count_arg(argv);
@@ -173,8 +158,14 @@ int main(int argc, char **argv, char **envp)
 	printf("target program %s\n", program);
 	elf_t *elf = parse_elf_headers(program);
 
+	struct flip_dev *dev = flip_dev_open(NULL);
+	if (!dev) {
+		perror("Failed to open the device");
+		exit(EXIT_FAILURE);
+	}
+
 	for (int i = 0; i < elf->ehdr.e_phnum; i++) {
-		Elf64_Phdr *phdr = &elf->phdrs[i];
+		const Elf64_Phdr *phdr = &elf->phdrs[i];
 		if (phdr->p_type == PT_LOAD) {
 			void *segment_vaddr = (void *)phdr->p_vaddr;
 			size_t segment_size = phdr->p_memsz;
@@ -185,11 +176,8 @@ int main(int argc, char **argv, char **envp)
 			printf("==============================\n");
 			printf("padding size: %#lx\n", padding_size);
 
-			void *mapped_mem =
-				mmap((void *)shifted_vaddr,
-				     segment_size + padding_size,
-				     PROT_READ | PROT_WRITE | PROT_EXEC,
-				     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			void *mapped_mem = map_segment(
+				dev, shifted_vaddr, segment_size + padding_size);
 
 			if (mapped_mem == MAP_FAILED) {
 				free(elf);
@@ -202,12 +190,8 @@ int main(int argc, char **argv, char **envp)
 
 			assert((uint64_t)mapped_mem == shifted_vaddr);
 
-			lseek(elf->fd, phdr->p_offset, SEEK_SET);
-			if (read(elf->fd, mapped_ptr, segment_file_size) !=
-			    segment_file_size) {
-				free(elf);
-				err_quit("Load segment to memory");
-			}
+			memcpy(mapped_ptr, elf->image + phdr->p_offset,
+			       segment_file_size);
 
 			// zero-out the remaining segment space (.bss section)
 			if (segment_size > segment_file_size) {
@@ -239,53 +223,31 @@ int main(int argc, char **argv, char **envp)
 	}
 
 	char *stack = setup_stack(elf, argv + 1, envp);
-	uint64_t target_addr;
-
-	for (unsigned *addr = (unsigned *)elf->ehdr.e_entry;
-	     (uint64_t)addr < elf->text_start + elf->text_size; addr++) {
-		unsigned instr = *addr;
-		if ((instr & 0xFF000000) == 0x97000000) {
-			unsigned *next_addr = addr + 1;
-			unsigned next_instr = *next_addr;
-
-			// Check for 'cmp' instr (0x7100001f is 'cmp w0, #0x0' in ARMv8)
-			if ((next_instr & 0xFF000000) != 0x71000000)
-				continue;
-
-			unsigned *next2_addr = next_addr + 1;
-			unsigned next2_instr = *next2_addr;
-
-			// Check for 'b.ne' instr (0x54000181 is 'b.ne' in ARMv8)
-			if ((next2_instr & 0xFF000000) == 0x54000000) {
-				printf("Found 'bl' at %#lx, 'cmp' at %#lx, and 'b.ne' at %#lx\n",
-				       (uint64_t)addr, (uint64_t)next_addr,
-				       (uint64_t)next2_addr);
-				printf("instruction 1: %#x\n", instr);
-				printf("instruction 2: %#x\n", next_instr);
-				printf("instruction 3: %#x\n", next2_instr);
-				target_addr = (uint64_t)next_addr;
-				break;
-			}
-		}
-	}
-
-	int fd = open("/dev/bitflip", O_RDWR);
-	if (fd < 0) {
-		perror("Failed to open the device");
+	const struct flip_insn_match pattern[] = FLIP_PATTERN_CHECK_CALL;
+	uint64_t entry = elf->ehdr.e_entry;
+	size_t bl_offset;
+
+	// 'bl', then 'cmp w0, #0x0' (0x7100001f), then 'b.ne' (0x54000181)
+	if (!flip_scan((void *)entry, elf->text_start + elf->text_size - entry,
+		       pattern, 3, &bl_offset, 1)) {
+		fprintf(stderr, "No 'bl; cmp; b.cond' sequence found\n");
 		exit(EXIT_FAILURE);
 	}
 
-	struct bitflip_args arg = {
-		.vaddr = target_addr,
-		.pid = getpid(),
-		.target_bit = 5,
-		.pfn_shift = 0,
-	};
-	if (ioctl(fd, IOCTL_FLIP_BIT, &arg) == -1) {
+	unsigned *addr = (unsigned *)(entry + bl_offset);
+	printf("Found 'bl' at %#lx, 'cmp' at %#lx, and 'b.ne' at %#lx\n",
+	       (uint64_t)addr, (uint64_t)(addr + 1), (uint64_t)(addr + 2));
+	printf("instruction 1: %#x\n", addr[0]);
+	printf("instruction 2: %#x\n", addr[1]);
+	printf("instruction 3: %#x\n", addr[2]);
+	uint64_t target_addr = (uint64_t)(addr + 1);
+
+	if (flip_bit(dev, getpid(), target_addr, 5)) {
 		perror("ioctl failed");
-		close(fd);
+		flip_dev_close(dev);
 		exit(EXIT_FAILURE);
 	}
+	flip_dev_close(dev);
 
 	jump_exec(stack, (void *)elf->ehdr.e_entry);
 }
\ No newline at end of file
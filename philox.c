@@ -0,0 +1,211 @@
+#include <string.h>
+
+#include "philox.h"
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+#define PHILOX_ROUNDS 10
+
+void philox4x32(const uint32_t ctr[4], const uint32_t key[2], uint32_t out[4])
+{
+	uint32_t c0 = ctr[0], c1 = ctr[1], c2 = ctr[2], c3 = ctr[3];
+	uint32_t k0 = key[0], k1 = key[1];
+
+	for (int r = 0; r < PHILOX_ROUNDS; r++) {
+		uint64_t p0 = (uint64_t)PHILOX_M0 * c0;
+		uint64_t p1 = (uint64_t)PHILOX_M1 * c2;
+
+		c0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+		c1 = (uint32_t)p1;
+		c2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+		c3 = (uint32_t)p0;
+		k0 += PHILOX_W0;
+		k1 += PHILOX_W1;
+	}
+
+	out[0] = c0;
+	out[1] = c1;
+	out[2] = c2;
+	out[3] = c3;
+}
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+
+static inline void mulhilo(uint32x4_t a, uint32_t m, uint32x4_t *hi,
+			   uint32x4_t *lo)
+{
+	uint64x2_t p01 = vmull_u32(vget_low_u32(a), vdup_n_u32(m));
+	uint64x2_t p23 = vmull_u32(vget_high_u32(a), vdup_n_u32(m));
+
+	*lo = vcombine_u32(vmovn_u64(p01), vmovn_u64(p23));
+	*hi = vcombine_u32(vshrn_n_u64(p01, 32), vshrn_n_u64(p23, 32));
+}
+
+// Blocks block .. block + 3 of the stream, in stream order.
+static void philox4x32_x4(const struct philox *rng, uint64_t block,
+			  uint32_t *out)
+{
+	uint32_t lo[4] = { block, block + 1, block + 2, block + 3 };
+	uint32_t hi[4] = { (block) >> 32, (block + 1) >> 32,
+			   (block + 2) >> 32, (block + 3) >> 32 };
+	uint32x4_t c0 = vld1q_u32(lo), c1 = vld1q_u32(hi);
+	uint32x4_t c2 = vdupq_n_u32(rng->trial);
+	uint32x4_t c3 = vdupq_n_u32(rng->trial >> 32);
+	uint32_t k0 = rng->key[0], k1 = rng->key[1];
+	uint32x4x4_t res;
+
+	for (int r = 0; r < PHILOX_ROUNDS; r++) {
+		uint32x4_t hi0, lo0, hi1, lo1;
+
+		mulhilo(c0, PHILOX_M0, &hi0, &lo0);
+		mulhilo(c2, PHILOX_M1, &hi1, &lo1);
+		c0 = veorq_u32(veorq_u32(hi1, c1), vdupq_n_u32(k0));
+		c1 = lo1;
+		c2 = veorq_u32(veorq_u32(hi0, c3), vdupq_n_u32(k1));
+		c3 = lo0;
+		k0 += PHILOX_W0;
+		k1 += PHILOX_W1;
+	}
+
+	res.val[0] = c0;
+	res.val[1] = c1;
+	res.val[2] = c2;
+	res.val[3] = c3;
+	vst4q_u32(out, res); // interleaves back into per-block order
+}
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+
+static inline void mulhilo(__m128i a, uint32_t m, __m128i *hi, __m128i *lo)
+{
+	const __m128i mv = _mm_set1_epi32(m);
+	const __m128i low = _mm_set_epi32(0, -1, 0, -1);
+	__m128i p02 = _mm_mul_epu32(a, mv);
+	__m128i p13 = _mm_mul_epu32(_mm_srli_epi64(a, 32), mv);
+
+	*lo = _mm_or_si128(_mm_and_si128(p02, low), _mm_slli_epi64(p13, 32));
+	*hi = _mm_or_si128(_mm_srli_epi64(p02, 32), _mm_andnot_si128(low, p13));
+}
+
+static void philox4x32_x4(const struct philox *rng, uint64_t block,
+			  uint32_t *out)
+{
+	__m128i c0 = _mm_set_epi32(block + 3, block + 2, block + 1, block);
+	__m128i c1 = _mm_set_epi32((block + 3) >> 32, (block + 2) >> 32,
+				   (block + 1) >> 32, block >> 32);
+	__m128i c2 = _mm_set1_epi32(rng->trial);
+	__m128i c3 = _mm_set1_epi32(rng->trial >> 32);
+	uint32_t k0 = rng->key[0], k1 = rng->key[1];
+	__m128i t0, t1, t2, t3;
+
+	for (int r = 0; r < PHILOX_ROUNDS; r++) {
+		__m128i hi0, lo0, hi1, lo1;
+
+		mulhilo(c0, PHILOX_M0, &hi0, &lo0);
+		mulhilo(c2, PHILOX_M1, &hi1, &lo1);
+		c0 = _mm_xor_si128(_mm_xor_si128(hi1, c1), _mm_set1_epi32(k0));
+		c1 = lo1;
+		c2 = _mm_xor_si128(_mm_xor_si128(hi0, c3), _mm_set1_epi32(k1));
+		c3 = lo0;
+		k0 += PHILOX_W0;
+		k1 += PHILOX_W1;
+	}
+
+	// 4x4 transpose back into per-block order
+	t0 = _mm_unpacklo_epi32(c0, c1);
+	t1 = _mm_unpacklo_epi32(c2, c3);
+	t2 = _mm_unpackhi_epi32(c0, c1);
+	t3 = _mm_unpackhi_epi32(c2, c3);
+	_mm_storeu_si128((__m128i *)out, _mm_unpacklo_epi64(t0, t1));
+	_mm_storeu_si128((__m128i *)out + 1, _mm_unpackhi_epi64(t0, t1));
+	_mm_storeu_si128((__m128i *)out + 2, _mm_unpacklo_epi64(t2, t3));
+	_mm_storeu_si128((__m128i *)out + 3, _mm_unpackhi_epi64(t2, t3));
+}
+#else
+static void philox4x32_x4(const struct philox *rng, uint64_t block,
+			  uint32_t *out)
+{
+	for (int i = 0; i < 4; i++) {
+		uint32_t ctr[4] = { block + i, (block + i) >> 32, rng->trial,
+				    rng->trial >> 32 };
+
+		philox4x32(ctr, rng->key, out + 4 * i);
+	}
+}
+#endif
+
+void philox_init(struct philox *rng, uint64_t seed, uint64_t trial)
+{
+	rng->key[0] = seed;
+	rng->key[1] = seed >> 32;
+	rng->trial = trial;
+	rng->block = 0;
+	rng->avail = 0;
+}
+
+static void refill(struct philox *rng)
+{
+	uint32_t ctr[4] = { rng->block, rng->block >> 32, rng->trial,
+			    rng->trial >> 32 };
+
+	philox4x32(ctr, rng->key, rng->buf);
+	rng->block++;
+	rng->avail = 4;
+}
+
+uint32_t philox_u32(struct philox *rng)
+{
+	if (!rng->avail)
+		refill(rng);
+	return rng->buf[4 - rng->avail--];
+}
+
+uint64_t philox_u64(struct philox *rng)
+{
+	uint64_t lo = philox_u32(rng);
+
+	return lo | (uint64_t)philox_u32(rng) << 32;
+}
+
+double philox_double(struct philox *rng)
+{
+	return (philox_u64(rng) >> 11) * 0x1.0p-53;
+}
+
+// Lemire's multiply-and-reject
+uint32_t philox_below(struct philox *rng, uint32_t n)
+{
+	uint64_t m = (uint64_t)philox_u32(rng) * n;
+
+	if ((uint32_t)m < n) {
+		uint32_t threshold = -n % n;
+
+		while ((uint32_t)m < threshold)
+			m = (uint64_t)philox_u32(rng) * n;
+	}
+	return m >> 32;
+}
+
+void philox_fill(struct philox *rng, uint32_t *out, size_t n)
+{
+	while (n && rng->avail) {
+		*out++ = rng->buf[4 - rng->avail--];
+		n--;
+	}
+
+	for (; n >= 16; n -= 16, out += 16) {
+		philox4x32_x4(rng, rng->block, out);
+		rng->block += 4;
+	}
+
+	while (n) {
+		refill(rng);
+		while (n && rng->avail) {
+			*out++ = rng->buf[4 - rng->avail--];
+			n--;
+		}
+	}
+}
@@ -0,0 +1,41 @@
+#ifndef PHILOX_H
+#define PHILOX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Philox4x32-10 counter-based generator (Salmon et al., SC'11).
+ *
+ * A stream is keyed by the campaign seed and addressed by (trial, block):
+ * block b of trial t is philox(key = seed, counter = {b, t}), four 32-bit
+ * words. Any trial can be replayed on its own, and workers never share
+ * state, no matter how trials are spread over threads or machines.
+ */
+
+struct philox {
+	uint32_t key[2];
+	uint64_t trial;
+	uint64_t block; // next block to generate
+	uint32_t buf[4];
+	unsigned avail; // unread words at the end of buf
+};
+
+// One block: out = philox4x32-10(ctr, key).
+void philox4x32(const uint32_t ctr[4], const uint32_t key[2],
+		uint32_t out[4]);
+
+void philox_init(struct philox *rng, uint64_t seed, uint64_t trial);
+
+uint32_t philox_u32(struct philox *rng);
+uint64_t philox_u64(struct philox *rng);
+// Uniform in [0, 1) with 53 bits.
+double philox_double(struct philox *rng);
+// Uniform in [0, n) without modulo bias, n > 0.
+uint32_t philox_below(struct philox *rng, uint32_t n);
+
+// The next `n` words of the stream, the same ones philox_u32() would return.
+// Whole blocks are generated four at a time with NEON or SSE2.
+void philox_fill(struct philox *rng, uint32_t *out, size_t n);
+
+#endif
@@ -10,6 +10,7 @@
 #include <asm/current.h>
 #include <asm/pgtable.h>
 #include <asm/cacheflush.h>
+#include <asm/tlbflush.h>
 
 #define DEVICE_NAME "pteredirect"
 #define N_MINORS 1
@@ -92,76 +93,224 @@ static ssize_t pteredirect_read(struct file *filp, char __user *buff, size_t len
 	return -EINVAL;
 }
 
-static pte_t *vaddr_to_pte(uint64_t address)
+enum pt_level {
+	PT_NONE,
+	PT_PTE,
+	PT_PMD,
+	PT_PUD,
+};
+
+struct pt_leaf {
+	enum pt_level level;
+	pud_t *pudp;
+	pmd_t *pmdp;
+	pte_t *ptep; // mapped, release with pte_unmap()
+};
+
+// Walk down to the entry that maps `address`. THP and hugetlb mappings stop
+// at a PMD or PUD leaf, there is no PTE level below them.
+static enum pt_level vaddr_to_leaf(uint64_t address, struct pt_leaf *leaf)
 {
-	pmd_t *pmdp = pmd_off(current->mm, address);
-	pr_info("pteredirect: [vaddr_to_pte] pmdp: %#llx\n", (uint64_t)pmdp->pmd);
-	return pte_offset_map(pmdp, address);
+	pgd_t *pgdp = pgd_offset(current->mm, address);
+	p4d_t *p4dp;
+
+	memset(leaf, 0, sizeof(*leaf));
+
+	if (pgd_none(*pgdp) || pgd_bad(*pgdp))
+		return PT_NONE;
+	p4dp = p4d_offset(pgdp, address);
+	if (p4d_none(*p4dp) || p4d_bad(*p4dp))
+		return PT_NONE;
+
+	leaf->pudp = pud_offset(p4dp, address);
+	if (pud_none(*leaf->pudp))
+		return PT_NONE;
+	if (pud_leaf(*leaf->pudp))
+		return leaf->level = PT_PUD;
+
+	leaf->pmdp = pmd_offset(leaf->pudp, address);
+	pr_info("pteredirect: [vaddr_to_leaf] pmdp: %#llx\n",
+		(uint64_t)pmd_val(*leaf->pmdp));
+	if (pmd_none(*leaf->pmdp))
+		return PT_NONE;
+	if (pmd_leaf(*leaf->pmdp))
+		return leaf->level = PT_PMD;
+
+	leaf->ptep = pte_offset_map(leaf->pmdp, address);
+	if (!leaf->ptep)
+		return PT_NONE;
+	return leaf->level = PT_PTE;
 }
 
-static pte_t *vaddr_to_pte_base(uint64_t address)
+// The page-table page holding the leaf entry, and the entry's index in it.
+static unsigned long leaf_table_pfn(struct pt_leaf *leaf)
 {
-	pmd_t *pmdp = pmd_off(current->mm, address);
-	pr_info("pteredirect: [to_pte_base] pmdp: %#llx\n", (uint64_t)pmdp->pmd);
-	return (pte_t *)pmd_page_vaddr(*pmdp);
+	switch (leaf->level) {
+	case PT_PTE:
+		return page_to_pfn(pmd_page(*leaf->pmdp));
+	case PT_PMD:
+		return page_to_pfn(virt_to_page(leaf->pmdp));
+	case PT_PUD:
+		return page_to_pfn(virt_to_page(leaf->pudp));
+	default:
+		return 0;
+	}
 }
 
+static unsigned long leaf_index(struct pt_leaf *leaf, uint64_t address)
+{
+	switch (leaf->level) {
+	case PT_PTE:
+		return pte_index(address);
+	case PT_PMD:
+		return pmd_index(address);
+	case PT_PUD:
+		return pud_index(address);
+	default:
+		return 0;
+	}
+}
+
+static ssize_t redirect_pte(struct vm_area_struct *vma, uint64_t user_va1,
+			    pte_t *ptep1, unsigned long pfn_pt2)
+{
+	unsigned long pfn;
+	pgprot_t old_prot;
+
+	if (!pte_present(*ptep1))
+		return 0;
+
+	pr_info("pteredirect: Old ptep1 present: %d writable: %d user exec: %d dirty: %d young: %d\n",
+		pte_present(*ptep1), pte_write(*ptep1), pte_user_exec(*ptep1),
+		pte_dirty(*ptep1), pte_young(*ptep1));
+	pr_info("pteredirect: ptep1 value: %#llx\n", pte_val(*ptep1));
+	pr_info("pteredirect: PTRS_PER_PTE: %d\n", PTRS_PER_PTE);
+	pr_info("pteredirect: ptep1    pte_index: %ld\n", pte_index(user_va1));
+
+	// redirect ptep1 to the page table that maps user_va2
+	pfn = pte_pfn(*ptep1);
+	old_prot = __pgprot(pte_val(pfn_pte(pfn, __pgprot(0))) ^
+			    pte_val(*ptep1));
+	set_pte(ptep1, pfn_pte(pfn_pt2, old_prot));
+
+	// ensure cache and TLB are in sync
+	flush_cache_page(vma, user_va1, pte_pfn(*ptep1));
+	flush_tlb_page(vma, user_va1);
+	update_mmu_cache(vma, user_va1, ptep1);
+
+	pr_info("pteredirect: ptep1 new value: %#llx\n", pte_val(*ptep1));
+	pr_info("pteredirect: New ptep1 present: %d writable: %d user exec: %d dirty: %d young: %d\n",
+		pte_present(*ptep1), pte_write(*ptep1), pte_user_exec(*ptep1),
+		pte_dirty(*ptep1), pte_young(*ptep1));
+
+	return 0;
+}
+
+/*
+ * A block entry can only point at a naturally aligned block, so a huge leaf
+ * is redirected to the block that contains the target page table, the same
+ * effect a flipped PFN bit in the block descriptor has. Returns the byte
+ * offset of the table inside the block.
+ */
+static ssize_t redirect_pmd(struct vm_area_struct *vma, uint64_t user_va1,
+			    pmd_t *pmdp1, unsigned long pfn_pt2)
+{
+	unsigned long nr = PMD_SIZE >> PAGE_SHIFT;
+	unsigned long pfn = pmd_pfn(*pmdp1);
+	unsigned long start = user_va1 & PMD_MASK;
+	pgprot_t old_prot;
+
+	pr_info("pteredirect: pmdp1 value: %#llx\n", (uint64_t)pmd_val(*pmdp1));
+
+	old_prot = __pgprot(pmd_val(pfn_pmd(pfn, __pgprot(0))) ^
+			    pmd_val(*pmdp1));
+	set_pmd(pmdp1, pfn_pmd(pfn_pt2 & ~(nr - 1), old_prot));
+	flush_tlb_range(vma, start, start + PMD_SIZE);
+
+	pr_info("pteredirect: pmdp1 new value: %#llx\n",
+		(uint64_t)pmd_val(*pmdp1));
+	return (pfn_pt2 & (nr - 1)) << PAGE_SHIFT;
+}
+
+static ssize_t redirect_pud(struct vm_area_struct *vma, uint64_t user_va1,
+			    pud_t *pudp1, unsigned long pfn_pt2)
+{
+	unsigned long nr = PUD_SIZE >> PAGE_SHIFT;
+	unsigned long pfn = pud_pfn(*pudp1);
+	unsigned long start = user_va1 & PUD_MASK;
+	pgprot_t old_prot;
+
+	pr_info("pteredirect: pudp1 value: %#llx\n", (uint64_t)pud_val(*pudp1));
+
+	old_prot = __pgprot(pud_val(pfn_pud(pfn, __pgprot(0))) ^
+			    pud_val(*pudp1));
+	set_pud(pudp1, pfn_pud(pfn_pt2 & ~(nr - 1), old_prot));
+	flush_tlb_range(vma, start, start + PUD_SIZE);
+
+	pr_info("pteredirect: pudp1 new value: %#llx\n",
+		(uint64_t)pud_val(*pudp1));
+	return (pfn_pt2 & (nr - 1)) << PAGE_SHIFT;
+}
+
+/*
+ * Redirect the entry mapping `buff` to the page table that maps buff + 2MB.
+ * For a 4K mapping this returns the index of the second entry in the
+ * redirected page; for a PMD or PUD leaf it returns the byte offset from
+ * `buff` at which that entry shows up.
+ */
 static ssize_t pteredirect_write(struct file *filp, const char __user *buff,
-			     size_t len, loff_t *off)
+				 size_t len, loff_t *off)
 {
 	uint64_t user_va1 = (uint64_t)buff;
 	uint64_t user_va2 = user_va1 + SIZE_2M;
+	struct vm_area_struct *vma;
+	struct pt_leaf leaf1, leaf2;
+	unsigned long pfn_pt2;
+	ssize_t ret = -EFAULT;
 
-	struct vm_area_struct *vma = find_vma(current->mm, user_va1);
-	pte_t *ptep1 = vaddr_to_pte(user_va1); // in the first page table
-	pte_t *ptep2 = vaddr_to_pte(user_va2); // in the second page table
-	pte_t *pte2_base = vaddr_to_pte_base(user_va2);
-	unsigned long pfn_pte2 =
-		page_to_pfn(pmd_page(*pmd_off(current->mm, user_va2)));
-
-	if (pte_present(*ptep1)) {
-		unsigned long pfn;
-		pgprot_t old_prot;
-
-		pr_info("pteredirect: Old ptep1 present: %d writable: %d user exec: %d dirty: %d young: %d\n",
-			pte_present(*ptep1), pte_write(*ptep1),
-			pte_user_exec(*ptep1), pte_dirty(*ptep1),
-			pte_young(*ptep1));
-		pr_info("pteredirect: ptep1 value: %#llx\n", pte_val(*ptep1));
-		pr_info("pteredirect: ptep2 value: %#llx\n", pte_val(*ptep2));
-		pr_info("pteredirect: pte2base addr: %#llx\n", (uint64_t)pte2_base);
-		pr_info("pteredirect: ptep2    addr: %#llx\n", (uint64_t)ptep2);
-
-		pr_info("pteredirect: PTRS_PER_PTE: %d\n", PTRS_PER_PTE);
-		pr_info("pteredirect: ptep1    pte_index: %ld\n",
-			pte_index(user_va1));
-		pr_info("pteredirect: ptep2    pte_index: %ld\n",
-			pte_index(user_va2));
-
-		// redirect ptep1 to the base of the second page table
-		pfn = pte_pfn(*ptep1);
-		old_prot = __pgprot(pte_val(pfn_pte(pfn, __pgprot(0))) ^
-				    pte_val(*ptep1));
-		set_pte(ptep1, pfn_pte(pfn_pte2, old_prot));
-
-		// ensure cache and TLB are in sync
-		flush_cache_page(vma, user_va1, pte_pfn(*ptep1));
-		flush_tlb_page(vma, user_va1);
-		update_mmu_cache(vma, user_va1, ptep1);
-
-		pr_info("pteredirect: ptep1 new value: %#llx\n", pte_val(*ptep1));
-		pr_info("pteredirect: New ptep1 present: %d writable: %d user exec: %d dirty: %d young: %d\n",
-			pte_present(*ptep1), pte_write(*ptep1),
-			pte_user_exec(*ptep1), pte_dirty(*ptep1),
-			pte_young(*ptep1));
-
-		pte_unmap(ptep1);
-		pte_unmap(ptep2);
+	mmap_read_lock(current->mm);
+	vma = find_vma(current->mm, user_va1);
+	vaddr_to_leaf(user_va1, &leaf1); // in the first page table
+	vaddr_to_leaf(user_va2, &leaf2); // in the second page table
+	if (!vma || leaf1.level == PT_NONE || leaf2.level == PT_NONE) {
+		pr_info("pteredirect: %#llx or %#llx is not mapped\n",
+			user_va1, user_va2);
+		goto out;
 	}
 
+	pfn_pt2 = leaf_table_pfn(&leaf2);
+	pr_info("pteredirect: level1: %d level2: %d table2 pfn: %#lx\n",
+		leaf1.level, leaf2.level, pfn_pt2);
+
+	switch (leaf1.level) {
+	case PT_PTE:
+		ret = redirect_pte(vma, user_va1, leaf1.ptep, pfn_pt2);
+		if (!ret)
+			ret = leaf_index(&leaf2, user_va2);
+		break;
+	case PT_PMD:
+		ret = redirect_pmd(vma, user_va1, leaf1.pmdp, pfn_pt2);
+		ret += leaf_index(&leaf2, user_va2) * sizeof(u64);
+		break;
+	case PT_PUD:
+		ret = redirect_pud(vma, user_va1, leaf1.pudp, pfn_pt2);
+		ret += leaf_index(&leaf2, user_va2) * sizeof(u64);
+		break;
+	default:
+		break;
+	}
+
+out:
+	if (leaf1.ptep)
+		pte_unmap(leaf1.ptep);
+	if (leaf2.ptep)
+		pte_unmap(leaf2.ptep);
+	mmap_read_unlock(current->mm);
+
 	pr_info("pteredirect: Finished writing to pteredirect module\n");
-	return pte_index(user_va2);
+	return ret;
 }
 
+
 module_init(pteredirect_init);
 module_exit(pteredirect_exit);
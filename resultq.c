@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "results.h"
+
+#define MAX_OUTCOMES 256
+#define MAX_BITS 64
+
+struct outcome {
+	char method[32];
+	int32_t exit_status;
+	uint8_t signal;
+	unsigned long count;
+};
+
+struct bit_stats {
+	unsigned long trials;
+	unsigned long exited_ok;
+	unsigned long signaled;
+	unsigned long changed; // the diff saw more than the flipped word
+};
+
+static struct outcome outcomes[MAX_OUTCOMES];
+static int n_outcomes;
+static struct bit_stats bits[MAX_BITS];
+
+static void count_outcome(const char *method, int32_t exit_status,
+			  uint8_t signal, unsigned long n)
+{
+	int i;
+
+	for (i = 0; i < n_outcomes; i++) {
+		if (outcomes[i].exit_status == exit_status &&
+		    outcomes[i].signal == signal &&
+		    strcmp(outcomes[i].method, method) == 0)
+			break;
+	}
+	if (i == n_outcomes) {
+		if (n_outcomes == MAX_OUTCOMES)
+			return;
+		snprintf(outcomes[i].method, sizeof(outcomes[i].method), "%s",
+			 method);
+		outcomes[i].exit_status = exit_status;
+		outcomes[i].signal = signal;
+		n_outcomes++;
+	}
+	outcomes[i].count += n;
+}
+
+// Outcomes are counted per (method id, exit, signal) inside the block first,
+// so the string compares happen once per distinct key and block.
+static void scan_block(const struct rs_block *b)
+{
+	const int32_t *exit_status = b->cols[RS_EXIT];
+	const uint8_t *signal = b->cols[RS_SIGNAL];
+	const uint32_t *method = b->cols[RS_METHOD];
+	const uint8_t *bit = b->cols[RS_BIT];
+	const uint32_t *diff_words = b->cols[RS_DIFF_WORDS];
+	struct {
+		uint32_t method;
+		int32_t exit_status;
+		uint8_t signal;
+		unsigned long count;
+	} local[16];
+	int n_local = 0;
+
+	for (uint32_t r = 0; r < b->nrows; r++) {
+		struct bit_stats *bs = &bits[bit[r] % MAX_BITS];
+		int i;
+
+		bs->trials++;
+		bs->exited_ok += !signal[r] && exit_status[r] == 0;
+		bs->signaled += signal[r] != 0;
+		bs->changed += diff_words[r] > 1;
+
+		for (i = 0; i < n_local; i++) {
+			if (local[i].method == method[r] &&
+			    local[i].exit_status == exit_status[r] &&
+			    local[i].signal == signal[r])
+				break;
+		}
+		if (i == n_local) {
+			if (n_local == 16) {
+				count_outcome(rs_str(b, method[r]),
+					      exit_status[r], signal[r], 1);
+				continue;
+			}
+			local[i].method = method[r];
+			local[i].exit_status = exit_status[r];
+			local[i].signal = signal[r];
+			local[i].count = 0;
+			n_local++;
+		}
+		local[i].count++;
+	}
+
+	for (int i = 0; i < n_local; i++)
+		count_outcome(rs_str(b, local[i].method), local[i].exit_status,
+			      local[i].signal, local[i].count);
+}
+
+int main(int argc, char *argv[])
+{
+	struct rs_file f;
+	struct rs_block b;
+	unsigned long rows = 0, blocks = 0;
+	size_t pos = 0;
+
+	if (argc < 2) {
+		fprintf(stderr, "USAGE: %s <result store>\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	if (rs_open(argv[1], &f))
+		exit(EXIT_FAILURE);
+
+	while (rs_next_block(&f, &pos, &b)) {
+		scan_block(&b);
+		rows += b.nrows;
+		blocks++;
+	}
+
+	printf("%lu rows in %lu blocks\n\n", rows, blocks);
+
+	printf("%-16s %6s %6s %12s\n", "method", "exit", "signal", "trials");
+	for (int i = 0; i < n_outcomes; i++)
+		printf("%-16s %6d %6u %12lu\n", outcomes[i].method,
+		       outcomes[i].exit_status, outcomes[i].signal,
+		       outcomes[i].count);
+
+	printf("\n%4s %12s %12s %12s %12s\n", "bit", "trials", "exit 0",
+	       "signaled", "spread");
+	for (int i = 0; i < MAX_BITS; i++) {
+		if (!bits[i].trials)
+			continue;
+		printf("%4d %12lu %12lu %12lu %12lu\n", i, bits[i].trials,
+		       bits[i].exited_ok, bits[i].signaled, bits[i].changed);
+	}
+
+	rs_close(&f);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,287 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "results.h"
+
+#define DICT_SLOTS (4 * RS_BLOCK_ROWS) // at most 2 new strings per row
+#define PAD8(x) (((x) + 7) & ~(size_t)7)
+
+static const uint8_t rs_width[RS_NCOLS] = {
+	[RS_ADDR] = 8,	     [RS_RUNTIME] = 8, [RS_DIFF_ADDR] = 8,
+	[RS_INSN_OLD] = 4,   [RS_INSN_NEW] = 4, [RS_EXIT] = 4,
+	[RS_DIFF_WORDS] = 4, [RS_VICTIM] = 4,	[RS_METHOD] = 4,
+	[RS_BIT] = 1,	     [RS_SIGNAL] = 1,
+};
+
+static const uint8_t zero_pad[8];
+
+struct rs_writer {
+	int fd;
+	uint32_t nrows;
+	uint8_t *cols[RS_NCOLS];
+
+	// block-local dictionary, rebuilt for every block
+	uint32_t slots[DICT_SLOTS]; // id + 1, 0 when empty
+	uint32_t ndict;
+	uint32_t dict_off[2 * RS_BLOCK_ROWS + 1];
+	char *dict_str;
+	size_t dict_len, dict_cap;
+};
+
+struct rs_writer *rs_writer_open(const char *path)
+{
+	struct rs_writer *w = calloc(1, sizeof(*w));
+
+	if (!w)
+		return NULL;
+
+	w->fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+	if (w->fd < 0) {
+		perror("Failed to open result store");
+		free(w);
+		return NULL;
+	}
+
+	for (int c = 0; c < RS_NCOLS; c++) {
+		w->cols[c] = malloc((size_t)RS_BLOCK_ROWS * rs_width[c]);
+		if (!w->cols[c]) {
+			rs_writer_close(w);
+			return NULL;
+		}
+	}
+
+	return w;
+}
+
+static uint32_t str_hash(const char *s)
+{
+	uint32_t h = 2166136261u;
+
+	while (*s)
+		h = (h ^ (uint8_t)*s++) * 16777619u;
+	return h;
+}
+
+static int dict_intern(struct rs_writer *w, const char *s, uint32_t *id)
+{
+	size_t len;
+
+	if (!s)
+		s = "";
+
+	for (uint32_t i = str_hash(s);; i++) {
+		uint32_t *slot = &w->slots[i & (DICT_SLOTS - 1)];
+
+		if (!*slot) {
+			len = strlen(s) + 1;
+			if (w->dict_len + len > w->dict_cap) {
+				size_t cap = w->dict_cap ? w->dict_cap : 4096;
+				char *str;
+
+				while (cap < w->dict_len + len)
+					cap *= 2;
+				str = realloc(w->dict_str, cap);
+				if (!str)
+					return -1;
+				w->dict_str = str;
+				w->dict_cap = cap;
+			}
+			memcpy(w->dict_str + w->dict_len, s, len);
+			w->dict_off[w->ndict] = w->dict_len;
+			w->dict_len += len;
+			*slot = ++w->ndict;
+			*id = *slot - 1;
+			return 0;
+		}
+		if (strcmp(w->dict_str + w->dict_off[*slot - 1], s) == 0) {
+			*id = *slot - 1;
+			return 0;
+		}
+	}
+}
+
+#define COL(w, c, type) ((type *)(w)->cols[c])
+
+int rs_append(struct rs_writer *w, const struct rs_row *row)
+{
+	uint32_t n = w->nrows, victim, method;
+
+	if (dict_intern(w, row->victim, &victim) ||
+	    dict_intern(w, row->method, &method))
+		return -1;
+
+	COL(w, RS_ADDR, uint64_t)[n] = row->addr;
+	COL(w, RS_RUNTIME, uint64_t)[n] = row->runtime_ns;
+	COL(w, RS_DIFF_ADDR, uint64_t)[n] = row->diff_addr;
+	COL(w, RS_INSN_OLD, uint32_t)[n] = row->insn_old;
+	COL(w, RS_INSN_NEW, uint32_t)[n] = row->insn_new;
+	COL(w, RS_EXIT, int32_t)[n] = row->exit_status;
+	COL(w, RS_DIFF_WORDS, uint32_t)[n] = row->diff_words;
+	COL(w, RS_VICTIM, uint32_t)[n] = victim;
+	COL(w, RS_METHOD, uint32_t)[n] = method;
+	COL(w, RS_BIT, uint8_t)[n] = row->bit;
+	COL(w, RS_SIGNAL, uint8_t)[n] = row->signal;
+
+	if (++w->nrows == RS_BLOCK_ROWS)
+		return rs_flush(w);
+	return 0;
+}
+
+// Queue `len` bytes and the padding up to the next multiple of 8.
+static size_t add_iov(struct iovec *iov, int *n, const void *base, size_t len)
+{
+	iov[*n].iov_base = (void *)base;
+	iov[*n].iov_len = len;
+	(*n)++;
+	if (PAD8(len) != len) {
+		iov[*n].iov_base = (void *)zero_pad;
+		iov[*n].iov_len = PAD8(len) - len;
+		(*n)++;
+	}
+	return PAD8(len);
+}
+
+int rs_flush(struct rs_writer *w)
+{
+	struct iovec iov[2 * (RS_NCOLS + 3)];
+	struct rs_block_hdr hdr = {
+		.magic = RS_MAGIC,
+		.version = RS_VERSION,
+		.ncols = RS_NCOLS,
+		.nrows = w->nrows,
+		.ndict = w->ndict,
+	};
+	size_t size;
+	ssize_t ret;
+	int n = 0;
+
+	if (!w->nrows)
+		return 0;
+
+	w->dict_off[w->ndict] = w->dict_len;
+	size = add_iov(iov, &n, &hdr, sizeof(hdr));
+	for (int c = 0; c < RS_NCOLS; c++)
+		size += add_iov(iov, &n, w->cols[c],
+				(size_t)w->nrows * rs_width[c]);
+	size += add_iov(iov, &n, w->dict_off,
+			(w->ndict + 1) * sizeof(w->dict_off[0]));
+	size += add_iov(iov, &n, w->dict_str, w->dict_len);
+	hdr.size = size;
+
+	// A regular-file write holds the inode lock, so with O_APPEND the
+	// whole block lands contiguously even with other writers on the file.
+	ret = writev(w->fd, iov, n);
+
+	w->nrows = 0;
+	w->ndict = 0;
+	w->dict_len = 0;
+	memset(w->slots, 0, sizeof(w->slots));
+
+	if (ret != (ssize_t)size) {
+		perror("Failed to append result block");
+		return -1;
+	}
+	return 0;
+}
+
+int rs_writer_close(struct rs_writer *w)
+{
+	int ret = 0;
+
+	if (!w)
+		return 0;
+
+	if (w->fd >= 0) {
+		ret = rs_flush(w);
+		close(w->fd);
+	}
+	for (int c = 0; c < RS_NCOLS; c++)
+		free(w->cols[c]);
+	free(w->dict_str);
+	free(w);
+	return ret;
+}
+
+int rs_open(const char *path, struct rs_file *f)
+{
+	struct stat st;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0) {
+		perror("Failed to open result store");
+		return -1;
+	}
+	if (fstat(fd, &st) < 0) {
+		perror("fstat");
+		close(fd);
+		return -1;
+	}
+
+	f->size = st.st_size;
+	f->base = NULL;
+	if (f->size) {
+		f->base = mmap(NULL, f->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (f->base == MAP_FAILED) {
+			perror("mmap result store");
+			close(fd);
+			return -1;
+		}
+		madvise((void *)f->base, f->size, MADV_SEQUENTIAL);
+	}
+	close(fd);
+
+	return 0;
+}
+
+void rs_close(struct rs_file *f)
+{
+	if (f->base)
+		munmap((void *)f->base, f->size);
+	f->base = NULL;
+	f->size = 0;
+}
+
+int rs_next_block(const struct rs_file *f, size_t *pos, struct rs_block *b)
+{
+	const struct rs_block_hdr *hdr;
+	size_t off, end;
+
+	if (*pos + sizeof(*hdr) > f->size)
+		return 0;
+
+	hdr = (const struct rs_block_hdr *)(f->base + *pos);
+	if (hdr->magic != RS_MAGIC || hdr->version != RS_VERSION ||
+	    hdr->ncols != RS_NCOLS || hdr->nrows > RS_BLOCK_ROWS ||
+	    hdr->size & 7) {
+		fprintf(stderr, "result store: bad block at %zu\n", *pos);
+		return 0;
+	}
+	if (hdr->size > f->size - *pos)
+		return 0; // truncated by a writer that died mid-append
+
+	end = *pos + hdr->size;
+	off = *pos + PAD8(sizeof(*hdr));
+	b->nrows = hdr->nrows;
+	for (int c = 0; c < RS_NCOLS; c++) {
+		b->cols[c] = f->base + off;
+		off += PAD8((size_t)hdr->nrows * rs_width[c]);
+	}
+	b->ndict = hdr->ndict;
+	b->dict_off = (const uint32_t *)(f->base + off);
+	off += PAD8(((size_t)hdr->ndict + 1) * sizeof(uint32_t));
+	b->dict_str = (const char *)(f->base + off);
+	if (off > end || b->dict_off[hdr->ndict] > end - off) {
+		fprintf(stderr, "result store: bad block at %zu\n", *pos);
+		return 0;
+	}
+
+	*pos = end;
+	return 1;
+}
@@ -0,0 +1,96 @@
+#ifndef RESULTS_H
+#define RESULTS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Append-only columnar store for campaign results.
+ *
+ * A file is a sequence of self-contained blocks. Each block holds up to
+ * RS_BLOCK_ROWS rows as one fixed-width array per column, followed by the
+ * block's string dictionary; string columns store indices into it. A
+ * writer buffers rows and appends a whole block with a single writev() on
+ * an O_APPEND descriptor, so any number of writers (one per thread or per
+ * process) can share a file without locking and without interleaving.
+ */
+
+#define RS_MAGIC 0x31535246 // "FRS1"
+#define RS_VERSION 1
+#define RS_BLOCK_ROWS 4096
+
+enum rs_col {
+	RS_ADDR, // u64, flipped address
+	RS_RUNTIME, // u64, victim runtime in ns
+	RS_DIFF_ADDR, // u64, first changed word, 0 if none
+	RS_INSN_OLD, // u32, instruction before the flip
+	RS_INSN_NEW, // u32, instruction after the flip
+	RS_EXIT, // s32, exit code, -1 if killed
+	RS_DIFF_WORDS, // u32, words changed in the victim's segments
+	RS_VICTIM, // u32, dictionary index
+	RS_METHOD, // u32, dictionary index
+	RS_BIT, // u8, flipped bit
+	RS_SIGNAL, // u8, terminating signal, 0 if exited
+	RS_NCOLS,
+};
+
+struct rs_row {
+	uint64_t addr;
+	uint64_t runtime_ns;
+	uint64_t diff_addr;
+	uint32_t insn_old;
+	uint32_t insn_new;
+	int32_t exit_status;
+	uint32_t diff_words;
+	const char *victim;
+	const char *method;
+	uint8_t bit;
+	uint8_t signal;
+};
+
+struct rs_block_hdr {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t ncols;
+	uint32_t nrows;
+	uint32_t ndict;
+	uint64_t size; // whole block including this header, multiple of 8
+};
+
+struct rs_writer;
+
+struct rs_writer *rs_writer_open(const char *path);
+int rs_append(struct rs_writer *w, const struct rs_row *row);
+int rs_flush(struct rs_writer *w);
+// Flushes the pending rows; returns -1 if that failed.
+int rs_writer_close(struct rs_writer *w);
+
+/*
+ * Read side. The file is mapped and every column of a block is a plain
+ * array into the mapping, so queries are tight loops over the columns they
+ * need. A truncated trailing block (a writer died mid-append) ends the scan.
+ */
+struct rs_file {
+	const uint8_t *base;
+	size_t size;
+};
+
+struct rs_block {
+	uint32_t nrows;
+	const void *cols[RS_NCOLS];
+	uint32_t ndict;
+	const uint32_t *dict_off; // ndict + 1 offsets into dict_str
+	const char *dict_str;
+};
+
+int rs_open(const char *path, struct rs_file *f);
+void rs_close(struct rs_file *f);
+// Decode the block at *pos and advance *pos; returns 0 at the end.
+int rs_next_block(const struct rs_file *f, size_t *pos, struct rs_block *b);
+
+static inline const char *rs_str(const struct rs_block *b, uint32_t id)
+{
+	return id < b->ndict ? b->dict_str + b->dict_off[id] : "";
+}
+
+#endif
@@ -0,0 +1,188 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "buddy.h"
+
+int zone_init(struct zone *z, uint32_t npages, unsigned ncpus,
+	      unsigned batch, unsigned high)
+{
+	memset(z, 0, sizeof(*z));
+	if (!npages || !ncpus || !batch || high < batch)
+		return -1;
+
+	z->npages = npages;
+	z->ncpus = ncpus;
+	z->batch = batch;
+	z->high = high;
+	z->free_order = malloc(npages);
+	z->next = malloc(npages * sizeof(*z->next));
+	z->prev = malloc(npages * sizeof(*z->prev));
+	z->pcp = calloc(ncpus, sizeof(*z->pcp));
+	if (!z->free_order || !z->next || !z->prev || !z->pcp) {
+		zone_free(z);
+		return -1;
+	}
+
+	for (unsigned c = 0; c < ncpus; c++) {
+		// one free can push the list to high + 1 before it drains
+		z->pcp[c].cap = high + batch + 1;
+		z->pcp[c].pages = malloc(z->pcp[c].cap * sizeof(uint32_t));
+		if (!z->pcp[c].pages) {
+			zone_free(z);
+			return -1;
+		}
+	}
+
+	zone_reset(z);
+	return 0;
+}
+
+void zone_free(struct zone *z)
+{
+	if (z->pcp) {
+		for (unsigned c = 0; c < z->ncpus; c++)
+			free(z->pcp[c].pages);
+	}
+	free(z->pcp);
+	free(z->free_order);
+	free(z->next);
+	free(z->prev);
+	memset(z, 0, sizeof(*z));
+}
+
+static void list_add(struct zone *z, uint32_t pfn, unsigned order)
+{
+	uint32_t old = z->head[order];
+
+	z->free_order[pfn] = order;
+	z->prev[pfn] = BUDDY_NIL;
+	z->next[pfn] = old;
+	if (old != BUDDY_NIL)
+		z->prev[old] = pfn;
+	z->head[order] = pfn;
+	z->nr_free[order]++;
+}
+
+static void list_add_tail(struct zone *z, uint32_t pfn, unsigned order,
+			  uint32_t *tail)
+{
+	z->free_order[pfn] = order;
+	z->next[pfn] = BUDDY_NIL;
+	z->prev[pfn] = *tail;
+	if (*tail != BUDDY_NIL)
+		z->next[*tail] = pfn;
+	else
+		z->head[order] = pfn;
+	*tail = pfn;
+	z->nr_free[order]++;
+}
+
+static void list_del(struct zone *z, uint32_t pfn, unsigned order)
+{
+	if (z->prev[pfn] != BUDDY_NIL)
+		z->next[z->prev[pfn]] = z->next[pfn];
+	else
+		z->head[order] = z->next[pfn];
+	if (z->next[pfn] != BUDDY_NIL)
+		z->prev[z->next[pfn]] = z->prev[pfn];
+	z->free_order[pfn] = -1;
+	z->nr_free[order]--;
+}
+
+void zone_reset(struct zone *z)
+{
+	uint32_t tail[BUDDY_MAX_ORDER + 1];
+	uint32_t pfn = 0;
+
+	memset(z->free_order, -1, z->npages);
+	for (int o = 0; o <= BUDDY_MAX_ORDER; o++) {
+		z->head[o] = tail[o] = BUDDY_NIL;
+		z->nr_free[o] = 0;
+	}
+	for (unsigned c = 0; c < z->ncpus; c++)
+		z->pcp[c].first = z->pcp[c].count = 0;
+
+	// boot hands memory over in address order, largest aligned blocks
+	while (pfn < z->npages) {
+		int o = BUDDY_MAX_ORDER;
+
+		while ((pfn & ((1u << o) - 1)) || pfn + (1u << o) > z->npages)
+			o--;
+		list_add_tail(z, pfn, o, &tail[o]);
+		pfn += 1u << o;
+	}
+}
+
+uint32_t zone_alloc(struct zone *z, unsigned order)
+{
+	unsigned o = order;
+	uint32_t pfn;
+
+	while (o <= BUDDY_MAX_ORDER && z->head[o] == BUDDY_NIL)
+		o++;
+	if (o > BUDDY_MAX_ORDER)
+		return BUDDY_NIL;
+
+	pfn = z->head[o];
+	list_del(z, pfn, o);
+	while (o > order) {
+		o--;
+		list_add(z, pfn + (1u << o), o);
+	}
+	return pfn;
+}
+
+void zone_release(struct zone *z, uint32_t pfn, unsigned order)
+{
+	while (order < BUDDY_MAX_ORDER) {
+		uint32_t buddy = pfn ^ (1u << order);
+
+		if (buddy >= z->npages || z->free_order[buddy] != (int)order)
+			break;
+		list_del(z, buddy, order);
+		pfn &= buddy;
+		order++;
+	}
+	list_add(z, pfn, order);
+}
+
+uint32_t zone_alloc_page(struct zone *z, unsigned cpu)
+{
+	struct pcp_list *l = &z->pcp[cpu];
+	uint32_t pfn;
+
+	if (!l->count) {
+		// rmqueue_bulk: the first page taken ends up at the head
+		for (unsigned i = 0; i < z->batch; i++) {
+			pfn = zone_alloc(z, 0);
+			if (pfn == BUDDY_NIL)
+				break;
+			l->pages[(l->first + l->count++) % l->cap] = pfn;
+		}
+		if (!l->count)
+			return BUDDY_NIL;
+	}
+
+	pfn = l->pages[l->first];
+	l->first = (l->first + 1) % l->cap;
+	l->count--;
+	return pfn;
+}
+
+void zone_free_page(struct zone *z, unsigned cpu, uint32_t pfn)
+{
+	struct pcp_list *l = &z->pcp[cpu];
+
+	l->first = (l->first + l->cap - 1) % l->cap;
+	l->pages[l->first] = pfn;
+	l->count++;
+
+	if (l->count <= z->high)
+		return;
+
+	// free_pcppages_bulk drains the coldest pages from the tail
+	for (unsigned i = 0; i < z->batch && l->count; i++) {
+		l->count--;
+		zone_release(z, l->pages[(l->first + l->count) % l->cap], 0);
+	}
+}
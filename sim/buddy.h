@@ -0,0 +1,59 @@
+#ifndef BUDDY_H
+#define BUDDY_H
+
+#include <stdint.h>
+
+/*
+ * One zone of the Linux page allocator: buddy free lists up to order
+ * BUDDY_MAX_ORDER plus a per-CPU list of order-0 pages for every CPU.
+ *
+ * The model follows mm/page_alloc.c where it decides placement:
+ *  - splitting hands out the lowest-addressed part of a block and puts the
+ *    upper halves on the free lists;
+ *  - a freed block merges with free buddies and goes to the list head;
+ *  - order-0 allocations come from the head of the CPU's list, which is
+ *    refilled with `batch` pages in address order when empty;
+ *  - order-0 frees go to the head of the CPU's list, and once it holds more
+ *    than `high` pages, `batch` pages from its tail go back to the buddy.
+ * Migrate types, watermarks and the to-tail heuristic are not modelled.
+ */
+
+#define BUDDY_MAX_ORDER 10
+#define BUDDY_NIL UINT32_MAX
+
+struct pcp_list {
+	uint32_t *pages; // ring, head at `first`
+	unsigned first;
+	unsigned count;
+	unsigned cap;
+};
+
+struct zone {
+	uint32_t npages;
+	unsigned ncpus;
+	unsigned batch;
+	unsigned high;
+
+	int8_t *free_order; // order of the free block starting here, or -1
+	uint32_t *next; // free list links, valid for free block heads
+	uint32_t *prev;
+	uint32_t head[BUDDY_MAX_ORDER + 1];
+	uint32_t nr_free[BUDDY_MAX_ORDER + 1];
+
+	struct pcp_list *pcp;
+};
+
+int zone_init(struct zone *z, uint32_t npages, unsigned ncpus,
+	      unsigned batch, unsigned high);
+void zone_free(struct zone *z);
+// Put every page back on the buddy lists as maximal blocks.
+void zone_reset(struct zone *z);
+
+// Returns the first PFN of the block, or BUDDY_NIL when out of memory.
+uint32_t zone_alloc(struct zone *z, unsigned order);
+void zone_release(struct zone *z, uint32_t pfn, unsigned order);
+
+uint32_t zone_alloc_page(struct zone *z, unsigned cpu);
+void zone_free_page(struct zone *z, unsigned cpu, uint32_t pfn);
+
+#endif
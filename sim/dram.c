@@ -0,0 +1,384 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "dram.h"
+#include "timewheel.h"
+
+#define EVENT_CHUNK 4096
+
+enum {
+	EV_ACT,
+	EV_REF,
+	EV_MITIGATE,
+};
+
+struct dram_event {
+	struct tw_event tw; // must stay first
+	unsigned rank;
+	unsigned bank;
+	unsigned row;
+	int queued;
+	struct dram_event *free_next; // also links the per-bank wait queue
+};
+
+struct ref_group {
+	struct tw_event tw; // must stay first
+	unsigned rank;
+	unsigned group;
+};
+
+struct row_state {
+	uint32_t disturb; // neighbour ACTs since the last refresh
+	uint32_t acts; // own ACTs since the last refresh or TRR
+};
+
+// ACTs held back by tRC/tFAW wait in FIFO order behind the bank's head, so
+// only one of them sits on the wheel at a time.
+struct bank_state {
+	uint64_t next_act;
+	struct dram_event *wait_head;
+	struct dram_event *wait_tail;
+};
+
+struct rank_state {
+	uint64_t faw[4];
+	unsigned faw_pos;
+	unsigned faw_count;
+};
+
+struct event_chunk {
+	struct event_chunk *next;
+	struct dram_event events[EVENT_CHUNK];
+};
+
+struct dram_sim {
+	struct dram_config cfg;
+	dram_flip_cb cb;
+	void *ctx;
+
+	struct timewheel wheel;
+	struct dram_stats stats;
+
+	unsigned n_groups; // REF commands per refresh window
+	unsigned rows_per_group;
+
+	struct row_state *rows; // [rank][bank][row]
+	struct bank_state *banks; // [rank][bank]
+	struct rank_state *ranks;
+	struct ref_group *groups; // [rank][group]
+
+	struct dram_event *free_events;
+	struct event_chunk *chunks;
+};
+
+void dram_default_config(struct dram_config *cfg)
+{
+	// DDR4-2400-ish single rank
+	cfg->ranks = 1;
+	cfg->banks = 16;
+	cfg->rows = 65536;
+	cfg->blast_radius = 1;
+	cfg->hc_first = 10000;
+	cfg->trr_threshold = 0;
+	cfg->trr_delay = 0;
+	cfg->timing.tRC = 46;
+	cfg->timing.tFAW = 21;
+	cfg->timing.tREFI = 7800;
+	cfg->timing.tREFW = 64000000;
+}
+
+struct dram_sim *dram_create(const struct dram_config *cfg, dram_flip_cb cb,
+			     void *ctx)
+{
+	struct dram_sim *sim;
+	size_t n_rows = (size_t)cfg->ranks * cfg->banks * cfg->rows;
+
+	if (!cfg->ranks || !cfg->banks || !cfg->rows || !cfg->timing.tREFI ||
+	    cfg->timing.tREFW < cfg->timing.tREFI)
+		return NULL;
+
+	sim = calloc(1, sizeof(*sim));
+	if (!sim)
+		return NULL;
+
+	sim->cfg = *cfg;
+	sim->cb = cb;
+	sim->ctx = ctx;
+	sim->n_groups = cfg->timing.tREFW / cfg->timing.tREFI;
+	sim->rows_per_group =
+		(cfg->rows + sim->n_groups - 1) / sim->n_groups;
+	tw_init(&sim->wheel, 0);
+
+	sim->rows = calloc(n_rows, sizeof(*sim->rows));
+	sim->banks = calloc((size_t)cfg->ranks * cfg->banks,
+			    sizeof(*sim->banks));
+	sim->ranks = calloc(cfg->ranks, sizeof(*sim->ranks));
+	sim->groups = calloc((size_t)cfg->ranks * sim->n_groups,
+			     sizeof(*sim->groups));
+	if (!sim->rows || !sim->banks || !sim->ranks || !sim->groups) {
+		dram_destroy(sim);
+		return NULL;
+	}
+
+	for (unsigned r = 0; r < cfg->ranks; r++) {
+		for (unsigned g = 0; g < sim->n_groups; g++) {
+			struct ref_group *grp =
+				&sim->groups[(size_t)r * sim->n_groups + g];
+
+			grp->tw.type = EV_REF;
+			grp->rank = r;
+			grp->group = g;
+		}
+	}
+
+	return sim;
+}
+
+void dram_destroy(struct dram_sim *sim)
+{
+	if (!sim)
+		return;
+
+	while (sim->chunks) {
+		struct event_chunk *next = sim->chunks->next;
+
+		free(sim->chunks);
+		sim->chunks = next;
+	}
+	free(sim->rows);
+	free(sim->banks);
+	free(sim->ranks);
+	free(sim->groups);
+	free(sim);
+}
+
+static struct dram_event *event_alloc(struct dram_sim *sim)
+{
+	struct dram_event *ev;
+
+	if (!sim->free_events) {
+		struct event_chunk *chunk = calloc(1, sizeof(*chunk));
+
+		if (!chunk)
+			return NULL;
+		chunk->next = sim->chunks;
+		sim->chunks = chunk;
+		for (int i = 0; i < EVENT_CHUNK; i++) {
+			chunk->events[i].free_next = sim->free_events;
+			sim->free_events = &chunk->events[i];
+		}
+	}
+
+	ev = sim->free_events;
+	sim->free_events = ev->free_next;
+	memset(&ev->tw, 0, sizeof(ev->tw));
+	ev->queued = 0;
+	return ev;
+}
+
+static void event_free(struct dram_sim *sim, struct dram_event *ev)
+{
+	ev->free_next = sim->free_events;
+	sim->free_events = ev;
+}
+
+static struct row_state *row_at(struct dram_sim *sim, unsigned rank,
+				unsigned bank, unsigned row)
+{
+	size_t idx = ((size_t)rank * sim->cfg.banks + bank) * sim->cfg.rows;
+
+	return &sim->rows[idx + row];
+}
+
+// REF commands are only put on the wheel for row groups that hold a non-zero
+// counter, so idle periods cost nothing and the wheel skips straight over
+// them.
+static void mark_dirty(struct dram_sim *sim, unsigned rank, unsigned row)
+{
+	const struct dram_timing *t = &sim->cfg.timing;
+	unsigned g = row / sim->rows_per_group;
+	struct ref_group *grp = &sim->groups[(size_t)rank * sim->n_groups + g];
+	uint64_t now = sim->wheel.now;
+	uint64_t when;
+
+	if (grp->tw.pending)
+		return;
+
+	when = now - now % t->tREFW + (uint64_t)g * t->tREFI;
+	if (when <= now)
+		when += t->tREFW;
+	tw_schedule(&sim->wheel, &grp->tw, when);
+}
+
+static void disturb(struct dram_sim *sim, unsigned rank, unsigned bank,
+		    unsigned row, unsigned aggressor)
+{
+	struct row_state *rs = row_at(sim, rank, bank, row);
+
+	if (rs->disturb++ == 0)
+		mark_dirty(sim, rank, row);
+
+	if (rs->disturb == sim->cfg.hc_first) {
+		struct dram_flip flip = {
+			.time = sim->wheel.now,
+			.rank = rank,
+			.bank = bank,
+			.row = row,
+			.aggressor = aggressor,
+		};
+
+		sim->stats.flips++;
+		if (sim->cb)
+			sim->cb(sim->ctx, &flip);
+	}
+}
+
+static void do_act(struct dram_sim *sim, struct dram_event *ev)
+{
+	const struct dram_config *cfg = &sim->cfg;
+	struct bank_state *bs = &sim->banks[ev->rank * cfg->banks + ev->bank];
+	struct rank_state *rk = &sim->ranks[ev->rank];
+	struct row_state *rs;
+	uint64_t now = sim->wheel.now;
+	uint64_t earliest = bs->next_act;
+
+	if (!ev->queued && bs->wait_head) {
+		ev->queued = 1;
+		ev->free_next = NULL;
+		bs->wait_tail->free_next = ev;
+		bs->wait_tail = ev;
+		sim->stats.delayed++;
+		return;
+	}
+
+	if (rk->faw_count == 4 && rk->faw[rk->faw_pos] + cfg->timing.tFAW >
+					  earliest)
+		earliest = rk->faw[rk->faw_pos] + cfg->timing.tFAW;
+
+	if (earliest > now) {
+		if (!ev->queued) {
+			ev->queued = 1;
+			ev->free_next = NULL;
+			bs->wait_head = bs->wait_tail = ev;
+			sim->stats.delayed++;
+		}
+		tw_schedule(&sim->wheel, &ev->tw, earliest);
+		return;
+	}
+
+	if (ev->queued) {
+		bs->wait_head = ev->free_next;
+		if (bs->wait_head)
+			tw_schedule(&sim->wheel, &bs->wait_head->tw,
+				    now + cfg->timing.tRC);
+		else
+			bs->wait_tail = NULL;
+	}
+
+	bs->next_act = now + cfg->timing.tRC;
+	rk->faw[rk->faw_pos] = now;
+	rk->faw_pos = (rk->faw_pos + 1) & 3;
+	if (rk->faw_count < 4)
+		rk->faw_count++;
+	sim->stats.acts++;
+
+	for (unsigned d = 1; d <= cfg->blast_radius; d++) {
+		if (ev->row >= d)
+			disturb(sim, ev->rank, ev->bank, ev->row - d, ev->row);
+		if (ev->row + d < cfg->rows)
+			disturb(sim, ev->rank, ev->bank, ev->row + d, ev->row);
+	}
+
+	rs = row_at(sim, ev->rank, ev->bank, ev->row);
+	if (rs->acts++ == 0)
+		mark_dirty(sim, ev->rank, ev->row);
+
+	if (cfg->trr_threshold && rs->acts == cfg->trr_threshold) {
+		rs->acts = 0;
+		ev->tw.type = EV_MITIGATE;
+		tw_schedule(&sim->wheel, &ev->tw, now + cfg->trr_delay);
+		return;
+	}
+
+	event_free(sim, ev);
+}
+
+static void do_ref(struct dram_sim *sim, struct ref_group *grp)
+{
+	const struct dram_config *cfg = &sim->cfg;
+	unsigned first = grp->group * sim->rows_per_group;
+	unsigned last = first + sim->rows_per_group;
+
+	if (last > cfg->rows)
+		last = cfg->rows;
+
+	for (unsigned b = 0; b < cfg->banks; b++) {
+		struct row_state *rs = row_at(sim, grp->rank, b, 0);
+
+		memset(&rs[first], 0, (last - first) * sizeof(*rs));
+	}
+	sim->stats.refs++;
+}
+
+static void do_mitigate(struct dram_sim *sim, struct dram_event *ev)
+{
+	const struct dram_config *cfg = &sim->cfg;
+
+	for (unsigned d = 1; d <= cfg->blast_radius; d++) {
+		if (ev->row >= d)
+			row_at(sim, ev->rank, ev->bank, ev->row - d)->disturb =
+				0;
+		if (ev->row + d < cfg->rows)
+			row_at(sim, ev->rank, ev->bank, ev->row + d)->disturb =
+				0;
+	}
+	sim->stats.mitigations++;
+	event_free(sim, ev);
+}
+
+int dram_activate(struct dram_sim *sim, uint64_t time, unsigned rank,
+		  unsigned bank, unsigned row)
+{
+	struct dram_event *ev;
+
+	if (rank >= sim->cfg.ranks || bank >= sim->cfg.banks ||
+	    row >= sim->cfg.rows)
+		return -1;
+
+	ev = event_alloc(sim);
+	if (!ev)
+		return -1;
+
+	ev->tw.type = EV_ACT;
+	ev->rank = rank;
+	ev->bank = bank;
+	ev->row = row;
+	tw_schedule(&sim->wheel, &ev->tw, time);
+	return 0;
+}
+
+uint64_t dram_run(struct dram_sim *sim, uint64_t until)
+{
+	struct tw_event *tw;
+
+	while ((tw = tw_next(&sim->wheel, until))) {
+		switch (tw->type) {
+		case EV_ACT:
+			do_act(sim, (struct dram_event *)tw);
+			break;
+		case EV_REF:
+			do_ref(sim, (struct ref_group *)tw);
+			break;
+		case EV_MITIGATE:
+			do_mitigate(sim, (struct dram_event *)tw);
+			break;
+		}
+	}
+
+	return sim->wheel.now;
+}
+
+const struct dram_stats *dram_get_stats(const struct dram_sim *sim)
+{
+	return &sim->stats;
+}
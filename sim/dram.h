@@ -0,0 +1,62 @@
+#ifndef DRAM_H
+#define DRAM_H
+
+#include <stdint.h>
+
+// All times are in simulated nanoseconds.
+struct dram_timing {
+	uint64_t tRC; // ACT to ACT, same bank
+	uint64_t tFAW; // window holding at most four ACTs, same rank
+	uint64_t tREFI; // interval between REF commands
+	uint64_t tREFW; // refresh window, every row is refreshed once
+};
+
+struct dram_config {
+	unsigned ranks;
+	unsigned banks; // per rank
+	unsigned rows; // per bank
+	unsigned blast_radius; // rows on each side disturbed by an ACT
+	unsigned hc_first; // neighbour ACTs within a window before a flip
+	unsigned trr_threshold; // ACTs before TRR refreshes neighbours, 0: off
+	uint64_t trr_delay; // latency of the TRR refresh
+	struct dram_timing timing;
+};
+
+struct dram_flip {
+	uint64_t time;
+	unsigned rank;
+	unsigned bank;
+	unsigned row;
+	unsigned aggressor;
+};
+
+struct dram_stats {
+	uint64_t acts;
+	uint64_t delayed; // ACTs pushed back by tRC/tFAW
+	uint64_t refs; // REF commands that reset at least one counter
+	uint64_t mitigations;
+	uint64_t flips;
+};
+
+typedef void (*dram_flip_cb)(void *ctx, const struct dram_flip *flip);
+
+struct dram_sim;
+
+void dram_default_config(struct dram_config *cfg);
+
+struct dram_sim *dram_create(const struct dram_config *cfg, dram_flip_cb cb,
+			     void *ctx);
+void dram_destroy(struct dram_sim *sim);
+
+// Queue an activation request arriving at `time`. The request is issued no
+// earlier than tRC/tFAW allow. Returns -1 on a bad address or allocation
+// failure.
+int dram_activate(struct dram_sim *sim, uint64_t time, unsigned rank,
+		  unsigned bank, unsigned row);
+
+// Process every event due at or before `until` and return the new time.
+uint64_t dram_run(struct dram_sim *sim, uint64_t until);
+
+const struct dram_stats *dram_get_stats(const struct dram_sim *sim);
+
+#endif
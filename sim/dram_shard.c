@@ -0,0 +1,378 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dram_shard.h"
+#include "spsc.h"
+
+#define CMD_SLOTS 4096
+#define FLIP_SLOTS 1024
+// Forward the time to idle shards every so many runs, so the merge stage
+// can release their neighbours' flips without waiting for the end.
+#define TICK_RUNS 4096
+
+enum {
+	CMD_ACT,
+	CMD_RUN,
+	CMD_STOP,
+};
+
+struct shard_cmd {
+	uint64_t time;
+	unsigned type;
+	unsigned rank; // shard-local
+	unsigned bank;
+	unsigned row;
+};
+
+struct shard {
+	unsigned index;
+	unsigned first_rank;
+	pthread_t thread;
+	struct dram_sim *sim;
+	int failed;
+
+	struct spsc cmds; // demux -> shard
+	struct spsc flips; // shard -> merge
+
+	// Every flip up to this time has been pushed to `flips`; later ones
+	// can be no earlier. UINT64_MAX once the shard has stopped.
+	uint64_t progress;
+
+	uint64_t sent; // demux: latest run forwarded
+
+	// merge: flips taken off the ring, not yet delivered
+	struct dram_flip *held;
+	size_t nheld, first, cap;
+};
+
+struct dram_shards {
+	struct dram_config cfg;
+	unsigned nshards;
+	unsigned per_shard; // ranks
+	dram_flip_cb cb;
+	void *ctx;
+
+	uint64_t until;
+	unsigned long runs;
+	int finished;
+
+	struct shard *shards;
+	pthread_t merger;
+};
+
+static void push_wait(struct spsc *q, const void *e)
+{
+	unsigned spins = 0;
+
+	while (!spsc_push(q, e))
+		spsc_backoff(&spins);
+}
+
+static void shard_flip(void *ctx, const struct dram_flip *flip)
+{
+	struct shard *sh = ctx;
+	struct dram_flip f = *flip;
+
+	f.rank += sh->first_rank;
+	push_wait(&sh->flips, &f);
+}
+
+static void *shard_main(void *arg)
+{
+	struct shard *sh = arg;
+	struct shard_cmd cmd;
+	unsigned spins = 0;
+
+	for (;;) {
+		if (!spsc_pop(&sh->cmds, &cmd)) {
+			spsc_backoff(&spins);
+			continue;
+		}
+		spins = 0;
+
+		switch (cmd.type) {
+		case CMD_ACT:
+			if (dram_activate(sh->sim, cmd.time, cmd.rank, cmd.bank,
+					  cmd.row))
+				sh->failed = 1;
+			break;
+		case CMD_RUN:
+			dram_run(sh->sim, cmd.time);
+			__atomic_store_n(&sh->progress, cmd.time,
+					 __ATOMIC_RELEASE);
+			break;
+		case CMD_STOP:
+			__atomic_store_n(&sh->progress, UINT64_MAX,
+					 __ATOMIC_RELEASE);
+			return NULL;
+		}
+	}
+}
+
+static int hold(struct shard *sh, const struct dram_flip *flip)
+{
+	if (sh->nheld == sh->cap) {
+		size_t cap = sh->cap ? 2 * sh->cap : 64;
+		struct dram_flip *held = malloc(cap * sizeof(*held));
+
+		if (!held)
+			return -1;
+		for (size_t i = 0; i < sh->nheld; i++)
+			held[i] = sh->held[(sh->first + i) % sh->cap];
+		free(sh->held);
+		sh->held = held;
+		sh->first = 0;
+		sh->cap = cap;
+	}
+	sh->held[(sh->first + sh->nheld++) % sh->cap] = *flip;
+	return 0;
+}
+
+/*
+ * k-way merge over the shards' flip streams, each already in time order.
+ * The earliest held flip (t, s) may go out once no shard can still produce
+ * an earlier one: a shard q holding nothing is only safe if its progress p
+ * orders after the flip, i.e. p > t, or p == t and q > s.
+ */
+static void *merge_main(void *arg)
+{
+	struct dram_shards *s = arg;
+	unsigned n = s->nshards;
+	uint64_t progress[n];
+	unsigned spins = 0;
+
+	for (;;) {
+		int busy = 0, done = 1;
+
+		// read the progress first: everything it covers is on the
+		// ring by then
+		for (unsigned q = 0; q < n; q++) {
+			struct shard *sh = &s->shards[q];
+			struct dram_flip f;
+
+			progress[q] = __atomic_load_n(&sh->progress,
+						      __ATOMIC_ACQUIRE);
+			while (spsc_pop(&sh->flips, &f)) {
+				// the shard may be blocked on a full ring, so
+				// there is no way to push back here
+				if (hold(sh, &f))
+					abort();
+				busy = 1;
+			}
+			if (progress[q] != UINT64_MAX || sh->nheld)
+				done = 0;
+		}
+
+		for (;;) {
+			struct shard *best = NULL;
+			const struct dram_flip *f = NULL;
+			unsigned q;
+
+			for (q = 0; q < n; q++) {
+				struct shard *sh = &s->shards[q];
+
+				if (sh->nheld && (!best ||
+				    sh->held[sh->first].time < f->time)) {
+					best = sh;
+					f = &sh->held[sh->first];
+				}
+			}
+			if (!best)
+				break;
+
+			for (q = 0; q < n; q++) {
+				if (s->shards[q].nheld)
+					continue;
+				if (progress[q] < f->time ||
+				    (progress[q] == f->time && q < best->index))
+					break;
+			}
+			if (q < n)
+				break;
+
+			if (s->cb)
+				s->cb(s->ctx, f);
+			best->first = (best->first + 1) % best->cap;
+			best->nheld--;
+			busy = 1;
+		}
+
+		if (done)
+			return NULL;
+		if (busy)
+			spins = 0;
+		else
+			spsc_backoff(&spins);
+	}
+}
+
+unsigned dram_shards_count(const struct dram_shards *s)
+{
+	return s->nshards;
+}
+
+struct dram_shards *dram_shards_create(const struct dram_config *cfg,
+				       unsigned nshards, dram_flip_cb cb,
+				       void *ctx)
+{
+	struct dram_shards *s;
+
+	if (!cfg->ranks)
+		return NULL;
+	if (nshards < 1)
+		nshards = 1;
+	if (nshards > cfg->ranks)
+		nshards = cfg->ranks;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return NULL;
+	s->cfg = *cfg;
+	s->cb = cb;
+	s->ctx = ctx;
+	s->per_shard = (cfg->ranks + nshards - 1) / nshards;
+	s->nshards = (cfg->ranks + s->per_shard - 1) / s->per_shard;
+	s->shards = calloc(s->nshards, sizeof(*s->shards));
+	if (!s->shards) {
+		free(s);
+		return NULL;
+	}
+
+	for (unsigned i = 0; i < s->nshards; i++) {
+		struct shard *sh = &s->shards[i];
+		struct dram_config sub = *cfg;
+
+		sh->index = i;
+		sh->first_rank = i * s->per_shard;
+		sub.ranks = cfg->ranks - sh->first_rank;
+		if (sub.ranks > s->per_shard)
+			sub.ranks = s->per_shard;
+
+		sh->sim = dram_create(&sub, shard_flip, sh);
+		if (!sh->sim || spsc_init(&sh->cmds, CMD_SLOTS,
+					  sizeof(struct shard_cmd)) ||
+		    spsc_init(&sh->flips, FLIP_SLOTS, sizeof(struct dram_flip)))
+			goto fail;
+	}
+
+	// start the threads only once nothing can fail any more
+	for (unsigned i = 0; i < s->nshards; i++) {
+		if (pthread_create(&s->shards[i].thread, NULL, shard_main,
+				   &s->shards[i]))
+			abort();
+	}
+	if (pthread_create(&s->merger, NULL, merge_main, s))
+		abort();
+	return s;
+
+fail:
+	s->finished = 1;
+	dram_shards_destroy(s);
+	return NULL;
+}
+
+static void shard_send(struct shard *sh, uint64_t time, unsigned type,
+		       unsigned rank, unsigned bank, unsigned row)
+{
+	struct shard_cmd cmd = {
+		.time = time,
+		.type = type,
+		.rank = rank,
+		.bank = bank,
+		.row = row,
+	};
+
+	push_wait(&sh->cmds, &cmd);
+}
+
+// Runs are coalesced: a shard only needs the latest time before its next
+// ACT, since running to t1 and then t2 with nothing queued in between is
+// the same as running to t2.
+static void catch_up(struct dram_shards *s, struct shard *sh)
+{
+	if (sh->sent < s->until) {
+		shard_send(sh, s->until, CMD_RUN, 0, 0, 0);
+		sh->sent = s->until;
+	}
+}
+
+int dram_shards_activate(struct dram_shards *s, uint64_t time, unsigned rank,
+			 unsigned bank, unsigned row)
+{
+	struct shard *sh;
+
+	if (s->finished || rank >= s->cfg.ranks || bank >= s->cfg.banks ||
+	    row >= s->cfg.rows)
+		return -1;
+
+	sh = &s->shards[rank / s->per_shard];
+	catch_up(s, sh);
+	shard_send(sh, time, CMD_ACT, rank - sh->first_rank, bank, row);
+	return 0;
+}
+
+void dram_shards_run(struct dram_shards *s, uint64_t until)
+{
+	if (s->finished || until <= s->until)
+		return;
+
+	s->until = until;
+	if (++s->runs % TICK_RUNS == 0) {
+		for (unsigned i = 0; i < s->nshards; i++)
+			catch_up(s, &s->shards[i]);
+	}
+}
+
+int dram_shards_finish(struct dram_shards *s, struct dram_stats *stats)
+{
+	int ret = 0;
+
+	if (!s->finished) {
+		for (unsigned i = 0; i < s->nshards; i++) {
+			catch_up(s, &s->shards[i]);
+			shard_send(&s->shards[i], 0, CMD_STOP, 0, 0, 0);
+		}
+		for (unsigned i = 0; i < s->nshards; i++)
+			pthread_join(s->shards[i].thread, NULL);
+		pthread_join(s->merger, NULL);
+		s->finished = 1;
+	}
+
+	if (stats)
+		memset(stats, 0, sizeof(*stats));
+	for (unsigned i = 0; i < s->nshards; i++) {
+		struct shard *sh = &s->shards[i];
+
+		if (sh->failed || !sh->sim)
+			ret = -1;
+		if (stats && sh->sim) {
+			const struct dram_stats *st = dram_get_stats(sh->sim);
+
+			stats->acts += st->acts;
+			stats->delayed += st->delayed;
+			stats->refs += st->refs;
+			stats->mitigations += st->mitigations;
+			stats->flips += st->flips;
+		}
+	}
+	return ret;
+}
+
+void dram_shards_destroy(struct dram_shards *s)
+{
+	if (!s)
+		return;
+
+	dram_shards_finish(s, NULL);
+	for (unsigned i = 0; i < s->nshards; i++) {
+		struct shard *sh = &s->shards[i];
+
+		dram_destroy(sh->sim);
+		spsc_free(&sh->cmds);
+		spsc_free(&sh->flips);
+		free(sh->held);
+	}
+	free(s->shards);
+	free(s);
+}
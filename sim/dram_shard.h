@@ -0,0 +1,46 @@
+#ifndef DRAM_SHARD_H
+#define DRAM_SHARD_H
+
+#include "dram.h"
+
+/*
+ * The DRAM model split over threads. Ranks share nothing in the model (tFAW
+ * and REF are per rank, tRC per bank), so every shard runs its own
+ * dram_sim over a contiguous block of ranks:
+ *
+ *   caller (demux) --SPSC--> shard 0 ... shard n-1 --SPSC--> merge --> cb
+ *
+ * The caller feeds ACTs as it would a single dram_sim; they are routed to
+ * the shard owning the rank. A merge thread collects the flips and calls
+ * `cb` in time order, flips at the same nanosecond in rank-block order. The
+ * flips, their order and the stats match a single-threaded run on the same
+ * input.
+ *
+ * Banks within a rank are coupled by tFAW, so a rank is the smallest unit
+ * that can be split off without changing the results; scaling needs a
+ * configuration with at least as many ranks (channels x ranks) as threads.
+ */
+
+struct dram_shards;
+
+// `nshards` is clamped to [1, cfg->ranks]. The callback runs on the merge
+// thread.
+struct dram_shards *dram_shards_create(const struct dram_config *cfg,
+				       unsigned nshards, dram_flip_cb cb,
+				       void *ctx);
+// Finishes the run if needed.
+void dram_shards_destroy(struct dram_shards *s);
+
+unsigned dram_shards_count(const struct dram_shards *s);
+
+// Same contract as dram_activate()/dram_run(), but both return as soon as
+// the work is queued.
+int dram_shards_activate(struct dram_shards *s, uint64_t time, unsigned rank,
+			 unsigned bank, unsigned row);
+void dram_shards_run(struct dram_shards *s, uint64_t until);
+
+// Drain every shard, deliver the remaining flips and stop the threads. No
+// more input is accepted afterwards. Returns -1 if a shard ran out of memory.
+int dram_shards_finish(struct dram_shards *s, struct dram_stats *stats);
+
+#endif
@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "dram.h"
+#include "dram_shard.h"
+
+static void print_flip(void *ctx, const struct dram_flip *flip)
+{
+	printf("flip: t=%lu ns rank %u bank %u row %u (aggressor %u)\n",
+	       flip->time, flip->rank, flip->bank, flip->row, flip->aggressor);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"USAGE: %s [-b bank] [-r victim row] [-s sides] [-n ACTs per aggressor per window]\n"
+		"          [-w hammered windows] [-i idle windows] [-H hc_first] [-T trr threshold]\n"
+		"          [-k ranks] [-j threads]\n",
+		prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	struct dram_config cfg;
+	struct dram_sim *sim = NULL;
+	struct dram_shards *shards = NULL;
+	struct dram_stats stats;
+	unsigned bank = 0, victim = 1000, sides = 2, threads = 1;
+	unsigned long acts = 20000, windows = 1, idle = 0;
+	int opt;
+
+	dram_default_config(&cfg);
+
+	while ((opt = getopt(argc, argv, "b:r:s:n:w:i:H:T:k:j:")) != -1) {
+		switch (opt) {
+		case 'b':
+			bank = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			victim = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			sides = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			acts = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			windows = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			idle = strtoul(optarg, NULL, 0);
+			break;
+		case 'H':
+			cfg.hc_first = strtoul(optarg, NULL, 0);
+			break;
+		case 'T':
+			cfg.trr_threshold = strtoul(optarg, NULL, 0);
+			cfg.trr_delay = cfg.timing.tREFI;
+			break;
+		case 'k':
+			cfg.ranks = strtoul(optarg, NULL, 0);
+			break;
+		case 'j':
+			threads = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (sides < 1 || sides > 2 || !acts || victim < 1 ||
+	    victim + 1 >= cfg.rows || !cfg.ranks || !threads)
+		usage(argv[0]);
+
+	if (threads > 1)
+		shards = dram_shards_create(&cfg, threads, print_flip, NULL);
+	else
+		sim = dram_create(&cfg, print_flip, NULL);
+	if (!sim && !shards) {
+		fprintf(stderr, "Failed to create the DRAM model\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// Spread the ACTs of each hammered window evenly over the window, then
+	// leave `idle` windows without any traffic. Every rank is hammered the
+	// same way.
+	uint64_t tREFW = cfg.timing.tREFW;
+	uint64_t gap = tREFW / (acts * sides);
+	uint64_t start = 0;
+
+	for (unsigned long w = 0; w < windows; w++) {
+		for (unsigned long i = 0; i < acts * sides; i++) {
+			uint64_t t = start + i * gap;
+			unsigned row = (i % sides) ? victim + 1 : victim - 1;
+
+			if (shards)
+				dram_shards_run(shards, t);
+			else
+				dram_run(sim, t);
+			for (unsigned r = 0; r < cfg.ranks; r++) {
+				int err = shards ? dram_shards_activate(shards,
+						t, r, bank, row) :
+					dram_activate(sim, t, r, bank, row);
+
+				if (err) {
+					fprintf(stderr, "Failed to queue ACT\n");
+					exit(EXIT_FAILURE);
+				}
+			}
+		}
+		start += (1 + idle) * tREFW;
+	}
+
+	if (shards) {
+		dram_shards_run(shards, start);
+		if (dram_shards_finish(shards, &stats)) {
+			fprintf(stderr, "Failed to queue ACT\n");
+			exit(EXIT_FAILURE);
+		}
+	} else {
+		dram_run(sim, start);
+		stats = *dram_get_stats(sim);
+	}
+
+	printf("simulated %lu ns: %lu ACTs (%lu delayed), %lu REFs, %lu TRR, %lu flips\n",
+	       start, stats.acts, stats.delayed, stats.refs,
+	       stats.mitigations, stats.flips);
+
+	dram_shards_destroy(shards);
+	dram_destroy(sim);
+	return 0;
+}
@@ -0,0 +1,344 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "buddy.h"
+#include "philox.h"
+
+#define PTRS_PER_PTE 512 // user pages mapped by one page-table page
+
+enum owner {
+	PG_FREE,
+	PG_OTHER, // background allocations
+	PG_ATTACKER,
+	PG_ATTACKER_PT,
+	PG_VICTIM,
+	PG_VICTIM_PT,
+};
+
+// Physical page to DRAM bank/row. A bank row spans `row_pages` pages and
+// the bank bits are XORed with the low row bits, as common controllers do.
+struct dram_map {
+	unsigned banks; // power of two
+	unsigned row_pages; // power of two
+};
+
+struct params {
+	uint32_t npages;
+	unsigned ncpus;
+	unsigned batch, high;
+	struct dram_map map;
+	double fill; // background occupancy before the attack
+	unsigned spray; // attacker data pages
+	unsigned stride; // the attacker frees every stride-th page
+	unsigned victim_pages;
+	unsigned attacker_cpu, victim_cpu;
+	uint64_t seed;
+	unsigned long trials;
+};
+
+enum {
+	ST_VICTIM_SINGLE, // a victim page next to an attacker row
+	ST_VICTIM_DOUBLE, // ... with attacker rows on both sides
+	ST_VICTIM_PT_SINGLE,
+	ST_VICTIM_PT_DOUBLE,
+	ST_VICTIM_REUSE, // a victim page the attacker had freed
+	ST_ATTACKER_PT_DOUBLE, // own page table between own rows
+	ST_OOM,
+	ST_COUNT,
+};
+
+static const char *const stat_names[ST_COUNT] = {
+	[ST_VICTIM_SINGLE] = "victim page, one side",
+	[ST_VICTIM_DOUBLE] = "victim page, both sides",
+	[ST_VICTIM_PT_SINGLE] = "victim page table, one side",
+	[ST_VICTIM_PT_DOUBLE] = "victim page table, both sides",
+	[ST_VICTIM_REUSE] = "victim page was freed by attacker",
+	[ST_ATTACKER_PT_DOUBLE] = "attacker page table, both sides",
+	[ST_OOM] = "out of memory",
+};
+
+struct worker {
+	const struct params *p;
+	pthread_t thread;
+	struct zone zone;
+	uint8_t *owner;
+	uint8_t *freed; // freed by the attacker this trial
+	uint32_t *bg, *spray;
+	unsigned long stats[ST_COUNT];
+};
+
+static unsigned long next_trial;
+
+static void pfn_to_row(const struct dram_map *m, uint32_t pfn,
+		       unsigned *bank, uint32_t *row)
+{
+	uint32_t chunk = pfn / m->row_pages;
+
+	*row = chunk / m->banks;
+	*bank = (chunk ^ *row) & (m->banks - 1);
+}
+
+static int row_owned(const struct worker *w, unsigned bank, int64_t row,
+		     enum owner who)
+{
+	const struct dram_map *m = &w->p->map;
+	uint64_t base;
+
+	if (row < 0)
+		return 0;
+	base = ((uint64_t)row * m->banks + ((bank ^ row) & (m->banks - 1))) *
+	       m->row_pages;
+	for (unsigned c = 0; c < m->row_pages; c++) {
+		if (base + c < w->p->npages && w->owner[base + c] == who)
+			return 1;
+	}
+	return 0;
+}
+
+// 1 if one neighbouring row holds an attacker page, 2 if both do.
+static int attacker_sides(const struct worker *w, uint32_t pfn)
+{
+	unsigned bank;
+	uint32_t row;
+
+	pfn_to_row(&w->p->map, pfn, &bank, &row);
+	return row_owned(w, bank, (int64_t)row - 1, PG_ATTACKER) +
+	       row_owned(w, bank, (int64_t)row + 1, PG_ATTACKER);
+}
+
+static uint32_t alloc_page(struct worker *w, unsigned cpu, enum owner who)
+{
+	uint32_t pfn = zone_alloc_page(&w->zone, cpu);
+
+	if (pfn != BUDDY_NIL)
+		w->owner[pfn] = who;
+	return pfn;
+}
+
+static void free_page(struct worker *w, unsigned cpu, uint32_t pfn)
+{
+	w->owner[pfn] = PG_FREE;
+	zone_free_page(&w->zone, cpu, pfn);
+}
+
+static void run_trial(struct worker *w, unsigned long trial)
+{
+	const struct params *p = w->p;
+	unsigned long nbg = p->fill * p->npages;
+	int reused = 0, best = 0, sides;
+	struct philox rng;
+	uint32_t pfn;
+
+	philox_init(&rng, p->seed, trial);
+	zone_reset(&w->zone);
+	memset(w->owner, PG_FREE, p->npages);
+	memset(w->freed, 0, p->npages);
+
+	// fragment memory: fill it from random CPUs, then free half at random
+	for (unsigned long i = 0; i < nbg; i++) {
+		w->bg[i] = alloc_page(w, philox_below(&rng, p->ncpus),
+				      PG_OTHER);
+		if (w->bg[i] == BUDDY_NIL)
+			goto oom;
+	}
+	for (unsigned long i = 0; i < nbg; i++) {
+		if (philox_u32(&rng) & 1)
+			free_page(w, philox_below(&rng, p->ncpus), w->bg[i]);
+	}
+
+	// spray: a page table page first for every PTRS_PER_PTE data pages
+	for (unsigned i = 0; i < p->spray; i++) {
+		if (i % PTRS_PER_PTE == 0 &&
+		    alloc_page(w, p->attacker_cpu, PG_ATTACKER_PT) == BUDDY_NIL)
+			goto oom;
+		w->spray[i] = alloc_page(w, p->attacker_cpu, PG_ATTACKER);
+		if (w->spray[i] == BUDDY_NIL)
+			goto oom;
+	}
+
+	for (uint32_t q = 0; q < p->npages; q++) {
+		if (w->owner[q] == PG_ATTACKER_PT && attacker_sides(w, q) == 2) {
+			w->stats[ST_ATTACKER_PT_DOUBLE]++;
+			break;
+		}
+	}
+
+	for (unsigned i = 0; i < p->spray; i += p->stride) {
+		w->freed[w->spray[i]] = 1;
+		free_page(w, p->attacker_cpu, w->spray[i]);
+	}
+
+	pfn = alloc_page(w, p->victim_cpu, PG_VICTIM_PT);
+	if (pfn == BUDDY_NIL)
+		goto oom;
+	sides = attacker_sides(w, pfn);
+	w->stats[ST_VICTIM_PT_SINGLE] += sides >= 1;
+	w->stats[ST_VICTIM_PT_DOUBLE] += sides == 2;
+
+	for (unsigned i = 0; i < p->victim_pages; i++) {
+		pfn = alloc_page(w, p->victim_cpu, PG_VICTIM);
+		if (pfn == BUDDY_NIL)
+			goto oom;
+		reused |= w->freed[pfn];
+		sides = attacker_sides(w, pfn);
+		if (sides > best)
+			best = sides;
+	}
+	w->stats[ST_VICTIM_SINGLE] += best >= 1;
+	w->stats[ST_VICTIM_DOUBLE] += best == 2;
+	w->stats[ST_VICTIM_REUSE] += reused;
+	return;
+
+oom:
+	w->stats[ST_OOM]++;
+}
+
+static void *worker_main(void *arg)
+{
+	struct worker *w = arg;
+	unsigned long t;
+
+	while ((t = __atomic_fetch_add(&next_trial, 1, __ATOMIC_RELAXED)) <
+	       w->p->trials)
+		run_trial(w, t);
+	return NULL;
+}
+
+static int worker_init(struct worker *w, const struct params *p)
+{
+	memset(w, 0, sizeof(*w));
+	w->p = p;
+	if (zone_init(&w->zone, p->npages, p->ncpus, p->batch, p->high))
+		return -1;
+	w->owner = malloc(p->npages);
+	w->freed = malloc(p->npages);
+	w->bg = malloc(((size_t)(p->fill * p->npages) + 1) * sizeof(*w->bg));
+	w->spray = malloc(((size_t)p->spray + 1) * sizeof(*w->spray));
+	return w->owner && w->freed && w->bg && w->spray ? 0 : -1;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"USAGE: %s [-m memory MB] [-c cpus] [-f background fill] [-s spray pages]\n"
+		"          [-k free stride] [-v victim pages] [-A attacker cpu] [-V victim cpu]\n"
+		"          [-B banks] [-R row KB] [-b pcp batch] [-H pcp high]\n"
+		"          [-n trials] [-j threads] [-S seed]\n",
+		prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	struct params p = {
+		.npages = 256 << 8, // 256MB
+		.ncpus = 4,
+		.batch = 63,
+		.high = 6 * 63,
+		.map = { .banks = 16, .row_pages = 2 },
+		.fill = 0.5,
+		.spray = 4096,
+		.stride = 2,
+		.victim_pages = 1,
+		.seed = 1,
+		.trials = 1000,
+	};
+	long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned long totals[ST_COUNT] = { 0 };
+	struct worker *workers;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "m:c:f:s:k:v:A:V:B:R:b:H:n:j:S:")) !=
+	       -1) {
+		switch (opt) {
+		case 'm':
+			p.npages = strtoul(optarg, NULL, 0) << 8;
+			break;
+		case 'c':
+			p.ncpus = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			p.fill = strtod(optarg, NULL);
+			break;
+		case 's':
+			p.spray = strtoul(optarg, NULL, 0);
+			break;
+		case 'k':
+			p.stride = strtoul(optarg, NULL, 0);
+			break;
+		case 'v':
+			p.victim_pages = strtoul(optarg, NULL, 0);
+			break;
+		case 'A':
+			p.attacker_cpu = strtoul(optarg, NULL, 0);
+			break;
+		case 'V':
+			p.victim_cpu = strtoul(optarg, NULL, 0);
+			break;
+		case 'B':
+			p.map.banks = strtoul(optarg, NULL, 0);
+			break;
+		case 'R':
+			p.map.row_pages = strtoul(optarg, NULL, 0) / 4;
+			break;
+		case 'b':
+			p.batch = strtoul(optarg, NULL, 0);
+			break;
+		case 'H':
+			p.high = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			p.trials = strtoul(optarg, NULL, 0);
+			break;
+		case 'j':
+			nthreads = strtol(optarg, NULL, 0);
+			break;
+		case 'S':
+			p.seed = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (!p.npages || !p.ncpus || p.attacker_cpu >= p.ncpus ||
+	    p.victim_cpu >= p.ncpus || p.fill < 0 || p.fill >= 1 ||
+	    !p.stride || !p.victim_pages || !p.trials || nthreads < 1 ||
+	    !p.map.banks || (p.map.banks & (p.map.banks - 1)) ||
+	    !p.map.row_pages || (p.map.row_pages & (p.map.row_pages - 1)))
+		usage(argv[0]);
+
+	workers = calloc(nthreads, sizeof(*workers));
+	if (!workers)
+		exit(EXIT_FAILURE);
+	for (long i = 0; i < nthreads; i++) {
+		if (worker_init(&workers[i], &p)) {
+			fprintf(stderr, "Failed to set up worker\n");
+			exit(EXIT_FAILURE);
+		}
+		pthread_create(&workers[i].thread, NULL, worker_main,
+			       &workers[i]);
+	}
+	for (long i = 0; i < nthreads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		for (int s = 0; s < ST_COUNT; s++)
+			totals[s] += workers[i].stats[s];
+	}
+
+	// every trial draws from its own (seed, trial) stream, so the counts
+	// do not depend on the thread count
+	printf("%lu trials, %u MB, %u cpus, seed %#llx\n", p.trials,
+	       p.npages >> 8, p.ncpus, (unsigned long long)p.seed);
+	for (int s = 0; s < ST_COUNT; s++) {
+		double prob = (double)totals[s] / p.trials;
+
+		printf("%-36s %8lu  %.4f +- %.4f\n", stat_names[s], totals[s],
+		       prob, 1.96 * sqrt(prob * (1 - prob) / p.trials));
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,91 @@
+#ifndef SPSC_H
+#define SPSC_H
+
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Bounded single-producer single-consumer ring of fixed-size elements.
+// Each side keeps a private copy of the other side's index and only reloads
+// it when the ring looks full (or empty), so the shared cache lines bounce
+// once per burst instead of once per element.
+#define SPSC_LINE 64
+
+struct spsc {
+	// consumer side
+	_Alignas(SPSC_LINE) size_t head;
+	size_t tail_seen;
+	// producer side
+	_Alignas(SPSC_LINE) size_t tail;
+	size_t head_seen;
+	_Alignas(SPSC_LINE) size_t mask;
+	size_t elem;
+	unsigned char *buf;
+};
+
+// `slots` must be a power of two.
+static inline int spsc_init(struct spsc *q, size_t slots, size_t elem)
+{
+	memset(q, 0, sizeof(*q));
+	q->mask = slots - 1;
+	q->elem = elem;
+	q->buf = malloc(slots * elem);
+	return q->buf ? 0 : -1;
+}
+
+static inline void spsc_free(struct spsc *q)
+{
+	free(q->buf);
+	q->buf = NULL;
+}
+
+static inline int spsc_push(struct spsc *q, const void *e)
+{
+	size_t tail = q->tail;
+
+	if (tail - q->head_seen > q->mask) {
+		q->head_seen = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+		if (tail - q->head_seen > q->mask)
+			return 0;
+	}
+	memcpy(q->buf + (tail & q->mask) * q->elem, e, q->elem);
+	__atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+static inline int spsc_pop(struct spsc *q, void *e)
+{
+	size_t head = q->head;
+
+	if (head == q->tail_seen) {
+		q->tail_seen = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+		if (head == q->tail_seen)
+			return 0;
+	}
+	memcpy(e, q->buf + (head & q->mask) * q->elem, q->elem);
+	__atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+// Spin a little, then yield, then sleep: idle stages must not starve busy
+// ones when there are fewer cores than threads.
+static inline void spsc_backoff(unsigned *spins)
+{
+	if (*spins < 64) {
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#elif defined(__aarch64__)
+		__asm__ volatile("yield");
+#endif
+	} else if (*spins < 1024) {
+		sched_yield();
+	} else {
+		struct timespec ts = { 0, 50000 };
+
+		nanosleep(&ts, NULL);
+	}
+	(*spins)++;
+}
+
+#endif
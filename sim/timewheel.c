@@ -0,0 +1,133 @@
+#include "timewheel.h"
+
+static void list_init(struct tw_event *head)
+{
+	head->next = head;
+	head->prev = head;
+}
+
+static void list_add_tail(struct tw_event *head, struct tw_event *ev)
+{
+	ev->prev = head->prev;
+	ev->next = head;
+	head->prev->next = ev;
+	head->prev = ev;
+}
+
+static void list_del(struct tw_event *ev)
+{
+	ev->prev->next = ev->next;
+	ev->next->prev = ev->prev;
+	ev->next = ev->prev = ev;
+}
+
+void tw_init(struct timewheel *tw, uint64_t now)
+{
+	tw->now = now;
+	tw->pending = 0;
+	for (int level = 0; level < TW_LEVELS; level++) {
+		tw->occupied[level] = 0;
+		for (int slot = 0; slot < TW_SLOTS; slot++)
+			list_init(&tw->slots[level][slot]);
+	}
+}
+
+static void tw_insert(struct timewheel *tw, struct tw_event *ev)
+{
+	uint64_t diff = ev->expires ^ tw->now;
+	int level = diff ? (63 - __builtin_clzll(diff)) / TW_SLOT_BITS : 0;
+	int slot = (ev->expires >> (level * TW_SLOT_BITS)) & (TW_SLOTS - 1);
+
+	list_add_tail(&tw->slots[level][slot], ev);
+	tw->occupied[level] |= 1ULL << slot;
+}
+
+static void tw_unlink(struct timewheel *tw, struct tw_event *ev)
+{
+	uint64_t diff = ev->expires ^ tw->now;
+	int level = diff ? (63 - __builtin_clzll(diff)) / TW_SLOT_BITS : 0;
+	int slot = (ev->expires >> (level * TW_SLOT_BITS)) & (TW_SLOTS - 1);
+	struct tw_event *head = &tw->slots[level][slot];
+
+	list_del(ev);
+	if (head->next == head)
+		tw->occupied[level] &= ~(1ULL << slot);
+}
+
+void tw_schedule(struct timewheel *tw, struct tw_event *ev, uint64_t expires)
+{
+	if (ev->pending)
+		tw_cancel(tw, ev);
+
+	ev->expires = (expires < tw->now) ? tw->now : expires;
+	ev->pending = 1;
+	tw->pending++;
+	tw_insert(tw, ev);
+}
+
+void tw_cancel(struct timewheel *tw, struct tw_event *ev)
+{
+	if (!ev->pending)
+		return;
+
+	tw_unlink(tw, ev);
+	ev->pending = 0;
+	tw->pending--;
+}
+
+struct tw_event *tw_next(struct timewheel *tw, uint64_t limit)
+{
+	for (;;) {
+		int level = 0;
+		while (level < TW_LEVELS && !tw->occupied[level])
+			level++;
+		if (level == TW_LEVELS)
+			break;
+
+		// The lowest occupied level always holds the earliest events:
+		// anything higher differs from `now` in a more significant
+		// block and therefore expires later.
+		int slot = __builtin_ctzll(tw->occupied[level]);
+		int shift = level * TW_SLOT_BITS;
+		int top = shift + TW_SLOT_BITS;
+		uint64_t keep = (top >= 64) ? 0 : ~((1ULL << top) - 1);
+		uint64_t start = (tw->now & keep) | ((uint64_t)slot << shift);
+
+		if (start > limit)
+			break;
+
+		struct tw_event *head = &tw->slots[level][slot];
+
+		if (level == 0) {
+			struct tw_event *ev = head->next;
+
+			tw->now = start;
+			tw_cancel(tw, ev);
+			return ev;
+		}
+
+		// Cascade the slot: jump straight to its start, every event
+		// in it now lands on a lower level.
+		struct tw_event list;
+
+		list_init(&list);
+		list.next = head->next;
+		list.prev = head->prev;
+		list.next->prev = &list;
+		list.prev->next = &list;
+		list_init(head);
+		tw->occupied[level] &= ~(1ULL << slot);
+		tw->now = start;
+
+		while (list.next != &list) {
+			struct tw_event *ev = list.next;
+
+			list_del(ev);
+			tw_insert(tw, ev);
+		}
+	}
+
+	if (limit != TW_FOREVER && limit > tw->now)
+		tw->now = limit;
+	return NULL;
+}
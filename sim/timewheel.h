@@ -0,0 +1,41 @@
+#ifndef TIMEWHEEL_H
+#define TIMEWHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Hierarchical timing wheel over simulated time (1 tick = 1 ns).
+// Level k holds events whose expiry differs from `now` first in bits
+// [6k, 6k + 6), so 11 levels of 64 slots cover the whole 64-bit range.
+#define TW_SLOT_BITS 6
+#define TW_SLOTS (1 << TW_SLOT_BITS)
+#define TW_LEVELS 11
+#define TW_FOREVER UINT64_MAX
+
+struct tw_event {
+	struct tw_event *next;
+	struct tw_event *prev;
+	uint64_t expires;
+	int type;
+	int pending;
+};
+
+struct timewheel {
+	uint64_t now;
+	size_t pending;
+	uint64_t occupied[TW_LEVELS];
+	struct tw_event slots[TW_LEVELS][TW_SLOTS]; // list heads
+};
+
+void tw_init(struct timewheel *tw, uint64_t now);
+
+// O(1): events in the past are clamped to `now`.
+void tw_schedule(struct timewheel *tw, struct tw_event *ev, uint64_t expires);
+void tw_cancel(struct timewheel *tw, struct tw_event *ev);
+
+// Pop the earliest event expiring at or before `limit` and advance `now` to
+// its expiry. Returns NULL once nothing is due; `now` is then fast-forwarded
+// to `limit` (unless limit is TW_FOREVER) without visiting empty slots.
+struct tw_event *tw_next(struct timewheel *tw, uint64_t limit);
+
+#endif
@@ -0,0 +1,117 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "snapdiff.h"
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+
+static inline int block_differs(const uint8_t *a, const uint8_t *b)
+{
+	uint8x16_t acc = veorq_u8(vld1q_u8(a), vld1q_u8(b));
+
+	acc = vorrq_u8(acc, veorq_u8(vld1q_u8(a + 16), vld1q_u8(b + 16)));
+	acc = vorrq_u8(acc, veorq_u8(vld1q_u8(a + 32), vld1q_u8(b + 32)));
+	acc = vorrq_u8(acc, veorq_u8(vld1q_u8(a + 48), vld1q_u8(b + 48)));
+	return vmaxvq_u8(acc) != 0;
+}
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+
+static inline int block_differs(const uint8_t *a, const uint8_t *b)
+{
+	const __m128i *va = (const __m128i *)a;
+	const __m128i *vb = (const __m128i *)b;
+	__m128i acc = _mm_xor_si128(_mm_load_si128(va), _mm_load_si128(vb));
+
+	acc = _mm_or_si128(acc, _mm_xor_si128(_mm_load_si128(va + 1),
+					      _mm_load_si128(vb + 1)));
+	acc = _mm_or_si128(acc, _mm_xor_si128(_mm_load_si128(va + 2),
+					      _mm_load_si128(vb + 2)));
+	acc = _mm_or_si128(acc, _mm_xor_si128(_mm_load_si128(va + 3),
+					      _mm_load_si128(vb + 3)));
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128())) !=
+	       0xFFFF;
+}
+#else
+static inline int block_differs(const uint8_t *a, const uint8_t *b)
+{
+	const uint64_t *wa = (const uint64_t *)a;
+	const uint64_t *wb = (const uint64_t *)b;
+	uint64_t acc = 0;
+
+	for (int i = 0; i < SNAP_BLOCK / 8; i++)
+		acc |= wa[i] ^ wb[i];
+	return acc != 0;
+}
+#endif
+
+int snapshot_take(pid_t pid, unsigned long start, size_t len,
+		  struct snapshot *snap)
+{
+	size_t padded = (len + SNAP_BLOCK - 1) & ~(size_t)(SNAP_BLOCK - 1);
+	struct iovec local, remote;
+	ssize_t n;
+
+	snap->start = start;
+	snap->len = len;
+	snap->data = aligned_alloc(SNAP_BLOCK, padded);
+	if (!snap->data) {
+		perror("Failed to allocate snapshot");
+		return -1;
+	}
+	memset(snap->data + len, 0, padded - len);
+
+	local.iov_base = snap->data;
+	local.iov_len = len;
+	remote.iov_base = (void *)start;
+	remote.iov_len = len;
+	n = process_vm_readv(pid, &local, 1, &remote, 1, 0);
+	if (n != (ssize_t)len) {
+		perror("process_vm_readv");
+		snapshot_free(snap);
+		return -1;
+	}
+
+	return 0;
+}
+
+void snapshot_free(struct snapshot *snap)
+{
+	free(snap->data);
+	snap->data = NULL;
+	snap->len = 0;
+}
+
+size_t snapshot_diff(const struct snapshot *before,
+		     const struct snapshot *after, struct snapdiff_rec *recs,
+		     size_t max)
+{
+	size_t len = before->len < after->len ? before->len : after->len;
+	size_t n = 0;
+
+	for (size_t off = 0; off < len; off += SNAP_BLOCK) {
+		if (!block_differs(before->data + off, after->data + off))
+			continue;
+
+		for (size_t w = off; w < off + SNAP_BLOCK && w < len; w += 8) {
+			uint64_t old, new;
+
+			memcpy(&old, before->data + w, sizeof(old));
+			memcpy(&new, after->data + w, sizeof(new));
+			if (old == new)
+				continue;
+			if (n < max) {
+				recs[n].addr = before->start + w;
+				recs[n].old = old;
+				recs[n].new = new;
+			}
+			n++;
+		}
+	}
+
+	return n;
+}
@@ -0,0 +1,34 @@
+#ifndef SNAPDIFF_H
+#define SNAPDIFF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define SNAP_BLOCK 64 // compared per step, one cache line
+
+struct snapshot {
+	unsigned long start;
+	size_t len;
+	uint8_t *data; // SNAP_BLOCK aligned, zero padded to a whole block
+};
+
+// One changed 64-bit word.
+struct snapdiff_rec {
+	unsigned long addr;
+	uint64_t old;
+	uint64_t new;
+};
+
+// Copy [start, start + len) out of `pid` with process_vm_readv.
+int snapshot_take(pid_t pid, unsigned long start, size_t len,
+		  struct snapshot *snap);
+void snapshot_free(struct snapshot *snap);
+
+// Compare two snapshots of the same range. Up to `max` changed words are
+// stored in `recs`; the total number of changed words is returned.
+size_t snapshot_diff(const struct snapshot *before,
+		     const struct snapshot *after, struct snapdiff_rec *recs,
+		     size_t max);
+
+#endif
@@ -0,0 +1,529 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+
+#include "libflip/flip.h"
+#include "heatmap.h"
+#include "results.h"
+#include "flipsched.h"
+#include "flippat.h"
+
+#define VICTIM_PATH "/usr/local/bin/mysudo"
+#define RESULTS_PATH "results.frs"
+#define TRIAL_TIMEOUT_NS 2000000000ULL
+// -m cap: weight 4 is already 35960 patterns per instruction, 2.3M trials
+// over the default 64 instructions, and every weight after it is several
+// times more
+#define MAX_WEIGHT 4
+
+// reward per outcome, relative to the unflipped baseline run
+#define REWARD_BYPASS 1.0 // exit 0 where the baseline failed
+#define REWARD_CHANGED 0.25 // some other clean exit
+#define REWARD_CRASH 0.05
+
+struct outcome {
+	int exit_status; // -1 if killed
+	int signal;
+	uint32_t insn_new;
+	uint64_t runtime_ns;
+};
+
+struct sweep {
+	struct heatmap hm;
+	struct sched sched;
+	char **argv;
+	const char *input;
+	const char *results_path;
+	struct outcome baseline;
+	unsigned long max_trials;
+	int keep_going;
+	int exhaustive; // also flips known to be undefined or no-ops
+	int max_weight; // bits flipped at once
+
+	pthread_mutex_t lock;
+	unsigned long trials;
+	unsigned long failed; // trials that could not be run to the end
+	int stop;
+	int weight; // of the patterns being run, 1 for the scheduled bits
+	struct patgen pg;
+};
+
+struct worker {
+	struct sweep *sw;
+	pthread_t thread;
+	struct flip_dev *dev;
+	struct rs_writer *results;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Flip the bits in `mask` of the instruction at `vaddr` while the victim is
+// stopped, so it never runs a single instruction unflipped. The aligned
+// 64-bit word around it never straddles a page.
+static int flip_now(struct worker *w, pid_t pid, unsigned long vaddr,
+		    uint32_t mask)
+{
+	uint64_t word = (uint64_t)mask << (8 * (vaddr & 7));
+
+	if (flip_mask(w->dev, pid, vaddr & ~7UL, &word, 1)) {
+		perror("ioctl failed");
+		return -1;
+	}
+	// the flip dies with the victim, keep the journal from growing
+	flip_commit(w->dev);
+	return 0;
+}
+
+// Let the victim run to its exit stop, killing it if it hangs.
+static int wait_exit(pid_t pid, struct outcome *out)
+{
+	uint64_t start = now_ns();
+	int status, sig = 0;
+	unsigned long msg;
+
+	for (;;) {
+		pid_t ret;
+
+		if (ptrace(PTRACE_CONT, pid, NULL, sig) < 0)
+			return -1;
+		while ((ret = waitpid(pid, &status, WNOHANG)) == 0) {
+			if (now_ns() - start > TRIAL_TIMEOUT_NS) {
+				kill(pid, SIGKILL);
+				waitpid(pid, &status, 0);
+				out->exit_status = -1;
+				out->signal = SIGKILL;
+				return -1;
+			}
+			usleep(200);
+		}
+		if (ret < 0)
+			return -1;
+
+		if (WIFEXITED(status) || WIFSIGNALED(status))
+			break;
+		if (status >> 8 == (SIGTRAP | (PTRACE_EVENT_EXIT << 8))) {
+			ptrace(PTRACE_GETEVENTMSG, pid, NULL, &msg);
+			status = msg;
+			break;
+		}
+		sig = WSTOPSIG(status);
+		if (sig == SIGTRAP)
+			sig = 0;
+	}
+
+	out->exit_status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+	out->signal = WIFSIGNALED(status) ? WTERMSIG(status) : 0;
+	out->runtime_ns = now_ns() - start;
+	return 0;
+}
+
+// The virtual DIMM only reaches memory the victim moved onto it: its text.
+static int adopt_text(struct flip_dev *dev, pid_t pid, const char *path)
+{
+	struct flip_map text;
+
+	if (flip_dev_backend(dev) != FLIP_BACKEND_VDIMM)
+		return 0;
+	if (flip_maps_find(pid, path, FLIP_PROT_EXEC, &text))
+		return -1;
+	return flip_vdimm_adopt(dev, pid, text.start, text.end - text.start);
+}
+
+// One run of the victim, with the bits in `mask` of the instruction at file
+// offset `offset` flipped before it starts. A zero mask runs it unflipped.
+static int run_trial(struct worker *w, unsigned long offset, uint32_t mask,
+		     struct outcome *out)
+{
+	struct sweep *sw = w->sw;
+	unsigned long vaddr = 0;
+	int status, ret = -1;
+	pid_t pid;
+
+	memset(out, 0, sizeof(*out));
+
+	pid = fork();
+	if (pid < 0) {
+		perror("fork failed");
+		return -1;
+	}
+	if (pid == 0) {
+		int fd = open(sw->input ? sw->input : "/dev/null", O_RDONLY);
+
+		if (fd < 0 || dup2(fd, STDIN_FILENO) < 0)
+			_exit(EXIT_FAILURE);
+		fd = open("/dev/null", O_WRONLY);
+		if (fd >= 0) {
+			dup2(fd, STDOUT_FILENO);
+			dup2(fd, STDERR_FILENO);
+		}
+		if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) < 0 ||
+		    flip_vdimm_inherit(w->dev))
+			_exit(EXIT_FAILURE);
+		execv(sw->argv[0], sw->argv);
+		_exit(EXIT_FAILURE);
+	}
+
+	if (waitpid(pid, &status, 0) < 0 || !WIFSTOPPED(status))
+		return -1;
+	ptrace(PTRACE_SETOPTIONS, pid, 0,
+	       PTRACE_O_EXITKILL | PTRACE_O_TRACEEXIT);
+
+	if (mask) {
+		if (flip_offset_to_vaddr(pid, sw->hm.path, offset, &vaddr) ||
+		    adopt_text(w->dev, pid, sw->hm.path) ||
+		    flip_now(w, pid, vaddr, mask))
+			goto out;
+	}
+
+	ret = wait_exit(pid, out);
+	if (ret == 0 && mask)
+		out->insn_new = ptrace(PTRACE_PEEKTEXT, pid, (void *)vaddr,
+				       NULL);
+
+out:
+	if (ret)
+		kill(pid, SIGKILL);
+	ptrace(PTRACE_DETACH, pid, NULL, NULL);
+	waitpid(pid, NULL, 0);
+	return ret;
+}
+
+static double reward_of(const struct outcome *base, const struct outcome *o)
+{
+	if (o->signal)
+		return REWARD_CRASH;
+	if (o->exit_status == base->exit_status)
+		return 0;
+	if (o->exit_status == 0)
+		return REWARD_BYPASS;
+	return REWARD_CHANGED;
+}
+
+// Log a finished trial and hand single-bit results to the pattern
+// generator; a bypass stops the sweep unless -a, and makes the patterns
+// containing it redundant.
+static void record(struct worker *w, unsigned long offset, uint32_t insn,
+		   uint32_t mask, const struct outcome *out, double reward)
+{
+	struct sweep *sw = w->sw;
+	int bit = __builtin_ctz(mask);
+	struct rs_row row = {
+		.addr = offset,
+		.runtime_ns = out->runtime_ns,
+		.insn_old = insn,
+		.insn_new = out->insn_new,
+		.exit_status = out->exit_status,
+		.victim = sw->hm.path,
+		.method = mask & (mask - 1) ? "pattern" : "sweep",
+		.bit = bit, // the lowest, insn_old ^ insn_new has the rest
+		.signal = out->signal,
+	};
+
+	if (w->results)
+		rs_append(w->results, &row);
+	if (!(mask & (mask - 1))) {
+		enum pat_result r = out->signal ? PAT_CRASH :
+				    reward == 0 ? PAT_QUIET : PAT_CHANGED;
+
+		pthread_mutex_lock(&sw->lock);
+		patgen_single(&sw->pg, offset, mask, r);
+		pthread_mutex_unlock(&sw->lock);
+	}
+	if (reward != REWARD_BYPASS)
+		return;
+
+	if (mask & (mask - 1))
+		printf("exploitable: offset %#lx mask %#010x (%s %s), %#x -> %#x\n",
+		       offset, mask, a64_class_name[a64_class_of(insn)],
+		       a64_outcome_name[a64_mask_outcome(insn, mask)], insn,
+		       out->insn_new);
+	else
+		printf("exploitable: offset %#lx bit %u (%s %s), %#x -> %#x\n",
+		       offset, bit, a64_class_name[a64_class_of(insn)],
+		       a64_field_name[a64_field_of(insn, bit)], insn,
+		       out->insn_new);
+	pthread_mutex_lock(&sw->lock);
+	patgen_found(&sw->pg, offset, mask);
+	if (!sw->keep_going)
+		sw->stop = 1;
+	pthread_mutex_unlock(&sw->lock);
+}
+
+static void *worker_main(void *arg)
+{
+	struct worker *w = arg;
+	struct sweep *sw = w->sw;
+
+	for (;;) {
+		struct pattern pat;
+		struct outcome out;
+		double reward = 0;
+		unsigned long offset;
+		uint32_t insn, mask;
+		long cand = -1;
+		int ret, have_pat = 0;
+
+		// a trial is only counted once there is a candidate for it
+		pthread_mutex_lock(&sw->lock);
+		if (!sw->stop && sw->trials < sw->max_trials) {
+			if (sw->weight > 1)
+				have_pat = patgen_next(&sw->pg, &pat);
+			else
+				cand = sched_next(&sw->sched);
+		}
+		if (have_pat || cand >= 0)
+			sw->trials++;
+		pthread_mutex_unlock(&sw->lock);
+
+		// patterns go out by instruction in turn, deferred ones last;
+		// the arms are for single bits
+		if (have_pat) {
+			offset = pat.offset;
+			insn = pat.insn;
+			mask = pat.mask;
+		} else if (cand >= 0) {
+			offset = sw->sched.cands[cand].offset;
+			insn = sw->sched.cands[cand].insn;
+			mask = 1u << sw->sched.cands[cand].bit;
+		} else {
+			break;
+		}
+
+		ret = run_trial(w, offset, mask, &out);
+		if (ret == 0)
+			reward = reward_of(&sw->baseline, &out);
+		if (cand >= 0)
+			sched_report(&sw->sched, cand, reward);
+
+		// nothing ran, or the victim was lost: no row to log
+		if (ret) {
+			pthread_mutex_lock(&sw->lock);
+			sw->failed++;
+			pthread_mutex_unlock(&sw->lock);
+			continue;
+		}
+		record(w, offset, insn, mask, &out, reward);
+	}
+
+	return NULL;
+}
+
+static void run_workers(struct worker *workers, unsigned nworkers)
+{
+	for (unsigned i = 0; i < nworkers; i++)
+		pthread_create(&workers[i].thread, NULL, worker_main,
+			       &workers[i]);
+	for (unsigned i = 0; i < nworkers; i++)
+		pthread_join(workers[i].thread, NULL);
+}
+
+static int worker_setup(struct worker *w, struct sweep *sw)
+{
+	w->sw = sw;
+	w->dev = flip_dev_open(NULL);
+	if (!w->dev) {
+		perror("Failed to open the device");
+		return -1;
+	}
+
+	// one writer per worker, they append whole blocks independently
+	w->results = rs_writer_open(sw->results_path);
+	return 0;
+}
+
+static unsigned long patterns_pruned(const struct patgen *g)
+{
+	return g->decoded + g->covered + g->superset;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"USAGE: %s [-j workers] [-n max trials] [-k candidate instructions]\n"
+		"          [-r profile runs] [-p sample period] [-i stdin file] [-o results]\n"
+		"          [-m max flipped bits] [-a] [-x] [victim [args...]]\n",
+		prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	static char *default_argv[] = { VICTIM_PATH, "../test/test-exe",
+					NULL };
+	struct sweep sw = {
+		.argv = default_argv,
+		.results_path = RESULTS_PATH,
+		.max_trials = ~0UL,
+		.max_weight = 1,
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+	};
+	struct flip_candidate *cands;
+	struct a64_flips *flips;
+	uint32_t *insns;
+	struct worker *workers;
+	unsigned long top = 64, period = 1000;
+	unsigned nworkers = 4, runs = 3;
+	size_t ncands, pruned = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "+j:n:k:r:p:i:o:m:ax")) != -1) {
+		switch (opt) {
+		case 'j':
+			nworkers = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			sw.max_trials = strtoul(optarg, NULL, 0);
+			break;
+		case 'k':
+			top = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			runs = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			period = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			sw.input = optarg;
+			break;
+		case 'o':
+			sw.results_path = optarg;
+			break;
+		case 'm':
+			sw.max_weight = strtoul(optarg, NULL, 0);
+			break;
+		case 'a':
+			sw.keep_going = 1;
+			break;
+		case 'x':
+			sw.exhaustive = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind < argc)
+		sw.argv = &argv[optind];
+	if (!nworkers || !top || !runs || sw.max_weight < 1 ||
+	    sw.max_weight > MAX_WEIGHT)
+		usage(argv[0]);
+
+	// profile first, cold code is never scheduled
+	if (heatmap_init(&sw.hm, sw.argv[0]))
+		exit(EXIT_FAILURE);
+	for (unsigned i = 0; i < runs; i++)
+		heatmap_run(&sw.hm, sw.argv, sw.input, period);
+	if (!sw.hm.runs)
+		exit(EXIT_FAILURE);
+	heatmap_finish(&sw.hm);
+
+	cands = calloc(top, sizeof(*cands));
+	flips = calloc(top, sizeof(*flips));
+	insns = calloc(top, sizeof(*insns));
+	workers = calloc(nworkers, sizeof(*workers));
+	if (!cands || !flips || !insns || !workers ||
+	    sched_init(&sw.sched, 0))
+		exit(EXIT_FAILURE);
+	ncands = heatmap_rank(&sw.hm, cands, top);
+
+	// a flip that only raises SIGILL or changes nothing needs no trial,
+	// and the patterns made of such bits are tried last
+	for (size_t i = 0; i < ncands; i++)
+		insns[i] = cands[i].insn;
+	a64_classify(insns, ncands, flips);
+	patgen_init(&sw.pg, sw.exhaustive);
+	for (size_t i = 0; i < ncands; i++) {
+		uint32_t bits = 0xFFFFFFFF;
+
+		if (patgen_add(&sw.pg, cands[i].offset, cands[i].insn,
+			       cands[i].score))
+			exit(EXIT_FAILURE);
+		patgen_single(&sw.pg, cands[i].offset,
+			      flips[i].bits[A64_O_UNDEFINED], PAT_CRASH);
+		patgen_single(&sw.pg, cands[i].offset,
+			      flips[i].bits[A64_O_SAME], PAT_QUIET);
+
+		if (!sw.exhaustive)
+			bits &= ~(flips[i].bits[A64_O_UNDEFINED] |
+				  flips[i].bits[A64_O_SAME]);
+		pruned += 32 - __builtin_popcount(bits);
+		sched_add_bits(&sw.sched, cands[i].offset, cands[i].insn, bits,
+			       cands[i].score);
+	}
+	printf("%zu instructions, %zu candidates, %zu pruned\n", ncands,
+	       sw.sched.ncands, pruned);
+
+	for (unsigned i = 0; i < nworkers; i++) {
+		if (worker_setup(&workers[i], &sw))
+			exit(EXIT_FAILURE);
+	}
+
+	if (run_trial(&workers[0], 0, 0, &sw.baseline)) {
+		fprintf(stderr, "baseline run failed\n");
+		exit(EXIT_FAILURE);
+	}
+	printf("baseline: exit %d signal %d\n", sw.baseline.exit_status,
+	       sw.baseline.signal);
+
+	sw.weight = 1;
+	run_workers(workers, nworkers);
+
+	// then heavier patterns, each weight knowing what the lighter found;
+	// they are generated as trials take them, up to the trial budget
+	for (int k = 2; k <= sw.max_weight && !sw.stop &&
+			sw.trials < sw.max_trials; k++) {
+		unsigned long pruned = patterns_pruned(&sw.pg);
+		unsigned long trials = sw.trials;
+
+		patgen_weight(&sw.pg, k);
+		sw.weight = k;
+		run_workers(workers, nworkers);
+		printf("%d-bit patterns: %lu trials, %lu pruned\n", k,
+		       sw.trials - trials, patterns_pruned(&sw.pg) - pruned);
+	}
+	if (sw.max_weight > 1)
+		printf("patterns pruned: %lu decoded, %lu covered, %lu containing a finding; %lu deferred\n",
+		       sw.pg.decoded, sw.pg.covered, sw.pg.superset,
+		       sw.pg.deferred);
+
+	for (unsigned i = 0; i < nworkers; i++) {
+		rs_writer_close(workers[i].results);
+		flip_dev_close(workers[i].dev);
+	}
+
+	printf("%lu trials, %lu failed\n\n%-12s %-8s %8s %8s\n", sw.trials,
+	       sw.failed, "class", "field", "trials", "reward");
+	for (size_t a = 0; a < A64_NCLASSES * A64_NFIELDS; a++) {
+		const struct sched_arm *arm = &sw.sched.arms[a];
+
+		if (!arm->pulls)
+			continue;
+		printf("%-12s %-8s %8lu %8.3f\n", a64_class_name[arm->cls],
+		       a64_field_name[arm->field], arm->pulls,
+		       arm->reward / arm->pulls);
+	}
+
+	sched_free(&sw.sched);
+	patgen_free(&sw.pg);
+	heatmap_free(&sw.hm);
+	free(cands);
+	free(flips);
+	free(insns);
+	free(workers);
+	return EXIT_SUCCESS;
+}